@@ -125,6 +125,15 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to memory, which holds at least count()
+   *        elements and may also back the data of other Blob%s.
+   *
+   * Reshaping beyond what memory holds gives the Blob new memory of its own.
+   */
+  void SetDataMemory(const shared_ptr<SyncedMemory>& memory);
+  /// @brief Like SetDataMemory, for the diff_ shared_ptr.
+  void SetDiffMemory(const shared_ptr<SyncedMemory>& memory);
 
  protected:
   shared_ptr<SyncedMemory> data_;
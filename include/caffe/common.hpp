@@ -61,6 +61,8 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+class ThreadPool;
+
 // A global initialization function that you should call in your main function.
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
@@ -128,12 +130,31 @@ class Caffe {
   // Prints the current GPU status.
   static void DeviceQuery();
 
+  // The number of threads, including the calling one, that CPU kernels such
+  // as im2col_cpu split their work over. Defaults to the number of hardware
+  // threads.
+  static int cpu_threads();
+  // Sets cpu_threads; 0 restores the default. Must not be called while a CPU
+  // kernel is running.
+  static void set_cpu_threads(const int num_threads);
+  // The pool backing cpu_threads, created on first use. Safe to call from any
+  // thread.
+  static ThreadPool* cpu_thread_pool();
+  // The fewest elements that element-wise CPU kernels hand to a thread of
+  // cpu_thread_pool(); smaller arrays run on the calling thread. See
+  // ParallelFor.
+  inline static int cpu_grain_size() { return Get().cpu_grain_size_; }
+  static void set_cpu_grain_size(const int grain_size);
+
  protected:
 #ifndef CPU_ONLY
   cublasHandle_t cublas_handle_;
   curandGenerator_t curand_generator_;
 #endif
   shared_ptr<RNG> random_generator_;
+  int cpu_threads_;
+  shared_ptr<ThreadPool> cpu_thread_pool_;
+  int cpu_grain_size_;
 
   Brew mode_;
   Phase phase_;
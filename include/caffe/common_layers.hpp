@@ -8,10 +8,12 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
+#include "caffe/fused_activation.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/quantization.hpp"
 
 namespace caffe {
 
@@ -265,6 +267,9 @@ class InnerProductLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual void BlobsChanged() {
+    if (quantized_gemm_) { quantized_gemm_->Invalidate(); }
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -281,6 +286,11 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  /// The activation applied to the top, if layer_param_ has fused_activation.
+  shared_ptr<FusedActivation<Dtype> > fused_activation_;
+  /// The int8 products of the CPU forward pass in the TEST phase, if
+  /// layer_param_ has quantization_param.
+  shared_ptr<QuantizedGemm<Dtype> > quantized_gemm_;
 };
 
 /**
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -17,6 +19,8 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/window_file.hpp"
 
 namespace caffe {
 
@@ -67,12 +71,33 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+/**
+ * @brief One prefetched batch: the data and (optionally) label blobs that a
+ *        BasePrefetchingDataLayer fills in the background.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+};
+
+/**
+ * @brief Provides base for data layers that load batches on a long-lived
+ *        background thread.
+ *
+ * The layer owns a ring of prefetch_count() batches cycling between two
+ * blocking queues: the prefetch thread pops an empty batch from
+ * prefetch_free_, fills it with LoadBatch, and pushes it to prefetch_full_;
+ * Forward pops the next full batch and points the top blobs at its memory
+ * without copying. The batch handed out is only recycled at the following
+ * Forward, so tops stay valid for the whole iteration.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
   explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+      : BaseDataLayer<Dtype>(param), current_batch_(NULL) {}
   virtual ~BasePrefetchingDataLayer() {}
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
@@ -86,13 +111,25 @@ class BasePrefetchingDataLayer :
       vector<Blob<Dtype>*>* top);
 
   virtual void CreatePrefetchThread();
+  // Stops the prefetch thread; subclasses must call this in their destructor
+  // before any state used by LoadBatch is torn down.
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: keeps filling free batches until stopped.
+  virtual void InternalThreadEntry();
+  // Fills one batch; implemented by each data layer and run on the prefetch
+  // thread. The batch blobs are already shaped like the tops.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+  // The number of batches kept in flight, read from the layer's own params.
+  virtual inline int prefetch_count() const { return 3; }
+  // Hands the next full batch to the tops, recycling the previous one.
+  void NextBatch(vector<Blob<Dtype>*>* top);
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  Batch<Dtype>* current_batch_;
 };
 
 template <typename Dtype>
@@ -112,7 +149,21 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual inline int prefetch_count() const {
+    return this->layer_param_.data_param().prefetch();
+  }
+  void TransformItems(Batch<Dtype>* batch, const int worker_id);
+
+  // Transformation workers; see DataParameter.num_workers.
+  shared_ptr<ThreadPool> workers_;
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  // The batch's datums hold only the header fields; their pixels are read
+  // in place from item_data_, which points into the LMDB map or, for
+  // LevelDB, whose values do not outlive the iterator, into item_buffers_.
+  vector<Datum> datums_;
+  vector<const char*> item_data_;
+  vector<string> item_buffers_;
 
   // LEVELDB
   shared_ptr<leveldb::DB> db_;
@@ -162,19 +213,22 @@ class DummyDataLayer : public Layer<Dtype> {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * The files listed in the source are streamed on the prefetch thread rather
+ * than loaded whole: rows are read chunk_size at a time as hyperslabs of the
+ * "data" and "label" datasets, and at most resident_chunks chunks are held in
+ * memory besides the prefetched batches. With shuffle, the file order and the
+ * chunk order within each file are shuffled every epoch, and so are the rows
+ * of the resident chunks.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), file_id_(-1), data_id_(-1),
+        label_id_(-1) {}
   virtual ~HDF5DataLayer();
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
-  // Data layers have no bottoms, so reshaping is trivial.
-  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {}
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_HDF5_DATA;
@@ -183,45 +237,66 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual inline int prefetch_count() const {
+    return this->layer_param_.hdf5_data_param().prefetch();
+  }
+  // Opens the file_permutation_[current_file_]-th file and lays out its
+  // chunks; the data and label datasets stay open until CloseHDF5File.
+  virtual void OpenHDF5File();
+  virtual void CloseHDF5File();
+  // Refills data_blob_ and label_blob_ with the next resident_chunks chunks,
+  // moving on to the next file (and epoch) as needed.
+  virtual void LoadChunks();
+  // Reads rows [row, row + rows) of dataset into the rows of blob starting at
+  // blob_row.
+  void ReadRows(hid_t dataset, hsize_t row, hsize_t rows, Blob<Dtype>* blob,
+      int blob_row);
 
   std::vector<std::string> hdf_filenames_;
-  unsigned int num_files_;
+  vector<int> file_permutation_;
   unsigned int current_file_;
-  hsize_t current_row_;
+  hid_t file_id_;
+  hid_t data_id_;
+  hid_t label_id_;
+  hsize_t file_rows_;
+  // The first row of each chunk of the open file, in reading order.
+  vector<hsize_t> chunk_begin_;
+  unsigned int current_chunk_;
+  int chunk_size_;
+  // The resident chunks, and the order in which their rows are handed out.
   Blob<Dtype> data_blob_;
   Blob<Dtype> label_blob_;
+  vector<int> row_permutation_;
+  int resident_rows_;
+  int current_row_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
 };
 
 /**
- * @brief Write blobs to disk as HDF5 files.
+ * @brief Appends its bottoms to datasets of an HDF5 file, a batch per
+ *        Forward, for as long as the layer lives.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Each bottom goes to its own extendible dataset, chunked along the rows and
+ * optionally gzip-compressed, created at the first Forward. Forward only
+ * copies the bottoms into a free buffer and queues it; a background thread
+ * writes the buffers in order, and the destructor waits for all of them to
+ * be written before closing the file.
  */
 template <typename Dtype>
-class HDF5OutputLayer : public Layer<Dtype> {
+class HDF5OutputLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5OutputLayer(const LayerParameter& param);
   virtual ~HDF5OutputLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {}
-  // Data layers have no bottoms, so reshaping is trivial.
+      vector<Blob<Dtype>*>* top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {}
+      vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_HDF5_OUTPUT;
   }
-  // TODO: no limit on the number of blobs
-  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 0; }
 
   inline std::string file_name() const { return file_name_; }
@@ -232,20 +307,35 @@ class HDF5OutputLayer : public Layer<Dtype> {
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
-  virtual void SaveBlobs();
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
+  // The writer thread's function: writes queued buffers until it pops -1.
+  virtual void InternalThreadEntry();
+  // Pops a free buffer, waiting for the writer if there is none, and shapes
+  // its blobs like the bottoms.
+  int NextBuffer(const vector<Blob<Dtype>*>& bottom);
+  // Appends the blobs of buffer to the datasets; run on the writer thread.
+  void WriteBuffer(const vector<shared_ptr<Blob<Dtype> > >& buffer);
+  void CreateDataset(int i, const Blob<Dtype>& blob);
 
   std::string file_name_;
   hid_t file_id_;
-  Blob<Dtype> data_blob_;
-  Blob<Dtype> label_blob_;
+  vector<string> dataset_names_;
+  vector<hid_t> dataset_ids_;
+  hsize_t rows_written_;
+  vector<vector<shared_ptr<Blob<Dtype> > > > buffers_;
+  BlockingQueue<int> write_free_;
+  BlockingQueue<int> write_full_;
 };
 
 /**
  * @brief Provides data to the Net from image files.
  *
+ * The images of a batch are decoded and transformed in parallel, each
+ * straight into its slot of the batch, by image_data_param.decode_threads
+ * threads.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
@@ -266,10 +356,24 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual inline int prefetch_count() const {
+    return this->layer_param_.image_data_param().prefetch();
+  }
+  // Decodes and transforms item item_id of a batch, whose data blob
+  // data_blob has its CPU data at top_data, from its line and random draws;
+  // called concurrently for the items of a batch.
+  void LoadItem(const Blob<Dtype>& data_blob, Dtype* top_data,
+      Dtype* top_label, const int item_id);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  shared_ptr<ThreadPool> decode_pool_;
+  // The line, random draws and pixel buffer of each item of the batch
+  // being loaded.
+  vector<int> item_lines_;
+  vector<typename DataTransformer<Dtype>::RandomDraws> item_draws_;
+  vector<string> item_buffers_;
 };
 
 /**
@@ -319,11 +423,14 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
  *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
+class WindowImageCache;
+
 template <typename Dtype>
 class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit WindowDataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), cache_hits_(0),
+        cache_misses_(0) {}
   virtual ~WindowDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -334,15 +441,28 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
+  /// @brief Windows whose image came from the decoded image cache.
+  uint64_t cache_hits() const { return cache_hits_; }
+  /// @brief Windows whose image had to be decoded, with the cache enabled.
+  uint64_t cache_misses() const { return cache_misses_; }
+
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual inline int prefetch_count() const {
+    return this->layer_param_.window_data_param().prefetch();
+  }
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
-  vector<std::pair<std::string, vector<int> > > image_database_;
-  enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
-  vector<vector<float> > fg_windows_;
-  vector<vector<float> > bg_windows_;
+  WindowFile windows_;
+  /// Foreground windows are [0, num_fg_windows_) of windows_, and background
+  /// windows [bg_windows_begin_, num_windows()).
+  int num_fg_windows_;
+  int bg_windows_begin_;
+  /// Decoded images by their index in windows_, if cache_bytes is positive.
+  shared_ptr<WindowImageCache> image_cache_;
+  uint64_t cache_hits_;
+  uint64_t cache_misses_;
 };
 
 }  // namespace caffe
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <vector>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -16,6 +18,9 @@ class DataTransformer {
   explicit DataTransformer(const TransformationParameter& param)
     : param_(param) {
     phase_ = Caffe::phase();
+    for (int i = 0; i < param_.mean_value_size(); ++i) {
+      mean_values_.push_back(param_.mean_value(i));
+    }
   }
   virtual ~DataTransformer() {}
 
@@ -31,6 +36,8 @@ class DataTransformer {
    * @param datum
    *    Datum containing the data to be transformed.
    * @param mean
+   *    Mean image to subtract; ignored, and may be NULL, if the parameters
+   *    give mean_value.
    * @param transformed_data
    *    This is meant to be the top blob's data. The transformed data will be
    *    written at the appropriate place within the blob's data.
@@ -38,12 +45,51 @@ class DataTransformer {
   void Transform(const int batch_item_id, const Datum& datum,
                  const Dtype* mean, Dtype* transformed_data);
 
+  /**
+   * @brief As above, but reads the uint8 pixels from data instead of
+   *        datum.data(), e.g. straight from a database page.
+   *
+   * @param datum
+   *    Datum giving the dimensions. Its float_data is used if data is NULL.
+   * @param data
+   *    channels * height * width uint8 pixels, or NULL.
+   */
+  void Transform(const int batch_item_id, const Datum& datum,
+                 const char* data, const Dtype* mean, Dtype* transformed_data);
+
+  /**
+   * @brief The random numbers one Transform call consumes: the crop offsets
+   *        and the mirror choice, where the parameters call for them.
+   */
+  struct RandomDraws {
+    unsigned int h_off;
+    unsigned int w_off;
+    unsigned int mirror;
+  };
+
+  /**
+   * @brief Draws the random numbers that the next Transform call would.
+   *
+   * Drawing them up front in item order and passing them to the overload
+   * below lets several threads transform the items of a batch at once with
+   * the same results as transforming them one after another.
+   */
+  void DrawRandom(RandomDraws* draws);
+
+  /**
+   * @brief As above, but takes its random numbers from draws instead of the
+   *        transformer's RNG, so it may be called concurrently.
+   */
+  void Transform(const int batch_item_id, const Datum& datum,
+                 const char* data, const Dtype* mean, Dtype* transformed_data,
+                 const RandomDraws& draws);
+
  protected:
   virtual unsigned int Rand();
 
   // Tranformation parameters
   TransformationParameter param_;
-
+  vector<Dtype> mean_values_;
 
   shared_ptr<Caffe::RNG> rng_;
   Caffe::Phase phase_;
@@ -0,0 +1,65 @@
+#ifndef CAFFE_FUSED_ACTIVATION_HPP_
+#define CAFFE_FUSED_ACTIVATION_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief An in-place neuron layer folded into the Convolution or InnerProduct
+ *        layer that produces its input (see Net::FuseActivations).
+ *
+ * On the CPU the producing layer activates each part of its top right after
+ * computing it, while it is still in cache, and turns the top diff into the
+ * diff of its pre-activation output before running its own backward pass.
+ * Both steps only read the activated output, which is all an in-place layer
+ * keeps anyway, so only activations whose derivative is a function of their
+ * output can be fused: ReLU with a non-negative slope, Sigmoid, TanH and
+ * Power with power 1. On the GPU the neuron layer itself runs over the top.
+ */
+template <typename Dtype>
+class FusedActivation {
+ public:
+  explicit FusedActivation(const LayerParameter& param);
+
+  /// @brief Returns whether the neuron layer param can be fused.
+  static bool CanFuse(const LayerParameter& param);
+
+  /// @brief Applies the activation to data[0, n) in place.
+  void Forward_cpu(const int n, Dtype* data) const;
+  /// @brief Multiplies diff[0, n) by the derivative of the activation at
+  ///        the activated outputs data[0, n).
+  void Backward_cpu(const int n, const Dtype* data, Dtype* diff) const;
+
+  /// @brief Runs the neuron layer forward in place over the whole blob.
+  void Forward(Blob<Dtype>* blob);
+  /// @brief Runs the neuron layer backward in place over the whole blob.
+  void Backward(Blob<Dtype>* blob);
+
+  inline const LayerParameter& layer_param() const { return layer_param_; }
+
+ protected:
+  void ForwardRange(Dtype* data, const int begin, const int end) const;
+  void BackwardRange(const Dtype* data, Dtype* diff, const int begin,
+                     const int end) const;
+  // Sets up layer_ in place over blob the first time it is needed.
+  void SetUpLayer(Blob<Dtype>* blob);
+
+  LayerParameter layer_param_;
+  LayerParameter_LayerType type_;
+  Dtype negative_slope_;
+  Dtype scale_;
+  Dtype shift_;
+  shared_ptr<Layer<Dtype> > layer_;
+
+  DISABLE_COPY_AND_ASSIGN(FusedActivation);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_FUSED_ACTIVATION_HPP_
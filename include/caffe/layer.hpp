@@ -31,7 +31,7 @@ class Layer {
    * layer.
    */
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), replay_(false) {
       // The only thing we do is to copy blobs if there are any.
       if (layer_param_.blobs_size() > 0) {
         blobs_.resize(layer_param_.blobs_size());
@@ -154,6 +154,25 @@ class Layer {
    */
   const LayerParameter& layer_param() const { return layer_param_; }
 
+  /**
+   * @brief Sets whether Forward recomputes the outputs of the previous
+   *        Forward, as Net does for the blobs it drops between checkpoints.
+   *
+   * Layers that draw random numbers in Forward reuse their previous draws
+   * while replaying, so that the recomputed outputs match.
+   */
+  inline void set_replay(const bool replay) { replay_ = replay; }
+
+  /**
+   * @brief Tells the layer that its blobs were given new values, as Net does
+   *        after it copies or shares trained weights into them and in Update.
+   *
+   * Layers that keep something derived from their blobs, such as quantized
+   * weights, compute it again. Code writing to the blobs directly should call
+   * this too.
+   */
+  virtual void BlobsChanged() {}
+
   /**
    * @brief Writes the layer parameter to a protocol buffer
    */
@@ -304,6 +323,9 @@ class Layer {
    *  the objective function. */
   vector<Dtype> loss_;
 
+  /** Whether Forward replays the previous Forward; see set_replay. */
+  bool replay_;
+
   /** @brief Using the CPU device, compute the layer output. */
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) = 0;
@@ -71,7 +71,8 @@ class Net {
    * @brief Reshape all layers from bottom to top.
    *
    * This is useful to propagate changes to layer sizes without running
-   * a forward pass, e.g. to compute output feature size.
+   * a forward pass, e.g. to compute output feature size. With
+   * share_blob_memory it also plans the shared memory for the new sizes.
    */
   void Reshape();
 
@@ -142,11 +143,21 @@ class Net {
   inline vector<int>& output_blob_indices() { return net_output_blob_indices_; }
   bool has_blob(const string& blob_name);
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name);
+  /// @brief Layers are also found by the names of the activations fused into
+  ///        them, see fuse_activations.
   bool has_layer(const string& layer_name);
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /// @brief Returns the number of data elements of all the tops.
+  inline size_t memory_used() const { return memory_used_; }
+  /// @brief Returns the number of data elements the blobs take up once
+  ///        share_blob_memory or checkpoints have them share memory.
+  inline size_t planned_memory_used() const { return planned_memory_used_; }
+  /// @brief Returns the number of segments the checkpoints split the net into.
+  inline int num_segments() const { return segment_begin_.size(); }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -154,6 +165,19 @@ class Net {
    */
   static void FilterNet(const NetParameter& param,
       NetParameter* param_filtered);
+  /**
+   * @brief Simplify a TEST phase net for inference, removing the layers that
+   *        do nothing at test time and folding linear Power layers into the
+   *        layers before them.
+   */
+  static void OptimizeInference(const NetParameter& param,
+      NetParameter* param_optimized);
+  /**
+   * @brief Fold each in-place activation that directly follows a Convolution
+   *        or InnerProduct layer into that layer's fused_activation.
+   */
+  static void FuseActivations(const NetParameter& param,
+      NetParameter* param_fused);
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
@@ -182,6 +206,45 @@ class Net {
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
 
+  /**
+   * @brief Let blobs that are never live at the same time share memory,
+   *        leaving the pinned ones alone.
+   *
+   * A blob is live from the first layer that writes it to the last that reads
+   * it, together with the blobs that Split or Flatten layers make share its
+   * data. Buffers are handed out greedily in layer order, each to the smallest
+   * free one that fits or else the largest free one, which grows.
+   */
+  void PlanBlobMemory();
+  /**
+   * @brief Split the layers into segments after the last writer of each
+   *        checkpoint blob, and pin the blobs that cannot be recomputed.
+   */
+  void SetUpCheckpoints(const NetParameter& param);
+  /**
+   * @brief Let the blobs of different segments share memory, leaving the
+   *        pinned ones and those used in more than one segment alone.
+   *
+   * Within a segment the blobs, largest first, get buffers of their own, and
+   * the i-th buffer of every segment is the same; the diffs are shared alike.
+   */
+  void PlanCheckpointMemory();
+  /// @brief Replay the forward pass of a segment whose blobs were overwritten.
+  void RecomputeSegment(const int segment);
+  /**
+   * @brief Group the blobs with those that Split or Flatten layers make share
+   *        their data, returning the number of groups.
+   *
+   * blob_group gets the group of each blob, or -1 for empty ones, and
+   * group_owner the blob of each group whose data the others share, and
+   * group_size the count of its largest blob.
+   */
+  int GroupAliasedBlobs(vector<int>* blob_group, vector<int>* group_owner,
+      vector<size_t>* group_size);
+  /// @brief Point the tops of Split and Flatten layers at the data of their
+  ///        bottoms, which their Forward does.
+  void ShareAliasedData();
+
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
   vector<string> layer_names_;
@@ -222,6 +285,22 @@ class Net {
   vector<float> params_weight_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether blobs share memory as planned by PlanBlobMemory.
+  bool share_blob_memory_;
+  /// Whether blobs between checkpoints share memory as planned by
+  /// PlanCheckpointMemory.
+  bool checkpointing_;
+  /// The blobs, indexed by blob_id, that PlanBlobMemory and
+  /// PlanCheckpointMemory leave alone.
+  vector<bool> blob_memory_pinned_;
+  /// The number of data elements the blobs take up after PlanBlobMemory or
+  /// PlanCheckpointMemory.
+  size_t planned_memory_used_;
+  /// The checkpoint segment of each layer, and the first layer of each.
+  vector<int> layer_segment_;
+  vector<int> segment_begin_;
+  /// The segment whose blobs hold what its last forward pass computed.
+  int intact_segment_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
 
@@ -0,0 +1,70 @@
+#ifndef CAFFE_QUANTIZATION_HPP_
+#define CAFFE_QUANTIZATION_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief The int8 matrix products of a Convolution or InnerProduct layer
+ *        with quantization_param, for its CPU forward pass in the TEST phase.
+ *
+ * Each output's weights are quantized with a scale of their largest magnitude
+ * over 127, and the bottom with the calibrated input_scale (see
+ * tools/calibrate_quantization.cpp). caffe_cpu_gemm_s8 accumulates the
+ * products in int32, which are scaled back to Dtype. The quantized weights
+ * are kept until Invalidate, which the layer calls from BlobsChanged.
+ *
+ * With drop_float_weights the float weights are freed once quantized, so the
+ * weights take a quarter of their float memory (an eighth for double) and the
+ * layer can only run this forward pass from then on.
+ */
+template <typename Dtype>
+class QuantizedGemm {
+ public:
+  explicit QuantizedGemm(const QuantizationParameter& param);
+
+  /// @brief Quantizes the rows x cols weights, one scale per row, unless
+  ///        they were quantized since the last Invalidate, and then frees
+  ///        them if drop_float_weights is set.
+  void QuantizeWeights(const int rows, const int cols, Blob<Dtype>* weights);
+  /// @brief Makes the next QuantizeWeights quantize the weights again,
+  ///        unless the float weights are gone.
+  void Invalidate();
+  /// @brief Whether QuantizeWeights has freed the float weights.
+  inline bool float_weights_dropped() const { return float_weights_dropped_; }
+
+  /// @brief Computes top (m x rows) = bottom (m x cols) * weights^T, as
+  ///        InnerProductLayer does.
+  void ForwardInnerProduct(const int m, const Dtype* bottom, Dtype* top);
+  /// @brief Computes top (rows x n) = weights[row_begin, row_begin + rows)
+  ///        * col (cols x n), as ConvolutionLayer does for a group.
+  void ForwardConvolution(const int row_begin, const int rows, const int n,
+      const Dtype* col, Dtype* top);
+
+ protected:
+  Dtype input_scale_;
+  bool drop_float_weights_;
+  bool float_weights_dropped_;
+  int rows_, cols_;
+  /// The quantized weights, rows_ x cols_, and their scale per row.
+  vector<int8_t> weights_;
+  vector<Dtype> weight_scales_;
+  /// The quantized bottom (or transposed column buffer), cols_ wide.
+  vector<int8_t> input_;
+  /// The quantized column buffer before transposition.
+  vector<int8_t> col_;
+  vector<int32_t> output_;
+
+  DISABLE_COPY_AND_ASSIGN(QuantizedGemm);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_QUANTIZATION_HPP_
@@ -0,0 +1,49 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe FIFO queue whose pop blocks until an element is
+ *        available.
+ *
+ * The synchronization primitives are hidden behind an opaque class so that
+ * this header can be included from CUDA sources, which cannot parse
+ * boost::thread (see caffe/internal_thread.hpp).
+ */
+template <typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+
+  void push(const T& t);
+  /// @brief Pops the front element if there is one; never blocks.
+  bool try_pop(T* t);
+  /**
+   * @brief Pops the front element, waiting for one to be pushed if the queue
+   *        is empty. If log_on_wait is non-empty it is logged when the caller
+   *        has to wait, which makes a starved consumer visible in the logs.
+   *
+   * Waiting is an interruption point of the calling boost::thread, so a
+   * thread blocked here is released when its InternalThread is stopped.
+   */
+  T pop(const string& log_on_wait = "");
+  size_t size() const;
+
+ protected:
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
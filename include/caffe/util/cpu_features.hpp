@@ -0,0 +1,33 @@
+#ifndef CAFFE_UTIL_CPU_FEATURES_HPP_
+#define CAFFE_UTIL_CPU_FEATURES_HPP_
+
+// Defined when hand-vectorized x86 kernels can be built: they are compiled
+// for their instruction set with target attributes, include <immintrin.h>
+// themselves, and are only called after checking CpuSimdLevel().
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || \
+     (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CAFFE_X86_SIMD
+#endif
+
+namespace caffe {
+
+/**
+ * @brief x86 vector instruction sets that hand-vectorized CPU kernels can be
+ *        dispatched on, in increasing order of width.
+ */
+enum SimdLevel {
+  SIMD_NONE = 0,
+  SIMD_SSE2 = 1,
+  SIMD_AVX2 = 2
+};
+
+/**
+ * @brief The widest SimdLevel supported by both this build and the running
+ *        CPU (and operating system). Detected once on first call.
+ */
+SimdLevel CpuSimdLevel();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CPU_FEATURES_HPP_
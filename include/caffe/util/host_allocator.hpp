@@ -0,0 +1,86 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/// @brief Counters kept by a HostAllocator.
+struct HostAllocatorStats {
+  // Bytes of the blocks currently handed out, after size class rounding.
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  // Bytes of freed blocks kept for reuse.
+  size_t bytes_cached;
+  size_t num_allocs;
+  // Allocations served from the cache instead of the system.
+  size_t num_cache_hits;
+};
+
+/**
+ * @brief A caching allocator for host memory, used by CaffeMallocHost and
+ *        CaffeFreeHost.
+ *
+ * Requests are rounded up to size classes (four per power of two, so at most
+ * 25% is wasted) and freed blocks are kept in per-class free lists, up to
+ * cache_limit() bytes, to be handed out again. Net reshapes and temporary
+ * blobs then reuse memory instead of going back to the system allocator and
+ * faulting in fresh pages. All blocks are aligned to kAlignment bytes for
+ * vector loads. If huge pages are enabled, blocks of at least kHugePageSize
+ * are rounded and aligned to whole huge pages, and the kernel is advised to
+ * back them with transparent huge pages.
+ *
+ * All methods are thread-safe.
+ */
+class HostAllocator {
+ public:
+  static const size_t kAlignment = 64;
+  static const size_t kHugePageSize = 2 << 20;
+
+  HostAllocator();
+  ~HostAllocator();
+
+  /// @brief The process-wide allocator behind CaffeMallocHost.
+  static HostAllocator* Get();
+
+  void* Allocate(size_t size);
+  /// @brief Frees a block returned by Allocate, possibly into the cache.
+  void Free(void* ptr);
+  /// @brief Returns all cached blocks to the system.
+  void ReleaseCache();
+
+  size_t cache_limit();
+  /// @brief Caps the bytes kept in the cache; 0 disables caching.
+  void set_cache_limit(size_t bytes);
+  bool huge_pages();
+  void set_huge_pages(bool huge_pages);
+  HostAllocatorStats stats();
+
+  /// @brief The number of bytes actually reserved for a request of size.
+  size_t BlockSize(size_t size, bool huge_pages) const;
+
+ protected:
+  // The mutex lives in the .cpp so that this header, which syncedmem.hpp
+  // includes, does not pull in boost::thread (see caffe/internal_thread.hpp).
+  class sync;
+
+  void ReleaseCacheTo(size_t bytes);
+
+  shared_ptr<sync> sync_;
+  size_t cache_limit_;
+  bool huge_pages_;
+  HostAllocatorStats stats_;
+  // Size of every block handed out, by address.
+  std::map<void*, size_t> in_use_;
+  // Freed blocks by size.
+  std::map<size_t, std::vector<void*> > cache_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
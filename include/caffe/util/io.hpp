@@ -18,6 +18,11 @@ namespace leveldb {
 struct Options;
 }
 
+namespace cv {
+// Forward declaration for cv::Mat to be used in the image reading functions.
+class Mat;
+}
+
 namespace caffe {
 
 using ::google::protobuf::Message;
@@ -90,7 +95,14 @@ inline void WriteProtoToBinaryFile(
 }
 
 bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum);
+    const int height, const int width, const bool is_color,
+    const bool reduced_decode, Datum* datum);
+
+inline bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  return ReadImageToDatum(filename, label, height, width, is_color, false,
+                          datum);
+}
 
 inline bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, Datum* datum) {
@@ -102,8 +114,71 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, datum);
 }
 
+/**
+ * @brief Decodes an image file into cv_img, as 8-bit BGR if is_color and
+ *        8-bit grayscale otherwise, resized to height x width if both are
+ *        positive. With reduced_decode the resize starts from
+ *        ReadImageToCVMatReduced rather than the full image. Returns false if
+ *        the file cannot be read.
+ */
+bool ReadImageToCVMat(const string& filename, const int height,
+    const int width, const bool is_color, const bool reduced_decode,
+    cv::Mat* cv_img);
+
+inline bool ReadImageToCVMat(const string& filename, const int height,
+    const int width, const bool is_color, cv::Mat* cv_img) {
+  return ReadImageToCVMat(filename, height, width, is_color, false, cv_img);
+}
+
+/**
+ * @brief Decodes an image file into cv_img like ReadImageToCVMat, letting a
+ *        JPEG decoder scale it down by 2, 4 or 8 in the DCT domain: by the
+ *        largest factor that keeps it at least min_height x min_width. Sets
+ *        scale to the factor used, which is 1 for other formats and for
+ *        OpenCV before 3.0.
+ */
+bool ReadImageToCVMatReduced(const string& filename, const int min_height,
+    const int min_width, const bool is_color, cv::Mat* cv_img, int* scale);
+
+/**
+ * @brief Copies the pixels of an 8-bit image to data in channels x height x
+ *        width order, the layout of Datum::data.
+ */
+void CVMatToPlanar(const cv::Mat& cv_img, char* data);
+
+/**
+ * @brief Parses a serialized Datum without copying its uint8 pixels.
+ *
+ * Every field but data is parsed into header as usual; data is left empty and
+ * instead *data and *data_size point into buffer (NULL and 0 if the Datum has
+ * no data). The pointer is only valid as long as buffer is.
+ */
+bool ParseDatumHeaderFromArray(const void* buffer, int size, Datum* header,
+    const char** data, int* data_size);
+
 leveldb::Options GetLevelDBOptions();
 
+/**
+ * @brief Holds the process-wide HDF5 mutex for as long as it lives.
+ *
+ * Unless built thread-safe, the HDF5 library must not be entered from two
+ * threads at once, and the HDF5 layers call it from background threads. The
+ * mutex lives in io.cpp so that this header can be included from CUDA
+ * sources.
+ */
+class HDF5Lock {
+ public:
+  HDF5Lock();
+  ~HDF5Lock();
+
+ private:
+  DISABLE_COPY_AND_ASSIGN(HDF5Lock);
+};
+
+// The HDF5 memory type of Dtype, for reading and writing blobs directly.
+template <typename Dtype>
+hid_t hdf5_native_type();
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
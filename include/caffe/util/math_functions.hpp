@@ -7,6 +7,7 @@
 #include "glog/logging.h"
 
 #include "caffe/common.hpp"
+#include "caffe/util/cpu_features.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include "caffe/util/mkl_alternate.hpp"
 
@@ -147,6 +148,52 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Converts the n uint8 values of x to Dtype and stores (x[i] - mean[i]) *
+// scale to y[i], or to y[n - 1 - i] if mirror is set. The work is vectorized
+// up to the given SimdLevel (capped at CpuSimdLevel()); every level produces
+// bitwise identical results.
+template <typename Dtype>
+void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype* mean, const Dtype scale, const bool mirror, Dtype* y,
+    const SimdLevel level);
+
+template <typename Dtype>
+inline void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype* mean, const Dtype scale, const bool mirror, Dtype* y) {
+  caffe_cpu_uint8_transform(n, x, mean, scale, mirror, y, CpuSimdLevel());
+}
+
+// As above, but subtracts the same mean from every element.
+template <typename Dtype>
+void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype mean, const Dtype scale, const bool mirror, Dtype* y,
+    const SimdLevel level);
+
+template <typename Dtype>
+inline void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype mean, const Dtype scale, const bool mirror, Dtype* y) {
+  caffe_cpu_uint8_transform(n, x, mean, scale, mirror, y, CpuSimdLevel());
+}
+
+// Stores x[i] / scale, rounded to the nearest integer and clamped to
+// [-127, 127], to y[i].
+template <typename Dtype>
+void caffe_cpu_quantize_s8(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y);
+
+// Computes the M x N matrix C = A * B^T of the row-major int8 matrices A
+// (M x K) and B (N x K), accumulating in int32. The work is vectorized up to
+// the given SimdLevel (capped at CpuSimdLevel()) and spread over
+// Caffe::cpu_thread_pool() when large enough; every level produces the same
+// results.
+void caffe_cpu_gemm_s8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C, const SimdLevel level);
+
+inline void caffe_cpu_gemm_s8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C) {
+  caffe_cpu_gemm_s8(M, N, K, A, B, C, CpuSimdLevel());
+}
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
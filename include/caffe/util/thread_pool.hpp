@@ -0,0 +1,68 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads that run indexed tasks in parallel.
+ *
+ * Run(n, task) calls task(0) ... task(n - 1), spreading the calls over the
+ * pool's threads and the calling thread, and returns once all of them are
+ * done. Several threads may call Run on the same pool concurrently. The
+ * caller always works on its own tasks, so Run makes progress even when
+ * every pool thread is busy, and a pool of zero threads runs tasks inline.
+ *
+ * Which thread runs a given index is unspecified: tasks needing per-task
+ * state (e.g. an RNG stream) should select it by index, not by thread.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  void Run(int num_tasks, const boost::function<void(int)>& task);
+
+  /// @brief The number of pool threads, not counting callers of Run.
+  int num_threads() const { return num_threads_; }
+
+ protected:
+  // Threading state lives in the .cpp so that this header does not pull in
+  // boost::thread (see caffe/internal_thread.hpp).
+  class sync;
+
+  void WorkerEntry();
+
+  int num_threads_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+/// @brief The threaded path of ParallelFor.
+void RunParallelFor(const int n,
+    const boost::function<void(int, int)>& range_fn);
+
+/**
+ * @brief Calls range_fn(begin, end) on consecutive ranges that cover [0, n).
+ *
+ * Once n reaches twice Caffe::cpu_grain_size(), the ranges are spread over
+ * Caffe::cpu_thread_pool(), each holding at least cpu_grain_size() elements;
+ * below that range_fn(0, n) runs inline, at no more cost than a plain loop.
+ * The ranges must not depend on each other, as in element-wise kernels.
+ */
+template <typename RangeFn>
+inline void ParallelFor(const int n, const RangeFn& range_fn) {
+  if (n / 2 < Caffe::cpu_grain_size()) {
+    range_fn(0, n);
+    return;
+  }
+  RunParallelFor(n, range_fn);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -0,0 +1,92 @@
+#ifndef CAFFE_UTIL_WINDOW_FILE_HPP_
+#define CAFFE_UTIL_WINDOW_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The images and windows listed by a WindowDataLayer source, kept as
+ *        flat arrays with the windows sorted by descending overlap.
+ *
+ * Text window files, in the format described in window_data_layer.cpp, are
+ * parsed into memory. Binary ones, written by WriteBinary or the
+ * convert_window_file tool, are memory-mapped and read in place, so that
+ * opening them takes constant time and memory however many windows they hold.
+ * Since the windows are sorted, the foreground and background windows for any
+ * pair of overlap thresholds are ranges found by CountOverlapAtLeast.
+ */
+class WindowFile {
+ public:
+  WindowFile();
+  ~WindowFile();
+
+  /// @brief Opens a text or binary window file, telling them apart by the
+  ///        magic number binary ones start with. Dies on malformed files.
+  void Open(const string& filename);
+  /// @brief Saves the open windows in the binary format.
+  void WriteBinary(const string& filename) const;
+
+  inline int num_images() const { return num_images_; }
+  inline const char* image_path(const int i) const {
+    return paths_ + path_offsets_[i];
+  }
+  inline int image_channels(const int i) const { return image_sizes_[3 * i]; }
+  inline int image_height(const int i) const {
+    return image_sizes_[3 * i + 1];
+  }
+  inline int image_width(const int i) const { return image_sizes_[3 * i + 2]; }
+
+  inline int num_windows() const { return num_windows_; }
+  /// @brief The index of the image window j was cut from.
+  inline int window_image(const int j) const { return window_image_[j]; }
+  inline int window_label(const int j) const { return window_label_[j]; }
+  inline float window_overlap(const int j) const {
+    return window_overlap_[j];
+  }
+  inline int window_x1(const int j) const { return window_x1_[j]; }
+  inline int window_y1(const int j) const { return window_y1_[j]; }
+  inline int window_x2(const int j) const { return window_x2_[j]; }
+  inline int window_y2(const int j) const { return window_y2_[j]; }
+
+  /// @brief Returns the number of windows with overlap of at least
+  ///        threshold, which are the first ones.
+  int CountOverlapAtLeast(const float threshold) const;
+
+ private:
+  void ParseText(const string& filename);
+  void Map(const string& filename);
+  // Points the arrays into data, which holds a whole binary window file.
+  void SetData(const char* data, const size_t size);
+  void Close();
+
+  // The binary file image, owned for text files and mapped for binary ones.
+  vector<uint32_t> owned_;
+  void* mapped_;
+  const char* data_;
+  size_t size_;
+
+  int num_images_;
+  const uint32_t* path_offsets_;
+  const int32_t* image_sizes_;
+  const char* paths_;
+  int num_windows_;
+  const int32_t* window_image_;
+  const int32_t* window_label_;
+  const float* window_overlap_;
+  const int32_t* window_x1_;
+  const int32_t* window_y1_;
+  const int32_t* window_x2_;
+  const int32_t* window_y2_;
+
+  DISABLE_COPY_AND_ASSIGN(WindowFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINDOW_FILE_HPP_
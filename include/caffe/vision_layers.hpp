@@ -9,10 +9,12 @@
 #include "caffe/common.hpp"
 #include "caffe/common_layers.hpp"
 #include "caffe/data_layers.hpp"
+#include "caffe/fused_activation.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/quantization.hpp"
 
 namespace caffe {
 
@@ -60,8 +62,20 @@ class ConvolutionLayer : public Layer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and WINOGRAD (CPU forward for 3x3
+   *    kernels with unit stride) engines. On the CPU, the CAFFE engine
+   *    convolves 1x1 kernels with unit stride and no padding directly, as a
+   *    GEMM on the input, without im2col.
+   *  - col_batch_size (\b optional, default 1). The number of images the CPU
+   *  implementation unrolls into the column buffer at once, so that each group
+   *  is a single GEMM over all of them. 0 picks as many as fit in
+   *  col_buffer_max_bytes.
+   *  - fused_activation (\b optional). An in-place neuron layer to apply to
+   *  each image of the top as soon as it is computed; set by Net when it
+   *  fuses activations.
+   *  - quantization_param (\b optional). Runs the GEMMs of the CAFFE engine's
+   *  CPU forward pass in int8 in the TEST phase.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -76,6 +90,9 @@ class ConvolutionLayer : public Layer<Dtype> {
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
+  virtual void BlobsChanged() {
+    if (quantized_gemm_) { quantized_gemm_->Invalidate(); }
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -97,6 +114,9 @@ class ConvolutionLayer : public Layer<Dtype> {
   int num_output_;
   int height_out_, width_out_;
   bool bias_term_;
+  /// is_1x1_ is set for 1x1 kernels with unit stride and no padding, which
+  /// Forward_cpu and Backward_cpu convolve without im2col.
+  bool is_1x1_;
 
   /// M_ is the channel dimension of the output for a single group, which is the
   /// leading dimension of the filter matrix.
@@ -107,8 +127,52 @@ class ConvolutionLayer : public Layer<Dtype> {
   /// N_ is the spatial dimension of the output, the H x W, which are the last
   /// dimensions of the data and filter matrices.
   int N_;
+  /// col_batch_ is the number of images unrolled into col_buffer_ at once.
+  int col_batch_;
   Blob<Dtype> col_buffer_;
+  /// Holds the output (or its diff) of col_batch_ images in GEMM layout,
+  /// num_output_ x (col_batch_ * N_), when col_batch_ > 1.
+  Blob<Dtype> top_buffer_;
   Blob<Dtype> bias_multiplier_;
+  /// The activation applied to the top, if layer_param_ has fused_activation.
+  shared_ptr<FusedActivation<Dtype> > fused_activation_;
+  /// The int8 products of the CPU forward pass in the TEST phase, if
+  /// layer_param_ has quantization_param.
+  shared_ptr<QuantizedGemm<Dtype> > quantized_gemm_;
+};
+
+/**
+ * @brief Convolves 3x3 filters with unit stride by the Winograd minimal
+ *        filtering algorithm F(2x2, 3x3) on the CPU.
+ *
+ * Each 4x4 input tile and each filter are transformed so that a 2x2 output
+ * tile takes 16 multiplications per channel instead of 36, and the
+ * multiplications for all tiles, channels and filters become 16 GEMMs per
+ * image and group. The backward pass and the GPU fall back to the
+ * ConvolutionLayer implementation.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  /// The number of 2x2 output tiles along the height and width.
+  int tiles_h_, tiles_w_;
+  /// The transformed filters, 16 x num_output_ x (channels_ / group_).
+  Blob<Dtype> transformed_weights_;
+  /// The transformed input tiles of one image, 16 x channels_ x tiles.
+  Blob<Dtype> transformed_input_;
+  /// The products before the output transform, 16 x num_output_ x tiles.
+  Blob<Dtype> transformed_output_;
 };
 
 #ifdef USE_CUDNN
@@ -318,6 +382,63 @@ class PoolingLayer : public Layer<Dtype> {
   int height_, width_;
   int pooled_height_, pooled_width_;
   Blob<Dtype> rand_idx_;
+  /// The position of each maximum for MAX pooling: its index within the
+  /// bottom plane on the GPU, and its offset kh * kernel_w_ + kw within the
+  /// pooling window on the CPU.
+  Blob<int> max_idx_;
+};
+
+/**
+ * @brief Max-pools regions of a feature map into grids of a fixed size, so
+ *        that the layers above run once per region while the layers below
+ *        run once per image.
+ *
+ * bottom[0] is the N x C x H x W feature map and bottom[1] holds R regions
+ * as R x 5 x 1 x 1 rows (n, x1, y1, x2, y2): the image within the batch and
+ * the inclusive corners in image pixels, which spatial_scale maps onto the
+ * feature map. Each pyramid level splits a region into level x level bins
+ * and takes the max of each. With a single level the top is
+ * R x C x level x level, laid out like the top of a PoolingLayer; with
+ * several it is R x (C * sum of level^2) x 1 x 1, one level after another.
+ * Only the feature map gets a gradient.
+ */
+template <typename Dtype>
+class RegionPoolingLayer : public Layer<Dtype> {
+ public:
+  explicit RegionPoolingLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_REGION_POOLING;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  // Pools region r of bottom_data for every channel of every level.
+  void ForwardRegion(const Dtype* bottom_data, const Dtype* regions,
+      Dtype* top_data, int* max_idx, const int r);
+
+  vector<int> pyramid_levels_;
+  Dtype spatial_scale_;
+  int num_, channels_;
+  int height_, width_;
+  // The number of bins per channel, summed over the levels.
+  int bins_;
+  /// The index within its bottom plane of the maximum of each bin of the
+  /// top, or -1 for a bin that covers no feature.
   Blob<int> max_idx_;
 };
 
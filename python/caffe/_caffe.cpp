@@ -2,20 +2,25 @@
 // caffe::Caffe functions so that one could easily call it from Python.
 // Note that for Python, we will simply use float as the data type.
 
+#include <boost/bind.hpp>
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
 
 // these need to be included after boost on OS X
 #include <string>  // NOLINT(build/include_order)
 #include <vector>  // NOLINT(build/include_order)
+#include <algorithm>  // NOLINT(build/include_order)
+#include <cmath>  // NOLINT(build/include_order)
 #include <fstream>  // NOLINT
 
 #include "_caffe.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 // Temporary solution for numpy < 1.7 versions: old macro, no promises.
 // You're strongly advised to upgrade to >= 1.7.
 #ifndef NPY_ARRAY_C_CONTIGUOUS
 #define NPY_ARRAY_C_CONTIGUOUS NPY_C_CONTIGUOUS
+#define NPY_ARRAY_ALIGNED NPY_ALIGNED
 #define PyArray_SetBaseObject(arr, x) (PyArray_BASE(arr) = (x))
 #endif
 
@@ -34,6 +39,124 @@ static void CheckFile(const string& filename) {
     f.close();
 }
 
+// A batch of images to preprocess into an input blob. The images are
+// converted to C contiguous float32 arrays beforehand, so that the worker
+// threads never touch Python objects.
+struct PreprocessJob {
+  vector<const float*> images;
+  vector<int> heights;
+  vector<int> widths;
+  int channels;
+  int image_height;
+  int image_width;
+  int crop_height;
+  int crop_width;
+  bool oversample;
+  vector<int> channel_order;
+  // K x crop_height x crop_width, or K x 1 x 1 for a mean pixel.
+  const float* mean;
+  bool mean_pixel;
+  float raw_scale;
+  float input_scale;
+  float* output;
+};
+
+// Linearly interpolates the (src_height x src_width x channels) image src to
+// dst_height x dst_width as caffe.io.resize_image does through skimage: the
+// pixel centers are aligned, and samples beyond the borders blend with the
+// smallest value of the image, which resize_image maps to skimage's cval of 0.
+static void ResizeBilinear(const float* src, const int src_height,
+    const int src_width, const int channels, const int dst_height,
+    const int dst_width, float* dst) {
+  // The image with a border of one pixel of its smallest value, so that every
+  // sample has its four neighbors.
+  const int padded_width = src_width + 2;
+  const float border = *std::min_element(src,
+      src + src_height * src_width * channels);
+  vector<float> padded((src_height + 2) * padded_width * channels, border);
+  for (int y = 0; y < src_height; ++y) {
+    std::copy(src + y * src_width * channels,
+        src + (y + 1) * src_width * channels,
+        &padded[((y + 1) * padded_width + 1) * channels]);
+  }
+  vector<int> x0(dst_width);
+  vector<float> wx(dst_width);
+  for (int x = 0; x < dst_width; ++x) {
+    const double fx = (x + 0.5) * src_width / dst_width - 0.5;
+    x0[x] = static_cast<int>(std::floor(fx)) + 1;
+    wx[x] = fx + 1 - x0[x];
+  }
+  for (int y = 0; y < dst_height; ++y) {
+    const double fy = (y + 0.5) * src_height / dst_height - 0.5;
+    const int y0 = static_cast<int>(std::floor(fy)) + 1;
+    const float wy = fy + 1 - y0;
+    const float* row0 = &padded[y0 * padded_width * channels];
+    const float* row1 = row0 + padded_width * channels;
+    for (int x = 0; x < dst_width; ++x) {
+      const int left = x0[x] * channels;
+      const int right = left + channels;
+      for (int k = 0; k < channels; ++k) {
+        const float top = row0[left + k] * (1 - wx[x]) +
+            row0[right + k] * wx[x];
+        const float bottom = row1[left + k] * (1 - wx[x]) +
+            row1[right + k] * wx[x];
+        *dst++ = top * (1 - wy) + bottom * wy;
+      }
+    }
+  }
+}
+
+// Resizes image i of job and writes its preprocessed crops.
+static void PreprocessImage(const PreprocessJob& job, const int i) {
+  const int channels = job.channels;
+  vector<float> resized(job.image_height * job.image_width * channels);
+  ResizeBilinear(job.images[i], job.heights[i], job.widths[i], channels,
+      job.image_height, job.image_width, &resized[0]);
+  // The corners and the center, as in caffe.io.oversample, then mirrored.
+  const int h_off = job.image_height - job.crop_height;
+  const int w_off = job.image_width - job.crop_width;
+  const int crop_h_offsets[] = {0, 0, h_off, h_off, h_off / 2};
+  const int crop_w_offsets[] = {0, w_off, 0, w_off, w_off / 2};
+  const int num_crops = job.oversample ? 10 : 1;
+  const int crop_size = channels * job.crop_height * job.crop_width;
+  for (int j = 0; j < num_crops; ++j) {
+    const int crop = job.oversample ? j % 5 : 4;
+    const bool mirror = j >= 5;
+    float* output = job.output + (i * num_crops + j) * crop_size;
+    for (int c = 0; c < channels; ++c) {
+      const int k = job.channel_order.empty() ? c : job.channel_order[c];
+      for (int y = 0; y < job.crop_height; ++y) {
+        const float* row = &resized[0] +
+            (crop_h_offsets[crop] + y) * job.image_width * channels;
+        for (int x = 0; x < job.crop_width; ++x) {
+          const int image_x = crop_w_offsets[crop] +
+              (mirror ? job.crop_width - 1 - x : x);
+          float value = row[image_x * channels + k] * job.raw_scale;
+          if (job.mean) {
+            value -= job.mean_pixel ? job.mean[c] :
+                job.mean[(c * job.crop_height + y) * job.crop_width + x];
+          }
+          *output++ = value * job.input_scale;
+        }
+      }
+    }
+  }
+}
+
+// Returns a C contiguous float32 array of obj with min_dim to max_dim
+// dimensions, converting it if needed, or raises a Python exception.
+static bp::object FloatArray(bp::object obj, int min_dim, int max_dim,
+    const string& name) {
+  PyObject* arr = PyArray_FROMANY(obj.ptr(), NPY_FLOAT32, min_dim, max_dim,
+      NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED);
+  if (!arr) {
+    PyErr_Clear();
+    throw std::runtime_error(name + " must be a float array of the right"
+        " dimensions");
+  }
+  return bp::object(bp::handle<>(arr));
+}
+
 bp::object PyBlobWrap::get_data() {
   npy_intp dims[] = {num(), channels(), height(), width()};
 
@@ -126,6 +249,83 @@ void PyNet::set_input_arrays(bp::object data_obj, bp::object labels_obj) {
       PyArray_DIMS(data_arr)[0]);
 }
 
+void PyNet::PreprocessBatch(string input_name, bp::object images,
+    int image_height, int image_width, bool oversample) {
+  const vector<int>& input_ids = net_->input_blob_indices();
+  int input_id = 0;
+  while (input_id < input_ids.size() &&
+         net_->blob_names()[input_ids[input_id]] != input_name) {
+    ++input_id;
+  }
+  if (input_id == input_ids.size()) {
+    throw std::runtime_error(input_name + " is not an input of the net");
+  }
+  Blob<float>* blob = net_->input_blobs()[input_id];
+  PreprocessJob job;
+  job.channels = blob->channels();
+  job.crop_height = blob->height();
+  job.crop_width = blob->width();
+  job.image_height = image_height;
+  job.image_width = image_width;
+  job.oversample = oversample;
+  if (image_height < job.crop_height || image_width < job.crop_width) {
+    throw std::runtime_error("images must be resized to at least the input"
+        " dimensions");
+  }
+  // Hold the converted arrays until the workers are done with them.
+  const int num_images = bp::len(images);
+  vector<bp::object> arrays;
+  for (int i = 0; i < num_images; ++i) {
+    arrays.push_back(FloatArray(images[i], 3, 3, "image"));
+    PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(arrays[i].ptr());
+    if (PyArray_DIMS(arr)[2] != job.channels) {
+      throw std::runtime_error("image has wrong number of channels");
+    }
+    job.images.push_back(static_cast<const float*>(PyArray_DATA(arr)));
+    job.heights.push_back(PyArray_DIMS(arr)[0]);
+    job.widths.push_back(PyArray_DIMS(arr)[1]);
+  }
+  if (channel_swap_.has_key(input_name)) {
+    bp::object order = channel_swap_[input_name];
+    for (int c = 0; c < bp::len(order); ++c) {
+      job.channel_order.push_back(bp::extract<int>(order[c]));
+    }
+    if (job.channel_order.size() != blob->channels()) {
+      throw std::runtime_error("channel swap has wrong number of channels");
+    }
+  }
+  job.mean = NULL;
+  bp::object mean;
+  if (mean_.has_key(input_name)) {
+    mean = FloatArray(mean_[input_name], 3, 3, "mean");
+    PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(mean.ptr());
+    job.mean_pixel = PyArray_DIMS(arr)[1] == 1 && PyArray_DIMS(arr)[2] == 1;
+    if (PyArray_DIMS(arr)[0] != job.channels || (!job.mean_pixel &&
+        (PyArray_DIMS(arr)[1] != job.crop_height ||
+         PyArray_DIMS(arr)[2] != job.crop_width))) {
+      throw std::runtime_error("mean has wrong dimensions");
+    }
+    job.mean = static_cast<const float*>(PyArray_DATA(arr));
+  }
+  job.raw_scale = 1;
+  if (raw_scale_.has_key(input_name)) {
+    job.raw_scale = bp::extract<float>(raw_scale_[input_name]);
+  }
+  job.input_scale = 1;
+  if (input_scale_.has_key(input_name)) {
+    job.input_scale = bp::extract<float>(input_scale_[input_name]);
+  }
+  blob->Reshape(num_images * (oversample ? 10 : 1), job.channels,
+      job.crop_height, job.crop_width);
+  net_->Reshape();
+  job.output = blob->mutable_cpu_data();
+  // The workers only read the arrays held above, so Python may run meanwhile.
+  Py_BEGIN_ALLOW_THREADS
+  Caffe::cpu_thread_pool()->Run(num_images,
+      boost::bind(&PreprocessImage, boost::cref(job), _1));
+  Py_END_ALLOW_THREADS
+}
+
 PySGDSolver::PySGDSolver(const string& param_file) {
   // as in PyNet, (as a convenience, not a guarantee), create a Python
   // exception if param_file can't be opened
@@ -155,10 +355,13 @@ BOOST_PYTHON_MODULE(_caffe) {
       .def("set_phase_train",       &PyNet::set_phase_train)
       .def("set_phase_test",        &PyNet::set_phase_test)
       .def("set_device",            &PyNet::set_device)
+      .def("set_host_cache_limit",  &PyNet::set_host_cache_limit)
+      .def("set_host_huge_pages",   &PyNet::set_host_huge_pages)
       .add_property("_blobs",       &PyNet::blobs)
       .add_property("layers",       &PyNet::layers)
       .add_property("_blob_names",  &PyNet::blob_names)
       .add_property("_layer_names", &PyNet::layer_names)
+      .def("_layer_index",          &PyNet::layer_index)
       .add_property("inputs",       &PyNet::inputs)
       .add_property("outputs",      &PyNet::outputs)
       .add_property("mean",         &PyNet::mean_)
@@ -166,6 +369,7 @@ BOOST_PYTHON_MODULE(_caffe) {
       .add_property("raw_scale",    &PyNet::raw_scale_)
       .add_property("channel_swap", &PyNet::channel_swap_)
       .def("_set_input_arrays",     &PyNet::set_input_arrays)
+      .def("_preprocess_batch",     &PyNet::PreprocessBatch)
       .def("save",                  &PyNet::save);
 
   bp::class_<PyBlob<float>, PyBlobWrap>(
@@ -181,7 +385,8 @@ BOOST_PYTHON_MODULE(_caffe) {
 
   bp::class_<PyLayer>(
       "Layer", bp::no_init)
-      .add_property("blobs", &PyLayer::blobs);
+      .add_property("blobs", &PyLayer::blobs)
+      .def("blobs_changed", &PyLayer::BlobsChanged);
 
   bp::class_<PySGDSolver, boost::noncopyable>(
       "SGDSolver", bp::init<string>())
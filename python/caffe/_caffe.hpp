@@ -8,10 +8,12 @@
 #include <numpy/arrayobject.h>
 
 // these need to be included after boost on OS X
+#include <algorithm>  // NOLINT(build/include_order)
 #include <string>  // NOLINT(build/include_order)
 #include <vector>  // NOLINT(build/include_order)
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace bp = boost::python;
 using boost::shared_ptr;
@@ -68,6 +70,9 @@ class PyLayer {
     return vector<PyBlob<float> >(layer_->blobs().begin(),
         layer_->blobs().end());
   }
+  // Call after writing to blobs, so that the layer refreshes what it derives
+  // from them, such as quantized weights.
+  void BlobsChanged() { layer_->BlobsChanged(); }
 
   // this is here only to satisfy boost's vector_indexing_suite
   bool operator == (const PyLayer &other) {
@@ -102,6 +107,14 @@ class PyNet {
 
   void set_input_arrays(bp::object data_obj, bp::object labels_obj);
 
+  // Resize the (H x W x K) images to image_height x image_width, take their
+  // center crops or, with oversample, the ten crops of caffe.io.oversample,
+  // and preprocess them as Net.preprocess does with the settings for
+  // input_name. The crops are written on the CPU thread pool straight into
+  // the input blob, which is reshaped to hold them all.
+  void PreprocessBatch(string input_name, bp::object images,
+      int image_height, int image_width, bool oversample);
+
   // Save the network weights to binary proto for net surgeries.
   void save(string filename) {
     NetParameter net_param;
@@ -115,6 +128,13 @@ class PyNet {
   void set_phase_train() { Caffe::set_phase(Caffe::TRAIN); }
   void set_phase_test() { Caffe::set_phase(Caffe::TEST); }
   void set_device(int device_id) { Caffe::SetDevice(device_id); }
+  // The host memory settings of caffe::HostAllocator, for the whole process.
+  void set_host_cache_limit(size_t bytes) {
+    HostAllocator::Get()->set_cache_limit(bytes);
+  }
+  void set_host_huge_pages(bool huge_pages) {
+    HostAllocator::Get()->set_huge_pages(huge_pages);
+  }
 
   vector<PyBlob<float> > blobs() {
     return vector<PyBlob<float> >(net_->blobs().begin(), net_->blobs().end());
@@ -126,6 +146,16 @@ class PyNet {
 
   vector<string> blob_names() { return net_->blob_names(); }
   vector<string> layer_names() { return net_->layer_names(); }
+  // The index of the layer named layer_name, or of the layer the activation
+  // named layer_name was fused into; -1 if there is neither.
+  int layer_index(const string& layer_name) {
+    if (!net_->has_layer(layer_name)) {
+      return -1;
+    }
+    const vector<shared_ptr<Layer<float> > >& layers = net_->layers();
+    return std::find(layers.begin(), layers.end(),
+                     net_->layer_by_name(layer_name)) - layers.begin();
+  }
 
   bp::list inputs() {
     bp::list input_blob_names;
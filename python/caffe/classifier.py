@@ -11,7 +11,7 @@ import caffe
 class Classifier(caffe.Net):
     """
     Classifier extends Net for image class prediction
-    by scaling, center cropping, or oversampling.
+    by scaling, center cropping, oversampling, or dense evaluation.
     """
     def __init__(self, model_file, pretrained_file, image_dims=None,
                  gpu=False, mean=None, input_scale=None, raw_scale=None,
@@ -46,7 +46,7 @@ class Classifier(caffe.Net):
         self.image_dims = image_dims
 
 
-    def predict(self, inputs, oversample=True):
+    def predict(self, inputs, oversample=True, dense=False):
         """
         Predict classification probabilities of inputs.
 
@@ -54,41 +54,86 @@ class Classifier(caffe.Net):
         inputs: iterable of (H x W x K) input ndarrays.
         oversample: average predictions across center, corners, and mirrors
                     when True (default). Center-only prediction when False.
+        dense: average predictions across every crop position of the scaled
+               inputs, computed in one pass, when True. This needs a net
+               defined with `fully_convolutional: true` and ignores
+               oversample.
 
         Give
         predictions: (N x C) ndarray of class probabilities
                      for N images and C classes.
         """
-        # Scale to standardize input dimensions.
-        input_ = np.zeros((len(inputs),
-            self.image_dims[0], self.image_dims[1], inputs[0].shape[2]),
-            dtype=np.float32)
-        for ix, in_ in enumerate(inputs):
-            input_[ix] = caffe.io.resize_image(in_, self.image_dims)
-
-        if oversample:
-            # Generate center, corner, and mirrored crops.
-            input_ = caffe.io.oversample(input_, self.crop_dims)
-        else:
-            # Take center crop.
-            center = np.array(self.image_dims) / 2.0
-            crop = np.tile(center, (1, 2))[0] + np.concatenate([
-                -self.crop_dims / 2.0,
-                self.crop_dims / 2.0
-            ])
-            input_ = input_[:, crop[0]:crop[2], crop[1]:crop[3], :]
-
-        # Classify
-        caffe_in = np.zeros(np.array(input_.shape)[[0,3,1,2]],
-                            dtype=np.float32)
-        for ix, in_ in enumerate(input_):
-            caffe_in[ix] = self.preprocess(self.inputs[0], in_)
-        out = self.forward_all(**{self.inputs[0]: caffe_in})
-        predictions = out[self.outputs[0]].squeeze(axis=(2,3))
-
-        # For oversampling, average predictions across crops.
-        if oversample:
-            predictions = predictions.reshape((len(predictions) / 10, 10, -1))
-            predictions = predictions.mean(1)
+        if dense:
+            # Scale to standardize input dimensions.
+            input_ = np.zeros((len(inputs),
+                self.image_dims[0], self.image_dims[1], inputs[0].shape[2]),
+                dtype=np.float32)
+            for ix, in_ in enumerate(inputs):
+                input_[ix] = caffe.io.resize_image(in_, self.image_dims)
+            return self.predict_dense(input_)
+
+        # Scale, take the center crop or the center, corner, and mirrored
+        # crops, and preprocess them natively, straight into the input blob.
+        # Classify as many images at a time as the net input holds crops of.
+        in_ = self.inputs[0]
+        crop_shape = self.blobs[in_].data.shape
+        num_crops = 10 if oversample else 1
+        batch_size = max(crop_shape[0] // num_crops, 1)
+        predictions = []
+        try:
+            for start in range(0, len(inputs), batch_size):
+                self._preprocess_batch(in_, inputs[start:start + batch_size],
+                                       int(self.image_dims[0]),
+                                       int(self.image_dims[1]), oversample)
+                out = self.forward()
+                batch_predictions = out[self.outputs[0]].squeeze(axis=(2,3))
+                # For oversampling, average predictions across crops.
+                predictions.append(batch_predictions.reshape(
+                    (-1, num_crops, batch_predictions.shape[1])).mean(1))
+        finally:
+            # Go back to the net input size.
+            self.blobs[in_].reshape(*crop_shape)
+            self.reshape()
+
+        return np.concatenate(predictions)
+
+
+    def predict_dense(self, input_):
+        """
+        Predict classification probabilities by sliding the classifier of a
+        fully convolutional net over whole inputs in a single forward pass.
+
+        Take
+        input_: (N x H x W x K) ndarray of inputs at least as large as the
+                net input.
 
+        Give
+        predictions: (N x C) ndarray of class probabilities averaged over
+                     the score map of each input.
+        """
+        in_ = self.inputs[0]
+        crop_shape = self.blobs[in_].data.shape
+        mean = self.mean.get(in_)
+        if (mean is not None and
+                mean.shape[1:] not in [(1, 1), input_.shape[1:3]]):
+            # Stretch an elementwise mean over the whole input.
+            self.mean[in_] = caffe.io.resize_image(mean.transpose((1,2,0)),
+                                                   input_.shape[1:3]
+                                                   ).transpose((2,0,1))
+        self.blobs[in_].reshape(len(input_), input_.shape[3],
+                                input_.shape[1], input_.shape[2])
+        self.reshape()
+        try:
+            caffe_in = np.zeros(np.array(input_.shape)[[0,3,1,2]],
+                                dtype=np.float32)
+            for ix, in_image in enumerate(input_):
+                caffe_in[ix] = self.preprocess(in_, in_image)
+            out = self.forward(**{in_: caffe_in})
+            predictions = out[self.outputs[0]].mean(axis=(2,3))
+        finally:
+            # Go back to the net input size for the other modes.
+            if mean is not None:
+                self.mean[in_] = mean
+            self.blobs[in_].reshape(*crop_shape)
+            self.reshape()
         return predictions
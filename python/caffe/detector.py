@@ -9,6 +9,13 @@ This implementation follows ideas in
     segmentation.
     http://arxiv.org/abs/1311.2524
 
+With a region pooling net the whole image goes through the convolutional
+layers once and every window is pooled from the shared feature maps instead,
+following
+    Ross Girshick.
+    Fast R-CNN.
+    http://arxiv.org/abs/1504.08083
+
 The selective_search_ijcv_with_python code required for the selective search
 proposal mode is available at
     https://github.com/sergeyk/selective_search_ijcv_with_python
@@ -26,7 +33,7 @@ class Detector(caffe.Net):
     """
     def __init__(self, model_file, pretrained_file, gpu=False, mean=None,
                  input_scale=None, raw_scale=None, channel_swap=None,
-                 context_pad=None):
+                 context_pad=None, roi_input=None):
         """
         Take
         gpu, mean, input_scale, raw_scale, channel_swap: params for
@@ -34,6 +41,9 @@ class Detector(caffe.Net):
         context_pad: amount of surrounding context to take s.t. a `context_pad`
             sized border of pixels in the network input image is context, as in
             R-CNN feature extraction.
+        roi_input: name of the net input taking the (n, x1, y1, x2, y2)
+            windows of a REGION_POOLING layer. When given, each image is run
+            once at its own size and context_pad does not apply.
         """
         caffe.Net.__init__(self, model_file, pretrained_file)
         self.set_phase_test()
@@ -43,14 +53,25 @@ class Detector(caffe.Net):
         else:
             self.set_mode_cpu()
 
+        self.roi_input = roi_input
+        if roi_input is not None:
+            if roi_input not in self.inputs:
+                raise Exception('Input not in {}'.format(self.inputs))
+            self.image_input = [in_ for in_ in self.inputs
+                                if in_ != roi_input][0]
+        else:
+            self.image_input = self.inputs[0]
+
         if mean is not None:
-            self.set_mean(self.inputs[0], mean)
+            # Images of any size take the mean pixel in region pooling mode.
+            mode = 'channel' if roi_input is not None else 'elementwise'
+            self.set_mean(self.image_input, mean, mode)
         if input_scale is not None:
-            self.set_input_scale(self.inputs[0], input_scale)
+            self.set_input_scale(self.image_input, input_scale)
         if raw_scale is not None:
-            self.set_raw_scale(self.inputs[0], raw_scale)
+            self.set_raw_scale(self.image_input, raw_scale)
         if channel_swap is not None:
-            self.set_channel_swap(self.inputs[0], channel_swap)
+            self.set_channel_swap(self.image_input, channel_swap)
 
         self.configure_crop(context_pad)
 
@@ -68,6 +89,9 @@ class Detector(caffe.Net):
         detections: list of {filename: image filename, window: crop coordinates,
             predictions: prediction vector} dicts.
         """
+        if self.roi_input is not None:
+            return self.detect_regions(images_windows)
+
         # Extract windows.
         window_inputs = []
         for image_fname, windows in images_windows:
@@ -98,6 +122,43 @@ class Detector(caffe.Net):
         return detections
 
 
+    def detect_regions(self, images_windows):
+        """
+        Do windowed detection by pooling every window of an image from the
+        feature maps of a single pass over the whole image.
+
+        Take
+        images_windows: (image filename, window list) iterable.
+
+        Give
+        detections: list of {filename: image filename, window: crop coordinates,
+            predictions: prediction vector} dicts.
+        """
+        detections = []
+        for image_fname, windows in images_windows:
+            image = caffe.io.load_image(image_fname).astype(np.float32)
+            windows = np.asarray(windows)
+            # Shape the net for this image and its windows.
+            self.blobs[self.image_input].reshape(1, image.shape[2],
+                                                 image.shape[0], image.shape[1])
+            self.blobs[self.roi_input].reshape(len(windows), 5, 1, 1)
+            self.reshape()
+            caffe_in = self.preprocess(self.image_input, image)
+            # Windows are ymin, xmin, ymax, xmax; regions are n, x1, y1, x2, y2.
+            rois = np.zeros((len(windows), 5, 1, 1), dtype=np.float32)
+            rois[:, 1:, 0, 0] = windows[:, [1, 0, 3, 2]]
+            out = self.forward(**{self.image_input: caffe_in[np.newaxis],
+                                  self.roi_input: rois})
+            predictions = out[self.outputs[0]].reshape((len(windows), -1))
+            for ix, window in enumerate(windows):
+                detections.append({
+                    'window': window,
+                    'prediction': predictions[ix].copy(),
+                    'filename': image_fname
+                })
+        return detections
+
+
     def detect_selective_search(self, image_fnames):
         """
         Do windowed detection over Selective Search proposals by extracting
@@ -44,9 +44,12 @@ def resize_image(im, new_dims, interp_order=1):
     """
     if im.shape[-1] == 1 or im.shape[-1] == 3:
         # skimage is fast but only understands {1,3} channel images in [0, 1].
+        # Beyond the borders it blends with 0, i.e. with im_min, as
+        # Net._preprocess_batch does; newer skimage reflects by default.
         im_min, im_max = im.min(), im.max()
         im_std = (im - im_min) / (im_max - im_min)
-        resized_std = resize(im_std, new_dims, order=interp_order)
+        resized_std = resize(im_std, new_dims, order=interp_order,
+                             mode='constant')
         resized_im = resized_std * (im_max - im_min) + im_min
     else:
         # ndimage interpolates anything but more slowly.
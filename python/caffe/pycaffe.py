@@ -35,6 +35,16 @@ def _Net_params(self):
                         for name, lr in zip(self._layer_names, self.layers)
                         if len(lr.blobs) > 0])
 
+def _Net_layer_index_or_raise(self, name):
+    """
+    Index of the layer called name, or of the layer the activation called name
+    was fused into.
+    """
+    ind = self._layer_index(name)
+    if ind < 0:
+        raise ValueError('{} is not a layer of this net'.format(name))
+    return ind
+
 def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
     """
     Forward pass: prepare inputs and run the net forward.
@@ -54,12 +64,12 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
         blobs = []
 
     if start is not None:
-        start_ind = list(self._layer_names).index(start)
+        start_ind = self._layer_index_or_raise(start)
     else:
         start_ind = 0
 
     if end is not None:
-        end_ind = list(self._layer_names).index(end)
+        end_ind = self._layer_index_or_raise(end)
         outputs = set([end] + blobs)
     else:
         end_ind = len(self.layers) - 1
@@ -101,12 +111,12 @@ def _Net_backward(self, diffs=None, start=None, end=None, **kwargs):
         diffs = []
 
     if start is not None:
-        start_ind = list(self._layer_names).index(start)
+        start_ind = self._layer_index_or_raise(start)
     else:
         start_ind = len(self.layers) - 1
 
     if end is not None:
-        end_ind = list(self._layer_names).index(end)
+        end_ind = self._layer_index_or_raise(end)
         outputs = set([end] + diffs)
     else:
         end_ind = 0
@@ -380,6 +390,7 @@ def _Net_batch(self, blobs):
 # Attach methods to Net.
 Net.blobs = _Net_blobs
 Net.params = _Net_params
+Net._layer_index_or_raise = _Net_layer_index_or_raise
 Net.forward = _Net_forward
 Net.backward = _Net_backward
 Net.forward_all = _Net_forward_all
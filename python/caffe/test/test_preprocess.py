@@ -0,0 +1,95 @@
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+import caffe
+
+
+def simple_net_file(num_output):
+    """Make a simple net prototxt for 4 x 5 images, based on
+    test_net.cpp, returning the name of the (temporary) file."""
+
+    f = tempfile.NamedTemporaryFile(mode='w', delete=False)
+    f.write("""name: 'testnet'
+    input: 'data' input_dim: 10 input_dim: 3 input_dim: 4 input_dim: 5
+    layers { name: 'ip' type: INNER_PRODUCT bottom: 'data' top: 'ip'
+      inner_product_param { num_output: """ + str(num_output) + """
+        weight_filler { type: 'gaussian' std: 1 }
+        bias_filler { type: 'constant' value: 2 } } }
+    layers { name: 'prob' type: SOFTMAX bottom: 'ip' top: 'prob' }""")
+    f.close()
+    return f.name
+
+
+class TestPreprocessBatch(unittest.TestCase):
+    def setUp(self):
+        net_file = simple_net_file(6)
+        self.net = caffe.Net(net_file)
+        os.remove(net_file)
+        self.net.set_phase_test()
+        self.net.set_mode_cpu()
+        self.net.set_mean('data', np.random.rand(3, 4, 5).astype(np.float32))
+        self.net.set_raw_scale('data', 255)
+        self.net.set_input_scale('data', 0.5)
+        self.net.set_channel_swap('data', (2, 1, 0))
+        self.image_dims = (7, 8)
+        self.crop_dims = np.array((4, 5))
+        # One image is scaled up and one is at image_dims already.
+        self.images = [np.random.rand(5, 6, 3).astype(np.float32),
+                       np.random.rand(7, 8, 3).astype(np.float32)]
+
+    def preprocess(self, oversample):
+        """Preprocess self.images as Classifier.predict did in numpy."""
+        input_ = np.array([caffe.io.resize_image(im, self.image_dims)
+                           for im in self.images])
+        if oversample:
+            input_ = caffe.io.oversample(input_, self.crop_dims)
+        else:
+            center = np.array(self.image_dims) / 2.0
+            crop = (np.tile(center, (1, 2))[0] + np.concatenate([
+                -self.crop_dims / 2.0,
+                self.crop_dims / 2.0
+            ])).astype(int)
+            input_ = input_[:, crop[0]:crop[2], crop[1]:crop[3], :]
+        return np.array([self.net.preprocess('data', in_) for in_ in input_])
+
+    def check_preprocess_batch(self, oversample):
+        self.net._preprocess_batch('data', self.images, self.image_dims[0],
+                                   self.image_dims[1], oversample)
+        expected = self.preprocess(oversample)
+        actual = self.net.blobs['data'].data
+        self.assertEqual(expected.shape, actual.shape)
+        self.assertTrue(np.allclose(expected, actual, atol=1e-3))
+
+    def test_center_crop(self):
+        self.check_preprocess_batch(False)
+
+    def test_oversample(self):
+        self.check_preprocess_batch(True)
+
+
+class TestClassifier(unittest.TestCase):
+    def setUp(self):
+        net_file = simple_net_file(6)
+        self.net = caffe.Net(net_file)
+        self.net.save(net_file + '.caffemodel')
+        self.classifier = caffe.Classifier(net_file,
+                                           net_file + '.caffemodel',
+                                           image_dims=(7, 8))
+        os.remove(net_file)
+        os.remove(net_file + '.caffemodel')
+        self.images = [np.random.rand(5, 6, 3).astype(np.float32)
+                       for _ in range(3)]
+
+    def test_predict_in_batches(self):
+        # The net input holds one image of ten crops, or ten center crops.
+        for oversample in (True, False):
+            predictions = self.classifier.predict(self.images, oversample)
+            self.assertEqual(predictions.shape, (3, 6))
+            for image, prediction in zip(self.images, predictions):
+                expected = self.classifier.predict([image], oversample)
+                self.assertTrue(np.allclose(expected[0], prediction))
+            self.assertEqual(self.classifier.blobs['data'].data.shape,
+                             (10, 3, 4, 5))
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -103,6 +105,23 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::SetDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  const int memory_capacity = memory->size() / sizeof(Dtype);
+  CHECK_GE(memory_capacity, count_);
+  data_ = memory;
+  // diff_ still holds the old capacity_ elements.
+  capacity_ = std::min(capacity_, memory_capacity);
+}
+
+template <typename Dtype>
+void Blob<Dtype>::SetDiffMemory(const shared_ptr<SyncedMemory>& memory) {
+  const int memory_capacity = memory->size() / sizeof(Dtype);
+  CHECK_GE(memory_capacity, count_);
+  diff_ = memory;
+  capacity_ = std::min(capacity_, memory_capacity);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -1,9 +1,13 @@
+#include <boost/thread.hpp>
 #include <glog/logging.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -37,10 +41,43 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InitGoogleLogging(*(pargv)[0]);
 }
 
+int Caffe::cpu_threads() {
+  if (Get().cpu_threads_ == 0) {
+    Get().cpu_threads_ = std::max(1u, boost::thread::hardware_concurrency());
+  }
+  return Get().cpu_threads_;
+}
+
+// Element-wise kernels may reach cpu_thread_pool() from data prefetching
+// threads as well as from the main thread.
+static boost::mutex cpu_thread_pool_mutex;
+
+void Caffe::set_cpu_threads(const int num_threads) {
+  CHECK_GE(num_threads, 0);
+  boost::mutex::scoped_lock lock(cpu_thread_pool_mutex);
+  Get().cpu_threads_ = num_threads;
+  Get().cpu_thread_pool_.reset();
+}
+
+ThreadPool* Caffe::cpu_thread_pool() {
+  boost::mutex::scoped_lock lock(cpu_thread_pool_mutex);
+  if (!Get().cpu_thread_pool_) {
+    // The thread calling ThreadPool::Run works too.
+    Get().cpu_thread_pool_.reset(new ThreadPool(cpu_threads() - 1));
+  }
+  return Get().cpu_thread_pool_.get();
+}
+
+void Caffe::set_cpu_grain_size(const int grain_size) {
+  CHECK_GT(grain_size, 0);
+  Get().cpu_grain_size_ = grain_size;
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
+    : random_generator_(), cpu_threads_(0), cpu_grain_size_(1 << 15),
+    mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
 
 Caffe::~Caffe() { }
 
@@ -84,7 +121,8 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), phase_(Caffe::TRAIN) {
+    cpu_threads_(0), cpu_grain_size_(1 << 15), mode_(Caffe::CPU),
+    phase_(Caffe::TRAIN) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
@@ -12,6 +12,42 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
                                        const Dtype* mean,
                                        Dtype* transformed_data) {
   const string& data = datum.data();
+  Transform(batch_item_id, datum, data.size() ? data.data() : NULL, mean,
+            transformed_data);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const Datum& datum,
+                                       const char* data,
+                                       const Dtype* mean,
+                                       Dtype* transformed_data) {
+  RandomDraws draws;
+  DrawRandom(&draws);
+  Transform(batch_item_id, datum, data, mean, transformed_data, draws);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::DrawRandom(RandomDraws* draws) {
+  const int crop_size = param_.crop_size();
+  draws->h_off = draws->w_off = draws->mirror = 0;
+  // We only do random crop when we do training.
+  if (crop_size && phase_ == Caffe::TRAIN) {
+    draws->h_off = Rand();
+    draws->w_off = Rand();
+  }
+  if (crop_size && param_.mirror()) {
+    draws->mirror = Rand();
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const Datum& datum,
+                                       const char* data,
+                                       const Dtype* mean,
+                                       Dtype* transformed_data,
+                                       const RandomDraws& draws) {
   const int channels = datum.channels();
   const int height = datum.height();
   const int width = datum.width();
@@ -25,62 +61,65 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
     LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
                << "set at the same time.";
   }
+  const bool has_mean_values = mean_values_.size() > 0;
+  if (has_mean_values) {
+    CHECK(mean_values_.size() == 1 || mean_values_.size() == channels) <<
+        "Specify either 1 mean_value or as many as channels: " << channels;
+  } else {
+    CHECK(mean) << "No mean image given";
+  }
 
   if (crop_size) {
-    CHECK(data.size()) << "Image cropping only support uint8 data";
+    CHECK(data) << "Image cropping only support uint8 data";
     int h_off, w_off;
     // We only do random crop when we do training.
     if (phase_ == Caffe::TRAIN) {
-      h_off = Rand() % (height - crop_size);
-      w_off = Rand() % (width - crop_size);
+      h_off = draws.h_off % (height - crop_size);
+      w_off = draws.w_off % (width - crop_size);
     } else {
       h_off = (height - crop_size) / 2;
       w_off = (width - crop_size) / 2;
     }
-    if (mirror && Rand() % 2) {
-      // Copy mirrored version
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + (crop_size - 1 - w);
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
-          }
-        }
-      }
-    } else {
-      // Normal copy
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + w;
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
-          }
+    const bool do_mirror = mirror && draws.mirror % 2;
+    // Each output row is a contiguous run of crop_size pixels of one input
+    // row, so the rows are transformed as vectors.
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(data);
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < crop_size; ++h) {
+        const int data_index = (c * height + h + h_off) * width + w_off;
+        const int top_index = ((batch_item_id * channels + c) * crop_size + h)
+            * crop_size;
+        if (has_mean_values) {
+          caffe_cpu_uint8_transform(crop_size, pixels + data_index,
+              mean_values_[mean_values_.size() == 1 ? 0 : c], scale,
+              do_mirror, transformed_data + top_index);
+        } else {
+          caffe_cpu_uint8_transform(crop_size, pixels + data_index,
+              mean + data_index, scale, do_mirror,
+              transformed_data + top_index);
         }
       }
     }
   } else {
+    Dtype* top_data = transformed_data + batch_item_id * size;
+    const int channel_size = height * width;
     // we will prefer to use data() first, and then try float_data()
-    if (data.size()) {
-      for (int j = 0; j < size; ++j) {
-        Dtype datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[j]));
-        transformed_data[j + batch_item_id * size] =
-            (datum_element - mean[j]) * scale;
+    if (data && has_mean_values) {
+      const uint8_t* pixels = reinterpret_cast<const uint8_t*>(data);
+      for (int c = 0; c < channels; ++c) {
+        caffe_cpu_uint8_transform(channel_size, pixels + c * channel_size,
+            mean_values_[mean_values_.size() == 1 ? 0 : c], scale, false,
+            top_data + c * channel_size);
       }
+    } else if (data) {
+      caffe_cpu_uint8_transform(size, reinterpret_cast<const uint8_t*>(data),
+          mean, scale, false, top_data);
     } else {
       for (int j = 0; j < size; ++j) {
-        transformed_data[j + batch_item_id * size] =
-            (datum.float_data(j) - mean[j]) * scale;
+        const Dtype datum_mean = has_mean_values ?
+            mean_values_[mean_values_.size() == 1 ? 0 : j / channel_size] :
+            mean[j];
+        top_data[j] = (datum.float_data(j) - datum_mean) * scale;
       }
     }
   }
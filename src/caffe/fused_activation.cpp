@@ -0,0 +1,152 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/fused_activation.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+FusedActivation<Dtype>::FusedActivation(const LayerParameter& param)
+    : layer_param_(param), type_(param.type()), negative_slope_(0),
+      scale_(1), shift_(0) {
+  CHECK(CanFuse(param)) << "Layer " << param.name()
+      << " is not an activation that can be fused.";
+  if (type_ == LayerParameter_LayerType_RELU) {
+    negative_slope_ = param.relu_param().negative_slope();
+  } else if (type_ == LayerParameter_LayerType_POWER) {
+    scale_ = param.power_param().scale();
+    shift_ = param.power_param().shift();
+  }
+}
+
+template <typename Dtype>
+bool FusedActivation<Dtype>::CanFuse(const LayerParameter& param) {
+  if (param.loss_weight_size() > 0) {
+    return false;
+  }
+  switch (param.type()) {
+  case LayerParameter_LayerType_RELU:
+    // A negative slope would make the sign of the output differ from that
+    // of the input, which the backward pass reads it from.
+    return param.relu_param().negative_slope() >= 0;
+  case LayerParameter_LayerType_SIGMOID:
+  case LayerParameter_LayerType_TANH:
+    return true;
+  case LayerParameter_LayerType_POWER:
+    return param.power_param().power() == 1;
+  default:
+    return false;
+  }
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::Forward_cpu(const int n, Dtype* data) const {
+  ParallelFor(n, boost::bind(&FusedActivation<Dtype>::ForwardRange, this,
+                             data, _1, _2));
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::Backward_cpu(const int n, const Dtype* data,
+    Dtype* diff) const {
+  ParallelFor(n, boost::bind(&FusedActivation<Dtype>::BackwardRange, this,
+                             data, diff, _1, _2));
+}
+
+// The arithmetic follows the CPU implementations of the neuron layers, so
+// that fused and separate layers compute the same values.
+template <typename Dtype>
+void FusedActivation<Dtype>::ForwardRange(Dtype* data, const int begin,
+    const int end) const {
+  switch (type_) {
+  case LayerParameter_LayerType_RELU:
+    for (int i = begin; i < end; ++i) {
+      data[i] = std::max(data[i], Dtype(0))
+          + negative_slope_ * std::min(data[i], Dtype(0));
+    }
+    break;
+  case LayerParameter_LayerType_SIGMOID:
+    for (int i = begin; i < end; ++i) {
+      data[i] = 1. / (1. + exp(-data[i]));
+    }
+    break;
+  case LayerParameter_LayerType_TANH:
+    for (int i = begin; i < end; ++i) {
+      const Dtype exp2x = exp(2 * data[i]);
+      data[i] = (exp2x - Dtype(1)) / (exp2x + Dtype(1));
+    }
+    break;
+  case LayerParameter_LayerType_POWER:
+    if (scale_ == Dtype(0)) {
+      std::fill(data + begin, data + end, shift_);
+      break;
+    }
+    for (int i = begin; i < end; ++i) {
+      data[i] = data[i] * scale_ + shift_;
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown fused activation " << type_;
+  }
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::BackwardRange(const Dtype* data, Dtype* diff,
+    const int begin, const int end) const {
+  switch (type_) {
+  case LayerParameter_LayerType_RELU:
+    for (int i = begin; i < end; ++i) {
+      diff[i] = diff[i] * ((data[i] > 0) + negative_slope_ * (data[i] <= 0));
+    }
+    break;
+  case LayerParameter_LayerType_SIGMOID:
+    for (int i = begin; i < end; ++i) {
+      diff[i] = diff[i] * data[i] * (1. - data[i]);
+    }
+    break;
+  case LayerParameter_LayerType_TANH:
+    for (int i = begin; i < end; ++i) {
+      diff[i] = diff[i] * (1 - data[i] * data[i]);
+    }
+    break;
+  case LayerParameter_LayerType_POWER:
+    for (int i = begin; i < end; ++i) {
+      diff[i] = scale_ * diff[i];
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown fused activation " << type_;
+  }
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::SetUpLayer(Blob<Dtype>* blob) {
+  vector<Blob<Dtype>*> blobs(1, blob);
+  if (!layer_) {
+    layer_.reset(GetLayer<Dtype>(layer_param_));
+    layer_->SetUp(blobs, &blobs);
+  } else {
+    layer_->Reshape(blobs, &blobs);
+  }
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::Forward(Blob<Dtype>* blob) {
+  SetUpLayer(blob);
+  vector<Blob<Dtype>*> blobs(1, blob);
+  layer_->Forward(blobs, &blobs);
+}
+
+template <typename Dtype>
+void FusedActivation<Dtype>::Backward(Blob<Dtype>* blob) {
+  SetUpLayer(blob);
+  vector<Blob<Dtype>*> blobs(1, blob);
+  layer_->Backward(blobs, vector<bool>(1, true), &blobs);
+}
+
+INSTANTIATE_CLASS(FusedActivation);
+
+}  // namespace caffe
@@ -24,6 +24,21 @@ bool InternalThread::StartInternalThread() {
   return true;
 }
 
+bool InternalThread::StopInternalThread() {
+  if (is_started()) {
+    try {
+      thread_->interrupt();
+    } catch (...) {
+      return false;
+    }
+  }
+  return WaitForInternalThreadToExit();
+}
+
+bool InternalThread::must_stop() {
+  return boost::this_thread::interruption_requested();
+}
+
 /** Will not return until the internal thread has exited. */
 bool InternalThread::WaitForInternalThreadToExit() {
   if (is_started()) {
@@ -22,6 +22,8 @@ ConvolutionLayer<Dtype>* GetConvolutionLayer(const string& name,
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return new ConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return new WinogradConvolutionLayer<Dtype>(param);
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     return new CuDNNConvolutionLayer<Dtype>(param);
@@ -231,6 +233,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return GetPoolingLayer<Dtype>(name, param);
   case LayerParameter_LayerType_POWER:
     return new PowerLayer<Dtype>(param);
+  case LayerParameter_LayerType_REGION_POOLING:
+    return new RegionPoolingLayer<Dtype>(param);
   case LayerParameter_LayerType_RELU:
     return GetReLULayer<Dtype>(name, param);
   case LayerParameter_LayerType_SILENCE:
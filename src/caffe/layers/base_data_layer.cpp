@@ -32,6 +32,8 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // check if we want to have mean
   if (transform_param_.has_mean_file()) {
+    CHECK_EQ(transform_param_.mean_value_size(), 0) <<
+        "Cannot specify mean_file and mean_value at the same time";
     const string& mean_file = transform_param_.mean_file();
     LOG(INFO) << "Loading mean file from" << mean_file;
     BlobProto blob_proto;
@@ -41,25 +43,53 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GE(data_mean_.channels(), datum_channels_);
     CHECK_GE(data_mean_.height(), datum_height_);
     CHECK_GE(data_mean_.width(), datum_width_);
-  } else {
+  } else if (transform_param_.mean_value_size() == 0) {
     // Simply initialize an all-empty mean.
     data_mean_.Reshape(1, datum_channels_, datum_height_, datum_width_);
   }
-  mean_ = data_mean_.cpu_data();
+  // With mean_value the per-channel means are applied by the transformer
+  // and no mean image is kept.
+  mean_ = data_mean_.count() ? data_mean_.cpu_data() : NULL;
   data_transformer_.InitRand();
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  // Setting up again starts over: the old thread and batches are dropped
+  // before DataLayerSetUp resets the state LoadBatch reads.
+  if (this->is_started()) {
+    JoinPrefetchThread();
+  }
+  // The tops still point at the batch handed out last, see NextBatch; give
+  // them memory of their own before that batch is freed.
+  if (current_batch_) {
+    for (int i = 0; i < top->size(); ++i) {
+      (*top)[i]->SetDataMemory(shared_ptr<SyncedMemory>(
+          new SyncedMemory((*top)[i]->count() * sizeof(Dtype))));
+    }
+  }
+  Batch<Dtype>* batch;
+  while (prefetch_free_.try_pop(&batch) || prefetch_full_.try_pop(&batch)) {}
+  current_batch_ = NULL;
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  const int prefetch_count = this->prefetch_count();
+  CHECK_GT(prefetch_count, 0) << "Data layers need at least one batch.";
+  // Shape every batch like the tops set up by DataLayerSetUp. Before starting
+  // the thread, we make cpu_data calls so that the prefetch thread does not
+  // accidentally make simultaneous cudaMalloc calls when the main thread is
+  // running. In some GPUs this seems to cause failures if we do not so.
+  prefetch_.resize(prefetch_count);
+  for (int i = 0; i < prefetch_count; ++i) {
+    prefetch_[i].reset(new Batch<Dtype>());
+    Batch<Dtype>* batch = prefetch_[i].get();
+    batch->data_.ReshapeLike(*(*top)[0]);
+    batch->data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      batch->label_.ReshapeLike(*(*top)[1]);
+      batch->label_.mutable_cpu_data();
+    }
+    prefetch_free_.push(batch);
   }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
@@ -75,23 +105,37 @@ void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  CHECK(StopInternalThread()) << "Thread joining failed";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
-    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             (*top)[0]->mutable_cpu_data());
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  while (!must_stop()) {
+    Batch<Dtype>* batch = prefetch_free_.pop();
+    LoadBatch(batch);
+    prefetch_full_.push(batch);
+  }
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::NextBatch(vector<Blob<Dtype>*>* top) {
+  // The batch handed out at the previous iteration is no longer in use.
+  if (current_batch_) {
+    prefetch_free_.push(current_batch_);
+  }
+  current_batch_ = prefetch_full_.pop("Data layer prefetch queue empty");
+  // Point the tops at the batch instead of copying it. set_cpu_data keeps the
+  // tops' SyncedMemory objects, so blobs sharing them see the new data too.
+  (*top)[0]->set_cpu_data(current_batch_->data_.mutable_cpu_data());
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               (*top)[1]->mutable_cpu_data());
+    (*top)[1]->set_cpu_data(current_batch_->label_.mutable_cpu_data());
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  NextBatch(top);
 }
 
 #ifdef CPU_ONLY
@@ -1,3 +1,6 @@
+#include <stdint.h>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -47,6 +50,18 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     stride_h_ = conv_param.stride_h();
     stride_w_ = conv_param.stride_w();
   }
+  // A 1x1 kernel with unit stride and no padding needs no unrolling on the
+  // CPU: each image is already its own column matrix.
+  is_1x1_ = kernel_h_ == 1 && kernel_w_ == 1 && stride_h_ == 1 &&
+      stride_w_ == 1 && pad_h_ == 0 && pad_w_ == 0;
+  if (this->layer_param_.has_fused_activation()) {
+    fused_activation_.reset(new FusedActivation<Dtype>(
+        this->layer_param_.fused_activation()));
+  }
+  if (this->layer_param_.has_quantization_param()) {
+    quantized_gemm_.reset(new QuantizedGemm<Dtype>(
+        this->layer_param_.quantization_param()));
+  }
   // Configure output channels and groups.
   channels_ = bottom[0]->channels();
   num_output_ = this->layer_param_.convolution_param().num_output();
@@ -117,49 +132,102 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   M_ = num_output_ / group_;
   K_ = channels_ * kernel_h_ * kernel_w_ / group_;
   N_ = height_out_ * width_out_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage.
-  col_buffer_.Reshape(
-      1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  // The im2col result buffer holds col_batch_ images side by side, by default
+  // only one to avoid overly large memory usage. Batching is CPU only; the
+  // GPU path always unrolls one image at a time, and 1x1 kernels are not
+  // unrolled on the CPU at all.
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  col_batch_ = 1;
+  if (Caffe::mode() == Caffe::CPU && !is_1x1_) {
+    col_batch_ = conv_param.col_batch_size();
+    if (col_batch_ == 0) {
+      // Count the column and output buffers of an image, data and diff.
+      const uint64_t image_bytes = 2 * sizeof(Dtype) *
+          (channels_ * kernel_h_ * kernel_w_ + num_output_) * N_;
+      col_batch_ = std::min<uint64_t>(
+          conv_param.col_buffer_max_bytes() / image_bytes, num_);
+    }
+    col_batch_ = std::max(1, std::min(col_batch_, num_));
+  }
+  col_buffer_.Reshape(1, channels_ * kernel_h_ * kernel_w_,
+      col_batch_ * height_out_, width_out_);
+  if (col_batch_ > 1) {
+    top_buffer_.Reshape(1, num_output_, col_batch_ * height_out_, width_out_);
+  }
   for (int top_id = 0; top_id < top->size(); ++top_id) {
     (*top)[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
   }
-  // Set up the all ones "bias multiplier" for adding biases by BLAS
+  // Set up the all ones "bias multiplier" for adding biases by BLAS, long
+  // enough to add them to a whole batch of images at once.
   if (bias_term_) {
-    bias_multiplier_.Reshape(1, 1, 1, N_);
-    caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    bias_multiplier_.Reshape(1, 1, 1, col_batch_ * N_);
+    caffe_set(bias_multiplier_.count(), Dtype(1),
+              bias_multiplier_.mutable_cpu_data());
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  const bool quantized = quantized_gemm_ && Caffe::phase() == Caffe::TEST;
+  if (quantized) {
+    quantized_gemm_->QuantizeWeights(num_output_, K_, this->blobs_[0].get());
+  } else {
+    CHECK(!quantized_gemm_ || !quantized_gemm_->float_weights_dropped())
+        << this->layer_param_.name() << " dropped its float weights and only "
+        << "runs its int8 CPU forward pass in the TEST phase";
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    Dtype* col_data = col_buffer_.mutable_cpu_data();
-    const Dtype* weight = this->blobs_[0]->cpu_data();
+    Dtype* col_data = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
+    const Dtype* weight = quantized ? NULL : this->blobs_[0]->cpu_data();
     int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int col_offset = K_ * N_;  // number of values in an input region / column
-    int top_offset = M_ * N_;  // number of values in an output region / column
-    for (int n = 0; n < num_; ++n) {
+    for (int n = 0; n < num_; n += col_batch_) {
       // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      im2col_cpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
-      // Take inner products for groups.
+      // into column matrix for multplication. The images of a batch sit side
+      // by side, so a column row spans cols values.
+      const int batch = std::min(col_batch_, num_ - n);
+      const int cols = batch * N_;
+      const Dtype* col = col_data;
+      if (is_1x1_) {
+        col = bottom_data + bottom[i]->offset(n);
+      } else {
+        for (int j = 0; j < batch; ++j) {
+          im2col_cpu(bottom_data + bottom[i]->offset(n + j), channels_,
+              height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              stride_h_, stride_w_, col_data + j * N_, cols);
+        }
+      }
+      // Take inner products for groups. A single image is already in the
+      // layout of the top; a batch goes through top_buffer_.
+      Dtype* output = (batch == 1) ? top_data + (*top)[i]->offset(n) :
+          top_buffer_.mutable_cpu_data();
       for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+        if (quantized) {
+          quantized_gemm_->ForwardConvolution(M_ * g, M_, cols,
+              col + K_ * cols * g, output + M_ * cols * g);
+        } else {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, cols, K_,
+            (Dtype)1., weight + weight_offset * g, col + K_ * cols * g,
+            (Dtype)0., output + M_ * cols * g);
+        }
       }
-      // Add bias.
+      // Add bias and activate the whole batch at once.
       if (bias_term_) {
         caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-            N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-            bias_multiplier_.cpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+            cols, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            bias_multiplier_.cpu_data(), (Dtype)1., output);
+      }
+      if (fused_activation_) {
+        fused_activation_->Forward_cpu(num_output_ * cols, output);
+      }
+      for (int j = 0; batch > 1 && j < batch; ++j) {
+        Dtype* image_top = top_data + (*top)[i]->offset(n + j);
+        for (int c = 0; c < num_output_; ++c) {
+          caffe_copy(N_, output + c * cols + j * N_, image_top + c * N_);
+        }
       }
     }
   }
@@ -181,9 +249,12 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   const int weight_offset = M_ * K_;
-  const int col_offset = K_ * N_;
-  const int top_offset = M_ * N_;
   for (int i = 0; i < top.size(); ++i) {
+    // Turn the diff of the activated top into that of the convolution.
+    if (fused_activation_) {
+      fused_activation_->Backward_cpu(top[i]->count(), top[i]->cpu_data(),
+          top[i]->mutable_cpu_diff());
+    }
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
     if (bias_term_ && this->param_propagate_down_[1]) {
@@ -199,22 +270,46 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->cpu_diff();
       }
-      Dtype* col_data = col_buffer_.mutable_cpu_data();
-      Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+      Dtype* col_data = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
+      Dtype* col_diff = is_1x1_ ? NULL : col_buffer_.mutable_cpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->cpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
-      for (int n = 0; n < num_; ++n) {
+      for (int n = 0; n < num_; n += col_batch_) {
         // Since we saved memory in the forward pass by not storing all col
         // data, we will need to recompute them.
-        im2col_cpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+        const int batch = std::min(col_batch_, num_ - n);
+        const int cols = batch * N_;
+        const Dtype* col = col_data;
+        Dtype* col_grad = col_diff;
+        if (is_1x1_) {
+          col = bottom_data + (*bottom)[i]->offset(n);
+          col_grad = bottom_diff + (*bottom)[i]->offset(n);
+        } else {
+          for (int j = 0; j < batch; ++j) {
+            im2col_cpu(bottom_data + (*bottom)[i]->offset(n + j), channels_,
+                height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                stride_h_, stride_w_, col_data + j * N_, cols);
+          }
+        }
+        // Gather the top diff of a batch into the GEMM layout.
+        const Dtype* output_diff = top_diff + top[i]->offset(n);
+        if (batch > 1) {
+          Dtype* buffer_diff = top_buffer_.mutable_cpu_diff();
+          for (int j = 0; j < batch; ++j) {
+            const Dtype* image_diff = top_diff + top[i]->offset(n + j);
+            for (int c = 0; c < num_output_; ++c) {
+              caffe_copy(N_, image_diff + c * N_,
+                         buffer_diff + c * cols + j * N_);
+            }
+          }
+          output_diff = buffer_diff;
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
           for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_data + col_offset * g, (Dtype)1.,
+            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, cols,
+                (Dtype)1., output_diff + M_ * cols * g,
+                col + K_ * cols * g, (Dtype)1.,
                 weight_diff + weight_offset * g);
           }
         }
@@ -224,15 +319,17 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
             weight = this->blobs_[0]->cpu_data();
           }
           for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, cols, M_,
                 (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
+                output_diff + M_ * cols * g,
+                (Dtype)0., col_grad + K_ * cols * g);
           }
           // col2im back to the data
-          col2im_cpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_,
-              stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
+          for (int j = 0; j < batch && !is_1x1_; ++j) {
+            col2im_cpu(col_diff + j * N_, channels_, height_, width_,
+                kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+                bottom_diff + (*bottom)[i]->offset(n + j), cols);
+          }
         }
       }
     }
@@ -12,6 +12,9 @@ namespace caffe {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  CHECK(!quantized_gemm_ || !quantized_gemm_->float_weights_dropped())
+      << this->layer_param_.name() << " dropped its float weights and only "
+      << "runs its int8 CPU forward pass in the TEST phase";
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* top_data = (*top)[i]->mutable_gpu_data();
@@ -40,6 +43,9 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
             (Dtype)1., top_data + (*top)[i]->offset(n));
       }
     }
+    if (fused_activation_) {
+      fused_activation_->Forward((*top)[i]);
+    }
   }
 }
 
@@ -63,6 +69,9 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const int col_offset = K_ * N_;
   const int top_offset = M_ * N_;
   for (int i = 0; i < top.size(); ++i) {
+    if (fused_activation_) {
+      fused_activation_->Backward(top[i]);
+    }
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
     if (bias_term_ && this->param_propagate_down_[1]) {
@@ -21,6 +21,8 @@ template <typename Dtype>
 void CuDNNConvolutionLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK(!this->fused_activation_)
+      << "The CUDNN engine does not apply fused activations.";
   // Initialize CUDA streams and cuDNN.
   stream_         = new cudaStream_t[this->group_ * CUDNN_STREAMS_PER_GROUP];
   handle_         = new cudnnHandle_t[this->group_ * CUDNN_STREAMS_PER_GROUP];
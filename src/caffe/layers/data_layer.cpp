@@ -1,3 +1,4 @@
+#include <boost/bind.hpp>
 #include <leveldb/db.h>
 #include <stdint.h>
 
@@ -11,6 +12,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -116,14 +118,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (crop_size > 0) {
     (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
                        datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), crop_size, crop_size);
   } else {
     (*top)[0]->Reshape(
         this->layer_param_.data_param().batch_size(), datum.channels(),
         datum.height(), datum.width());
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), datum.height(), datum.width());
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -131,51 +129,66 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   if (this->output_labels_) {
     (*top)[1]->Reshape(this->layer_param_.data_param().batch_size(), 1, 1, 1);
-    this->prefetch_label_.Reshape(this->layer_param_.data_param().batch_size(),
-        1, 1, 1);
   }
   // datum size
   this->datum_channels_ = datum.channels();
   this->datum_height_ = datum.height();
   this->datum_width_ = datum.width();
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
+
+  // workers: the prefetch thread itself acts as worker 0, and uses the
+  // layer's own data_transformer_.
+  const int num_workers = this->layer_param_.data_param().num_workers();
+  CHECK_GT(num_workers, 0);
+  workers_.reset(new ThreadPool(num_workers - 1));
+  worker_transformers_.clear();
+  for (int i = 1; i < num_workers; ++i) {
+    worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_)));
+    worker_transformers_.back()->InitRand();
+  }
+  datums_.resize(this->layer_param_.data_param().batch_size());
+  item_data_.resize(this->layer_param_.data_param().batch_size());
+  item_buffers_.resize(this->layer_param_.data_param().batch_size());
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to fill a batch.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
-  if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
-  }
+void DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
   const int batch_size = this->layer_param_.data_param().batch_size();
 
+  // Reading the database is sequential, so the datums of the whole batch are
+  // parsed here first and only the transformations are spread over workers.
+  int data_size;
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       CHECK(iter_);
       CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      CHECK(ParseDatumHeaderFromArray(iter_->value().data(),
+          iter_->value().size(), &datums_[item_id], &item_data_[item_id],
+          &data_size));
+      if (item_data_[item_id]) {
+        item_buffers_[item_id].assign(item_data_[item_id], data_size);
+        item_data_[item_id] = item_buffers_[item_id].data();
+      }
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      // The read-only transaction stays open for the layer's lifetime, so
+      // pointers into the map remain valid.
+      CHECK(ParseDatumHeaderFromArray(mdb_value_.mv_data, mdb_value_.mv_size,
+          &datums_[item_id], &item_data_[item_id], &data_size));
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
-
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+    if (item_data_[item_id]) {
+      const Datum& datum = datums_[item_id];
+      CHECK_EQ(data_size, datum.channels() * datum.height() * datum.width());
     }
 
     // go to the next iter
@@ -201,6 +214,37 @@ void DataLayer<Dtype>::InternalThreadEntry() {
       LOG(FATAL) << "Unknown database backend";
     }
   }
+
+  const int num_workers = this->layer_param_.data_param().num_workers();
+  workers_->Run(num_workers,
+      boost::bind(&DataLayer<Dtype>::TransformItems, this, batch, _1));
+}
+
+// Transforms worker_id's share of the batch. Each worker owns a transformer,
+// and hence an RNG stream, and always gets the same contiguous range of
+// items, so the random crops and mirrors only depend on the seed.
+template <typename Dtype>
+void DataLayer<Dtype>::TransformItems(Batch<Dtype>* batch,
+    const int worker_id) {
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  const int num_workers = this->layer_param_.data_param().num_workers();
+  const int begin = batch_size * worker_id / num_workers;
+  const int end = batch_size * (worker_id + 1) / num_workers;
+  DataTransformer<Dtype>* transformer = (worker_id == 0) ?
+      &this->data_transformer_ : worker_transformers_[worker_id - 1].get();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
+  if (this->output_labels_) {
+    top_label = batch->label_.mutable_cpu_data();
+  }
+  for (int item_id = begin; item_id < end; ++item_id) {
+    // Apply data transformations (mirror, scale, crop...)
+    transformer->Transform(item_id, datums_[item_id], item_data_[item_id],
+                           this->mean_, top_data);
+    if (this->output_labels_) {
+      top_label[item_id] = datums_[item_id].label();
+    }
+  }
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -1,11 +1,4 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -14,46 +7,51 @@ TODO:
 #include "hdf5_hl.h"
 #include "stdint.h"
 
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
-#include "caffe/vision_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
-template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
-
-// Load data and label from HDF5 filename into the class property blobs.
-template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  LOG(INFO) << "Loading HDF5 file" << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(ERROR) << "Failed opening HDF5 file" << filename;
-    return;
-  }
+namespace {
 
-  const int MIN_DATA_DIM = 2;
-  const int MAX_DATA_DIM = 4;
-  hdf5_load_nd_dataset(
-    file_id, "data",  MIN_DATA_DIM, MAX_DATA_DIM, &data_blob_);
+// Opens dataset name of file_id after checking that it holds floats with
+// min_dim to max_dim dimensions, whose sizes go to dims padded to four.
+// Call with the HDF5 lock held.
+hid_t OpenDataset(hid_t file_id, const char* name, int min_dim, int max_dim,
+    vector<hsize_t>* dims) {
+  hid_t dataset = H5Dopen2(file_id, name, H5P_DEFAULT);
+  CHECK_GE(dataset, 0) << "Failed to open dataset " << name;
+  hid_t type = H5Dget_type(dataset);
+  CHECK_EQ(H5Tget_class(type), H5T_FLOAT) << "Expected float or double data";
+  H5Tclose(type);
+  hid_t space = H5Dget_space(dataset);
+  const int ndims = H5Sget_simple_extent_ndims(space);
+  CHECK_GE(ndims, min_dim);
+  CHECK_LE(ndims, max_dim);
+  dims->resize(ndims);
+  H5Sget_simple_extent_dims(space, &(*dims)[0], NULL);
+  H5Sclose(space);
+  dims->resize(4, 1);
+  return dataset;
+}
 
-  const int MIN_LABEL_DIM = 1;
-  const int MAX_LABEL_DIM = 2;
-  hdf5_load_nd_dataset(
-    file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, &label_blob_);
+}  // namespace
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file " << filename;
-  CHECK_EQ(data_blob_.num(), label_blob_.num());
-  LOG(INFO) << "Successully loaded " << data_blob_.num() << " rows";
+template <typename Dtype>
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->JoinPrefetchThread();
+  CloseHDF5File();
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+void HDF5DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const string& source = param.source();
   LOG(INFO) << "Loading filename from " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -64,16 +62,37 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }
   source_file.close();
-  num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
-  LOG(INFO) << "Number of files: " << num_files_;
+  CHECK_GT(hdf_filenames_.size(), 0) << "No HDF5 files listed in " << source;
+  LOG(INFO) << "Number of files: " << hdf_filenames_.size();
+  const int batch_size = param.batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  chunk_size_ = param.chunk_size() ? param.chunk_size() : batch_size;
+  CHECK_GT(param.resident_chunks(), 0) << "At least one chunk must be resident";
+
+  file_permutation_.resize(hdf_filenames_.size());
+  for (int i = 0; i < file_permutation_.size(); ++i) {
+    file_permutation_[i] = i;
+  }
+  prefetch_rng_.reset();
+  if (param.shuffle()) {
+    LOG(INFO) << "Shuffling data";
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    caffe::rng_t* prefetch_rng =
+        static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(file_permutation_.begin(), file_permutation_.end(), prefetch_rng);
+  }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
+  // Open the first file to learn the shape of the rows; its first chunks are
+  // read by the prefetch thread.
+  data_blob_.Reshape(0, 0, 0, 0);
+  label_blob_.Reshape(0, 0, 0, 0);
+  current_file_ = 0;
+  OpenHDF5File();
+  resident_rows_ = 0;
   current_row_ = 0;
 
   // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
   (*top)[0]->Reshape(batch_size, data_blob_.channels(),
                      data_blob_.height(), data_blob_.width());
   (*top)[1]->Reshape(batch_size, label_blob_.channels(),
@@ -81,38 +100,178 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
+  this->datum_channels_ = data_blob_.channels();
+  this->datum_height_ = data_blob_.height();
+  this->datum_width_ = data_blob_.width();
+  this->datum_size_ = data_blob_.count() / data_blob_.num();
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int data_count = (*top)[0]->count() / (*top)[0]->num();
-  const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
-
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blob_.num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
+void HDF5DataLayer<Dtype>::OpenHDF5File() {
+  CloseHDF5File();
+  const string& filename = hdf_filenames_[file_permutation_[current_file_]];
+  DLOG(INFO) << "Opening HDF5 file " << filename;
+  vector<hsize_t> data_dims, label_dims;
+  {
+    HDF5Lock lock;
+    file_id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    CHECK_GE(file_id_, 0) << "Failed opening HDF5 file " << filename;
+    const int MIN_DATA_DIM = 2;
+    const int MAX_DATA_DIM = 4;
+    data_id_ = OpenDataset(file_id_, HDF5_DATA_DATASET_NAME, MIN_DATA_DIM,
+                           MAX_DATA_DIM, &data_dims);
+    const int MIN_LABEL_DIM = 1;
+    const int MAX_LABEL_DIM = 2;
+    label_id_ = OpenDataset(file_id_, HDF5_DATA_LABEL_NAME, MIN_LABEL_DIM,
+                            MAX_LABEL_DIM, &label_dims);
+  }
+  CHECK_EQ(data_dims[0], label_dims[0]) << filename
+      << " has a different number of data and label rows";
+  CHECK_GT(data_dims[0], 0) << filename << " has no rows";
+  file_rows_ = data_dims[0];
+  if (data_blob_.count() == 0) {
+    // The resident chunks are only ever touched by the prefetch thread, but
+    // are allocated here like the batches; see BasePrefetchingDataLayer.
+    const int resident_rows =
+        this->layer_param_.hdf5_data_param().resident_chunks() * chunk_size_;
+    data_blob_.Reshape(resident_rows, data_dims[1], data_dims[2],
+                       data_dims[3]);
+    label_blob_.Reshape(resident_rows, label_dims[1], label_dims[2],
+                        label_dims[3]);
+    data_blob_.mutable_cpu_data();
+    label_blob_.mutable_cpu_data();
+  } else {
+    CHECK(data_blob_.channels() == data_dims[1] &&
+          data_blob_.height() == data_dims[2] &&
+          data_blob_.width() == data_dims[3] &&
+          label_blob_.channels() == label_dims[1])
+        << filename << " has rows of another shape than the first file";
+  }
+  chunk_begin_.clear();
+  for (hsize_t row = 0; row < file_rows_; row += chunk_size_) {
+    chunk_begin_.push_back(row);
+  }
+  if (prefetch_rng_) {
+    caffe::rng_t* prefetch_rng =
+        static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(chunk_begin_.begin(), chunk_begin_.end(), prefetch_rng);
+  }
+  current_chunk_ = 0;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CloseHDF5File() {
+  if (file_id_ < 0) {
+    return;
+  }
+  HDF5Lock lock;
+  H5Dclose(data_id_);
+  H5Dclose(label_id_);
+  herr_t status = H5Fclose(file_id_);
+  CHECK_GE(status, 0) << "Failed to close HDF5 file "
+      << hdf_filenames_[file_permutation_[current_file_]];
+  file_id_ = -1;
+  data_id_ = -1;
+  label_id_ = -1;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ReadRows(hid_t dataset, hsize_t row, hsize_t rows,
+    Blob<Dtype>* blob, int blob_row) {
+  HDF5Lock lock;
+  hid_t file_space = H5Dget_space(dataset);
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  vector<hsize_t> start(ndims, 0);
+  vector<hsize_t> count(ndims);
+  H5Sget_simple_extent_dims(file_space, &count[0], NULL);
+  start[0] = row;
+  count[0] = rows;
+  herr_t status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start[0],
+                                      NULL, &count[0], NULL);
+  CHECK_GE(status, 0) << "Failed to select HDF5 rows " << row << " to "
+      << row + rows;
+  hid_t mem_space = H5Screate_simple(ndims, &count[0], NULL);
+  status = H5Dread(dataset, hdf5_native_type<Dtype>(), mem_space, file_space,
+      H5P_DEFAULT, blob->mutable_cpu_data() + blob->offset(blob_row));
+  CHECK_GE(status, 0) << "Failed to read HDF5 rows " << row << " to "
+      << row + rows;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadChunks() {
+  resident_rows_ = 0;
+  const int resident_chunks =
+      this->layer_param_.hdf5_data_param().resident_chunks();
+  for (int i = 0; i < resident_chunks; ++i) {
+    if (current_chunk_ == chunk_begin_.size()) {
+      current_file_ += 1;
+      if (current_file_ == hdf_filenames_.size()) {
+        current_file_ = 0;
+        LOG(INFO) << "looping around to first file";
+        if (prefetch_rng_) {
+          caffe::rng_t* prefetch_rng =
+              static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+          shuffle(file_permutation_.begin(), file_permutation_.end(),
+                  prefetch_rng);
         }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
       }
-      current_row_ = 0;
+      OpenHDF5File();
+    }
+    const hsize_t row = chunk_begin_[current_chunk_++];
+    const hsize_t rows =
+        std::min(static_cast<hsize_t>(chunk_size_), file_rows_ - row);
+    ReadRows(data_id_, row, rows, &data_blob_, resident_rows_);
+    ReadRows(label_id_, row, rows, &label_blob_, resident_rows_);
+    resident_rows_ += rows;
+  }
+  if (prefetch_rng_) {
+    row_permutation_.resize(resident_rows_);
+    for (int i = 0; i < resident_rows_; ++i) {
+      row_permutation_[i] = i;
     }
-    caffe_copy(data_count, &data_blob_.cpu_data()[current_row_ * data_count],
-               &(*top)[0]->mutable_cpu_data()[i * data_count]);
-    caffe_copy(label_data_count,
-               &label_blob_.cpu_data()[current_row_ * label_data_count],
-               &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
+    caffe::rng_t* prefetch_rng =
+        static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(row_permutation_.begin(), row_permutation_.end(), prefetch_rng);
   }
+  current_row_ = 0;
 }
 
-#ifdef CPU_ONLY
-STUB_GPU_FORWARD(HDF5DataLayer, Forward);
-#endif
+// This function is called on the prefetch thread to fill a batch.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  const int batch_size = batch->data_.num();
+  const int data_count = batch->data_.count() / batch_size;
+  const int label_data_count = batch->label_.count() / batch_size;
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  for (int i = 0; i < batch_size; ) {
+    if (current_row_ == resident_rows_) {
+      LoadChunks();
+    }
+    if (prefetch_rng_) {
+      const int row = row_permutation_[current_row_++];
+      caffe_copy(data_count, data_blob_.cpu_data() + row * data_count,
+                 top_data + i * data_count);
+      caffe_copy(label_data_count,
+                 label_blob_.cpu_data() + row * label_data_count,
+                 top_label + i * label_data_count);
+      ++i;
+    } else {
+      // Unshuffled rows are handed out in order, as many at once as fit.
+      const int rows = std::min(batch_size - i, resident_rows_ - current_row_);
+      caffe_copy(rows * data_count,
+                 data_blob_.cpu_data() + current_row_ * data_count,
+                 top_data + i * data_count);
+      caffe_copy(rows * label_data_count,
+                 label_blob_.cpu_data() + current_row_ * label_data_count,
+                 top_label + i * label_data_count);
+      i += rows;
+      current_row_ += rows;
+    }
+  }
+}
 
 INSTANTIATE_CLASS(HDF5DataLayer);
 
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "hdf5.h"
@@ -14,8 +17,10 @@ namespace caffe {
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
-      file_name_(param.hdf5_output_param().file_name()) {
+      file_name_(param.hdf5_output_param().file_name()),
+      rows_written_(0) {
   /* create a HDF5 file */
+  HDF5Lock lock;
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
@@ -23,50 +28,170 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  // Let the writer drain the queue before closing the file.
+  if (is_started()) {
+    write_full_.push(-1);
+    CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  }
+  HDF5Lock lock;
+  for (int i = 0; i < dataset_ids_.size(); ++i) {
+    if (dataset_ids_[i] >= 0) {
+      H5Dclose(dataset_ids_[i]);
+    }
+  }
   herr_t status = H5Fclose(file_id_);
   CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
+  LOG(INFO) << "Saved " << rows_written_ << " rows to " << file_name_;
+}
+
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  if (is_started()) {
+    CHECK_EQ(bottom.size(), dataset_names_.size())
+        << "The number of bottoms cannot change once writing has started";
+    return;
+  }
+  const HDF5OutputParameter& param = this->layer_param_.hdf5_output_param();
+  CHECK_LE(param.dataset_name_size(), bottom.size())
+      << "More dataset names than bottoms";
+  CHECK_LE(param.compression_level(), 9) << "gzip levels range from 1 to 9";
+  dataset_names_.resize(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (i < param.dataset_name_size()) {
+      dataset_names_[i] = param.dataset_name(i);
+    } else if (i == 0) {
+      dataset_names_[i] = HDF5_DATA_DATASET_NAME;
+    } else if (i == 1) {
+      dataset_names_[i] = HDF5_DATA_LABEL_NAME;
+    } else {
+      std::ostringstream name;
+      name << HDF5_DATA_DATASET_NAME << "_" << i;
+      dataset_names_[i] = name.str();
+    }
+  }
+  dataset_ids_.assign(bottom.size(), -1);
+  const int write_queue = param.write_queue();
+  CHECK_GT(write_queue, 0) << "The writer needs at least one buffer";
+  buffers_.resize(write_queue);
+  for (int b = 0; b < write_queue; ++b) {
+    buffers_[b].resize(bottom.size());
+    for (int i = 0; i < bottom.size(); ++i) {
+      buffers_[b][i].reset(new Blob<Dtype>());
+    }
+    write_free_.push(b);
+  }
+  CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
-void HDF5OutputLayer<Dtype>::SaveBlobs() {
-  // TODO: no limit on the number of blobs
-  LOG(INFO) << "Saving HDF5 file" << file_name_;
-  CHECK_EQ(data_blob_.num(), label_blob_.num()) <<
-      "data blob and label blob must have the same batch size";
-  hdf5_save_nd_dataset(file_id_, HDF5_DATA_DATASET_NAME, data_blob_);
-  hdf5_save_nd_dataset(file_id_, HDF5_DATA_LABEL_NAME, label_blob_);
-  LOG(INFO) << "Successfully saved " << data_blob_.num() << " rows";
+void HDF5OutputLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  for (int i = 1; i < bottom.size(); ++i) {
+    CHECK_EQ(bottom[0]->num(), bottom[i]->num())
+        << "All bottoms must have the same number of rows";
+  }
+}
+
+template <typename Dtype>
+int HDF5OutputLayer<Dtype>::NextBuffer(const vector<Blob<Dtype>*>& bottom) {
+  const int b = write_free_.pop("HDF5 output waiting for the writer");
+  for (int i = 0; i < bottom.size(); ++i) {
+    buffers_[b][i]->ReshapeLike(*bottom[i]);
+  }
+  return b;
 }
 
 template <typename Dtype>
 void HDF5OutputLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  CHECK_GE(bottom.size(), 2);
-  CHECK_EQ(bottom[0]->num(), bottom[1]->num());
-  data_blob_.Reshape(bottom[0]->num(), bottom[0]->channels(),
-                     bottom[0]->height(), bottom[0]->width());
-  label_blob_.Reshape(bottom[1]->num(), bottom[1]->channels(),
-                     bottom[1]->height(), bottom[1]->width());
-  const int data_datum_dim = bottom[0]->count() / bottom[0]->num();
-  const int label_datum_dim = bottom[1]->count() / bottom[1]->num();
+  const int b = NextBuffer(bottom);
+  for (int i = 0; i < bottom.size(); ++i) {
+    caffe_copy(bottom[i]->count(), bottom[i]->cpu_data(),
+               buffers_[b][i]->mutable_cpu_data());
+  }
+  write_full_.push(b);
+}
 
-  for (int i = 0; i < bottom[0]->num(); ++i) {
-    caffe_copy(data_datum_dim, &bottom[0]->cpu_data()[i * data_datum_dim],
-        &data_blob_.mutable_cpu_data()[i * data_datum_dim]);
-    caffe_copy(label_datum_dim, &bottom[1]->cpu_data()[i * label_datum_dim],
-        &label_blob_.mutable_cpu_data()[i * label_datum_dim]);
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::InternalThreadEntry() {
+  for (int b = write_full_.pop(); b >= 0; b = write_full_.pop()) {
+    WriteBuffer(buffers_[b]);
+    write_free_.push(b);
   }
-  SaveBlobs();
 }
 
 template <typename Dtype>
-void HDF5OutputLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-  return;
+void HDF5OutputLayer<Dtype>::CreateDataset(int i, const Blob<Dtype>& blob) {
+  const HDF5OutputParameter& param = this->layer_param_.hdf5_output_param();
+  hsize_t dims[HDF5_NUM_DIMS];
+  hsize_t max_dims[HDF5_NUM_DIMS];
+  hsize_t chunk_dims[HDF5_NUM_DIMS];
+  dims[0] = 0;
+  max_dims[0] = H5S_UNLIMITED;
+  chunk_dims[0] = param.chunk_size() ? param.chunk_size()
+      : std::max(blob.num(), 1);
+  dims[1] = max_dims[1] = chunk_dims[1] = blob.channels();
+  dims[2] = max_dims[2] = chunk_dims[2] = blob.height();
+  dims[3] = max_dims[3] = chunk_dims[3] = blob.width();
+  hid_t space = H5Screate_simple(HDF5_NUM_DIMS, dims, max_dims);
+  hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+  herr_t status = H5Pset_chunk(plist, HDF5_NUM_DIMS, chunk_dims);
+  CHECK_GE(status, 0) << "Failed to chunk dataset " << dataset_names_[i];
+  if (param.compression_level() > 0) {
+    status = H5Pset_deflate(plist, param.compression_level());
+    CHECK_GE(status, 0) << "Failed to compress dataset " << dataset_names_[i];
+  }
+  dataset_ids_[i] = H5Dcreate2(file_id_, dataset_names_[i].c_str(),
+      hdf5_native_type<Dtype>(), space, H5P_DEFAULT, plist, H5P_DEFAULT);
+  CHECK_GE(dataset_ids_[i], 0) << "Failed to create dataset "
+      << dataset_names_[i];
+  H5Pclose(plist);
+  H5Sclose(space);
+}
+
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::WriteBuffer(
+    const vector<shared_ptr<Blob<Dtype> > >& buffer) {
+  HDF5Lock lock;
+  const hsize_t rows = buffer[0]->num();
+  for (int i = 0; i < buffer.size(); ++i) {
+    const Blob<Dtype>& blob = *buffer[i];
+    if (dataset_ids_[i] < 0) {
+      CreateDataset(i, blob);
+    }
+    hsize_t start[HDF5_NUM_DIMS] = {rows_written_, 0, 0, 0};
+    hsize_t count[HDF5_NUM_DIMS];
+    count[0] = rows;
+    count[1] = blob.channels();
+    count[2] = blob.height();
+    count[3] = blob.width();
+    hsize_t dims[HDF5_NUM_DIMS];
+    hid_t file_space = H5Dget_space(dataset_ids_[i]);
+    H5Sget_simple_extent_dims(file_space, dims, NULL);
+    H5Sclose(file_space);
+    CHECK(dims[1] == count[1] && dims[2] == count[2] && dims[3] == count[3])
+        << "Rows of another shape than before for dataset "
+        << dataset_names_[i];
+    dims[0] = rows_written_ + rows;
+    herr_t status = H5Dset_extent(dataset_ids_[i], dims);
+    CHECK_GE(status, 0) << "Failed to extend dataset " << dataset_names_[i];
+    file_space = H5Dget_space(dataset_ids_[i]);
+    status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL,
+                                 count, NULL);
+    CHECK_GE(status, 0) << "Failed to select rows of " << dataset_names_[i];
+    hid_t mem_space = H5Screate_simple(HDF5_NUM_DIMS, count, NULL);
+    status = H5Dwrite(dataset_ids_[i], hdf5_native_type<Dtype>(), mem_space,
+                      file_space, H5P_DEFAULT, blob.cpu_data());
+    CHECK_GE(status, 0) << "Failed to write dataset " << dataset_names_[i];
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+  }
+  rows_written_ += rows;
 }
 
 #ifdef CPU_ONLY
-STUB_GPU(HDF5OutputLayer);
+STUB_GPU_FORWARD(HDF5OutputLayer, Forward);
 #endif
 
 INSTANTIATE_CLASS(HDF5OutputLayer);
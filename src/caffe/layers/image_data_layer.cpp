@@ -1,3 +1,7 @@
+#include <boost/bind.hpp>
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -9,6 +13,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -54,33 +59,41 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_id_ = skip;
   }
   // Read a data point, and use it to initialize the top blob.
+  cv::Mat cv_img;
+  CHECK(ReadImageToCVMat(lines_[lines_id_].first, new_height, new_width,
+                         true, &cv_img));
   Datum datum;
-  CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
-                         new_height, new_width, &datum));
+  datum.set_channels(cv_img.channels());
+  datum.set_height(cv_img.rows);
+  datum.set_width(cv_img.cols);
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const int batch_size = this->layer_param_.image_data_param().batch_size();
   if (crop_size > 0) {
     (*top)[0]->Reshape(batch_size, datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), crop_size,
-                                 crop_size);
   } else {
     (*top)[0]->Reshape(batch_size, datum.channels(), datum.height(),
                        datum.width());
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), datum.height(),
-        datum.width());
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
   // label
   (*top)[1]->Reshape(batch_size, 1, 1, 1);
-  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
   // datum size
   this->datum_channels_ = datum.channels();
   this->datum_height_ = datum.height();
   this->datum_width_ = datum.width();
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
+  // The prefetch thread decodes too, so the pool has one thread less.
+  int decode_threads = this->layer_param_.image_data_param().decode_threads();
+  if (decode_threads == 0) {
+    decode_threads = Caffe::cpu_threads();
+  }
+  decode_pool_.reset(new ThreadPool(std::max(decode_threads, 1) - 1));
+  item_lines_.resize(batch_size);
+  item_draws_.resize(batch_size);
+  item_buffers_.resize(batch_size);
 }
 
 template <typename Dtype>
@@ -90,33 +103,18 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to fill a batch.
 template <typename Dtype>
-void ImageDataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-
-  // datum scales
+void ImageDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  // Pick the lines and random draws of the batch in order on this thread,
+  // so that the results do not depend on how the items are scheduled.
   const int lines_size = lines_.size();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
     CHECK_GT(lines_size, lines_id_);
-    if (!ReadImageToDatum(lines_[lines_id_].first,
-          lines_[lines_id_].second,
-          new_height, new_width, &datum)) {
-      continue;
-    }
-
-    // Apply transformations (mirror, crop...) to the data
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    top_label[item_id] = datum.label();
+    item_lines_[item_id] = lines_id_;
+    this->data_transformer_.DrawRandom(&item_draws_[item_id]);
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
@@ -128,6 +126,38 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
       }
     }
   }
+  decode_pool_->Run(batch_size, boost::bind(&ImageDataLayer<Dtype>::LoadItem,
+      this, boost::cref(batch->data_), batch->data_.mutable_cpu_data(),
+      batch->label_.mutable_cpu_data(), _1));
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::LoadItem(const Blob<Dtype>& data_blob,
+    Dtype* top_data, Dtype* top_label, const int item_id) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const std::pair<std::string, int>& line = lines_[item_lines_[item_id]];
+  top_label[item_id] = line.second;
+  cv::Mat cv_img;
+  if (!ReadImageToCVMat(line.first, image_data_param.new_height(),
+                        image_data_param.new_width(), true,
+                        image_data_param.reduced_decode(), &cv_img)) {
+    // Leave a blank item rather than stall the batch.
+    caffe_set(data_blob.count() / data_blob.num(), Dtype(0),
+              top_data + data_blob.offset(item_id));
+    return;
+  }
+  // Unpack the pixels into this item's own buffer and transform them from
+  // there, without going through a Datum.
+  Datum header;
+  header.set_channels(cv_img.channels());
+  header.set_height(cv_img.rows);
+  header.set_width(cv_img.cols);
+  string* buffer = &item_buffers_[item_id];
+  buffer->resize(cv_img.channels() * cv_img.rows * cv_img.cols);
+  CVMatToPlanar(cv_img, &(*buffer)[0]);
+  this->data_transformer_.Transform(item_id, header, buffer->data(),
+      this->mean_, top_data, item_draws_[item_id]);
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
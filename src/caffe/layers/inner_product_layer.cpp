@@ -40,6 +40,14 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  if (this->layer_param_.has_fused_activation()) {
+    fused_activation_.reset(new FusedActivation<Dtype>(
+        this->layer_param_.fused_activation()));
+  }
+  if (this->layer_param_.has_quantization_param()) {
+    quantized_gemm_.reset(new QuantizedGemm<Dtype>(
+        this->layer_param_.quantization_param()));
+  }
 }
 
 template <typename Dtype>
@@ -62,20 +70,35 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (quantized_gemm_ && Caffe::phase() == Caffe::TEST) {
+    quantized_gemm_->QuantizeWeights(N_, K_, this->blobs_[0].get());
+    quantized_gemm_->ForwardInnerProduct(M_, bottom_data, top_data);
+  } else {
+    CHECK(!quantized_gemm_ || !quantized_gemm_->float_weights_dropped())
+        << this->layer_param_.name() << " dropped its float weights and only "
+        << "runs its int8 CPU forward pass in the TEST phase";
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, this->blobs_[0]->cpu_data(), (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
   }
+  if (fused_activation_) {
+    fused_activation_->Forward_cpu(M_ * N_, top_data);
+  }
 }
 
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     vector<Blob<Dtype>*>* bottom) {
+  // Turn the diff of the activated top into that of the inner product.
+  if (fused_activation_) {
+    fused_activation_->Backward_cpu(top[0]->count(), top[0]->cpu_data(),
+        top[0]->mutable_cpu_diff());
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = (*bottom)[0]->cpu_data();
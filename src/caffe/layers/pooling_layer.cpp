@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <cfloat>
 #include <vector>
@@ -5,14 +7,391 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/cpu_features.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
+#ifdef CAFFE_X86_SIMD
+#include <immintrin.h>  // NOLINT(build/include_order)
+#endif
+
 namespace caffe {
 
 using std::min;
 using std::max;
 
+namespace {
+
+// Below this many bottom elements, pooling runs on the calling thread only.
+const int kMinParallelPoolCount = 1 << 15;
+
+// The geometry of pooling a single (n, c) plane. The window of output
+// (ph, pw) starts at row ph * stride_h - pad_h and column pw * stride_w -
+// pad_w of the image.
+struct PoolingShape {
+  int height, width, pooled_height, pooled_width;
+  int kernel_h, kernel_w, stride_h, stride_w, pad_h, pad_w;
+
+  // Returns K if the windows are KxK with stride 2 and no padding for one of
+  // the K with a specialized kernel, else 0.
+  int FixedKernel() const {
+    if (kernel_h != kernel_w || stride_h != 2 || stride_w != 2 ||
+        pad_h != 0 || pad_w != 0) {
+      return 0;
+    }
+    return (kernel_h == 2 || kernel_h == 3) ? kernel_h : 0;
+  }
+  // For FixedKernel() K, whether the windows of output row ph lie inside the
+  // image, and how many leading windows of a row lie inside its width.
+  bool FixedRow(const int k, const int ph) const {
+    return 2 * ph + k <= height;
+  }
+  int FixedCount(const int k) const {
+    return (width < k) ? 0 : min(pooled_width, (width - k) / 2 + 1);
+  }
+};
+
+// Max pools the window of output (ph, pw) clipped to the image. The mask
+// holds the offset of the maximum within the unclipped window, kh * kernel_w
+// + kw; the first maximum in row-major order wins. A window that falls
+// entirely outside the image gets -FLT_MAX and a mask of -1.
+template <typename Dtype>
+void MaxPoolWindow(const PoolingShape& s, const Dtype* in, const int ph,
+    const int pw, Dtype* out, int* mask) {
+  const int hbase = ph * s.stride_h - s.pad_h;
+  const int wbase = pw * s.stride_w - s.pad_w;
+  const int hstart = max(hbase, 0);
+  const int wstart = max(wbase, 0);
+  const int hend = min(hbase + s.kernel_h, s.height);
+  const int wend = min(wbase + s.kernel_w, s.width);
+  if (hstart >= hend || wstart >= wend) {
+    *out = -FLT_MAX;
+    *mask = -1;
+    return;
+  }
+  Dtype best = in[hstart * s.width + wstart];
+  int best_h = hstart;
+  int best_w = wstart;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      if (in[h * s.width + w] > best) {
+        best = in[h * s.width + w];
+        best_h = h;
+        best_w = w;
+      }
+    }
+  }
+  *out = best;
+  *mask = (best_h - hbase) * s.kernel_w + best_w - wbase;
+}
+
+// Max pools windows [begin, end) of output row ph for KxK windows with
+// stride 2 that lie inside the image, without branches so that the running
+// maximum and its offset stay in registers.
+template <typename Dtype, int K>
+void MaxPoolRowFixed(const PoolingShape& s, const Dtype* in, const int ph,
+    const int begin, const int end, Dtype* out, int* mask) {
+  const Dtype* row = in + 2 * ph * s.width;
+  for (int pw = begin; pw < end; ++pw) {
+    const Dtype* x = row + 2 * pw;
+    Dtype best = x[0];
+    int offset = 0;
+    for (int kh = 0; kh < K; ++kh) {
+      for (int kw = 0; kw < K; ++kw) {
+        const Dtype v = x[kh * s.width + kw];
+        const bool greater = v > best;
+        best = greater ? v : best;
+        offset = greater ? kh * K + kw : offset;
+      }
+    }
+    out[pw] = best;
+    mask[pw] = offset;
+  }
+}
+
+// Average pools the window of output (ph, pw). The divisor counts the
+// window clipped to the padded image, so padding counts as zeros.
+template <typename Dtype>
+void AvePoolWindow(const PoolingShape& s, const Dtype* in, const int ph,
+    const int pw, Dtype* out) {
+  int hstart = ph * s.stride_h - s.pad_h;
+  int wstart = pw * s.stride_w - s.pad_w;
+  int hend = min(hstart + s.kernel_h, s.height + s.pad_h);
+  int wend = min(wstart + s.kernel_w, s.width + s.pad_w);
+  const int pool_size = (hend - hstart) * (wend - wstart);
+  hstart = max(hstart, 0);
+  wstart = max(wstart, 0);
+  hend = min(hend, s.height);
+  wend = min(wend, s.width);
+  Dtype sum = 0;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      sum += in[h * s.width + w];
+    }
+  }
+  *out = sum / pool_size;
+}
+
+// The AvePoolWindow of windows [begin, end) of output row ph, as for
+// MaxPoolRowFixed, summing in the same order.
+template <typename Dtype, int K>
+void AvePoolRowFixed(const PoolingShape& s, const Dtype* in, const int ph,
+    const int begin, const int end, Dtype* out) {
+  const Dtype* row = in + 2 * ph * s.width;
+  for (int pw = begin; pw < end; ++pw) {
+    const Dtype* x = row + 2 * pw;
+    Dtype sum = 0;
+    for (int kh = 0; kh < K; ++kh) {
+      for (int kw = 0; kw < K; ++kw) {
+        sum += x[kh * s.width + kw];
+      }
+    }
+    out[pw] = sum / (K * K);
+  }
+}
+
+#ifdef CAFFE_X86_SIMD
+
+// SSE2 versions of the 2x2 fixed row kernels for float, four windows at a
+// time: the even and odd columns of two rows are split apart by shuffles and
+// compared or summed in the same order as the scalar kernels. They return
+// the number of windows done, leaving the rest to the scalar kernels.
+
+__attribute__((target("sse2")))
+inline void MaxUpdateSse2(const __m128 v, const int offset, __m128* best,
+    __m128i* best_offset) {
+  const __m128 greater = _mm_cmpgt_ps(v, *best);
+  *best = _mm_or_ps(_mm_and_ps(greater, v), _mm_andnot_ps(greater, *best));
+  const __m128i g = _mm_castps_si128(greater);
+  *best_offset = _mm_or_si128(_mm_and_si128(g, _mm_set1_epi32(offset)),
+                              _mm_andnot_si128(g, *best_offset));
+}
+
+__attribute__((target("sse2")))
+int MaxPoolRow2x2Sse2(const PoolingShape& s, const float* in, const int ph,
+    const int count, float* out, int* mask) {
+  const float* r0 = in + 2 * ph * s.width;
+  const float* r1 = r0 + s.width;
+  int pw = 0;
+  for (; pw + 4 <= count; pw += 4) {
+    const __m128 a = _mm_loadu_ps(r0 + 2 * pw);
+    const __m128 b = _mm_loadu_ps(r0 + 2 * pw + 4);
+    const __m128 c = _mm_loadu_ps(r1 + 2 * pw);
+    const __m128 d = _mm_loadu_ps(r1 + 2 * pw + 4);
+    __m128 best = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128i offset = _mm_setzero_si128();
+    MaxUpdateSse2(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), 1,
+                  &best, &offset);
+    MaxUpdateSse2(_mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0)), 2,
+                  &best, &offset);
+    MaxUpdateSse2(_mm_shuffle_ps(c, d, _MM_SHUFFLE(3, 1, 3, 1)), 3,
+                  &best, &offset);
+    _mm_storeu_ps(out + pw, best);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + pw), offset);
+  }
+  return pw;
+}
+
+__attribute__((target("sse2")))
+int AvePoolRow2x2Sse2(const PoolingShape& s, const float* in, const int ph,
+    const int count, float* out) {
+  const float* r0 = in + 2 * ph * s.width;
+  const float* r1 = r0 + s.width;
+  const __m128 pool_size = _mm_set1_ps(4);
+  int pw = 0;
+  for (; pw + 4 <= count; pw += 4) {
+    const __m128 a = _mm_loadu_ps(r0 + 2 * pw);
+    const __m128 b = _mm_loadu_ps(r0 + 2 * pw + 4);
+    const __m128 c = _mm_loadu_ps(r1 + 2 * pw);
+    const __m128 d = _mm_loadu_ps(r1 + 2 * pw + 4);
+    __m128 sum = _mm_add_ps(_mm_setzero_ps(),
+                            _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(c, d, _MM_SHUFFLE(3, 1, 3, 1)));
+    _mm_storeu_ps(out + pw, _mm_div_ps(sum, pool_size));
+  }
+  return pw;
+}
+
+#endif  // CAFFE_X86_SIMD
+
+// Pools the leading windows [0, count) of output row ph for FixedKernel() k,
+// vectorized where possible.
+template <typename Dtype>
+void MaxPoolRow(const PoolingShape& s, const int k, const Dtype* in,
+    const int ph, const int count, Dtype* out, int* mask) {
+  if (k == 2) {
+    MaxPoolRowFixed<Dtype, 2>(s, in, ph, 0, count, out, mask);
+  } else {
+    MaxPoolRowFixed<Dtype, 3>(s, in, ph, 0, count, out, mask);
+  }
+}
+
+template <>
+void MaxPoolRow(const PoolingShape& s, const int k, const float* in,
+    const int ph, const int count, float* out, int* mask) {
+  if (k == 2) {
+    int pw = 0;
+#ifdef CAFFE_X86_SIMD
+    if (CpuSimdLevel() >= SIMD_SSE2) {
+      pw = MaxPoolRow2x2Sse2(s, in, ph, count, out, mask);
+    }
+#endif
+    MaxPoolRowFixed<float, 2>(s, in, ph, pw, count, out, mask);
+  } else {
+    MaxPoolRowFixed<float, 3>(s, in, ph, 0, count, out, mask);
+  }
+}
+
+template <typename Dtype>
+void AvePoolRow(const PoolingShape& s, const int k, const Dtype* in,
+    const int ph, const int count, Dtype* out) {
+  if (k == 2) {
+    AvePoolRowFixed<Dtype, 2>(s, in, ph, 0, count, out);
+  } else {
+    AvePoolRowFixed<Dtype, 3>(s, in, ph, 0, count, out);
+  }
+}
+
+template <>
+void AvePoolRow(const PoolingShape& s, const int k, const float* in,
+    const int ph, const int count, float* out) {
+  if (k == 2) {
+    int pw = 0;
+#ifdef CAFFE_X86_SIMD
+    if (CpuSimdLevel() >= SIMD_SSE2) {
+      pw = AvePoolRow2x2Sse2(s, in, ph, count, out);
+    }
+#endif
+    AvePoolRowFixed<float, 2>(s, in, ph, pw, count, out);
+  } else {
+    AvePoolRowFixed<float, 3>(s, in, ph, 0, count, out);
+  }
+}
+
+// The per plane passes below handle plane p of the bottom and top blobs.
+// If top_mask is given, it receives the maximum's index within the plane,
+// as the GPU implementation outputs it.
+template <typename Dtype>
+void MaxPoolPlane(const PoolingShape& s, const Dtype* bottom, Dtype* top,
+    int* mask, Dtype* top_mask, const int p) {
+  const int pooled_size = s.pooled_height * s.pooled_width;
+  const Dtype* in = bottom + p * s.height * s.width;
+  Dtype* out = top + p * pooled_size;
+  mask += p * pooled_size;
+  const int k = s.FixedKernel();
+  const int fixed_count = k ? s.FixedCount(k) : 0;
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    Dtype* out_row = out + ph * s.pooled_width;
+    int* mask_row = mask + ph * s.pooled_width;
+    int pw = 0;
+    if (k && s.FixedRow(k, ph)) {
+      MaxPoolRow(s, k, in, ph, fixed_count, out_row, mask_row);
+      pw = fixed_count;
+    }
+    for (; pw < s.pooled_width; ++pw) {
+      MaxPoolWindow(s, in, ph, pw, out_row + pw, mask_row + pw);
+    }
+  }
+  if (top_mask) {
+    top_mask += p * pooled_size;
+    for (int ph = 0; ph < s.pooled_height; ++ph) {
+      for (int pw = 0; pw < s.pooled_width; ++pw) {
+        const int i = ph * s.pooled_width + pw;
+        const int h = ph * s.stride_h - s.pad_h + mask[i] / s.kernel_w;
+        const int w = pw * s.stride_w - s.pad_w + mask[i] % s.kernel_w;
+        top_mask[i] = (mask[i] < 0) ? Dtype(-1) :
+            static_cast<Dtype>(h * s.width + w);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void AvePoolPlane(const PoolingShape& s, const Dtype* bottom, Dtype* top,
+    const int p) {
+  const Dtype* in = bottom + p * s.height * s.width;
+  Dtype* out = top + p * s.pooled_height * s.pooled_width;
+  const int k = s.FixedKernel();
+  const int fixed_count = k ? s.FixedCount(k) : 0;
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    Dtype* out_row = out + ph * s.pooled_width;
+    int pw = 0;
+    if (k && s.FixedRow(k, ph)) {
+      AvePoolRow(s, k, in, ph, fixed_count, out_row);
+      pw = fixed_count;
+    }
+    for (; pw < s.pooled_width; ++pw) {
+      AvePoolWindow(s, in, ph, pw, out_row + pw);
+    }
+  }
+}
+
+template <typename Dtype>
+void MaxUnpoolPlane(const PoolingShape& s, const Dtype* top_diff,
+    const int* mask, Dtype* bottom_diff, const int p) {
+  const int pooled_size = s.pooled_height * s.pooled_width;
+  top_diff += p * pooled_size;
+  mask += p * pooled_size;
+  Dtype* diff = bottom_diff + p * s.height * s.width;
+  caffe_set(s.height * s.width, Dtype(0), diff);
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    for (int pw = 0; pw < s.pooled_width; ++pw) {
+      const int i = ph * s.pooled_width + pw;
+      if (mask[i] < 0) {
+        continue;
+      }
+      const int h = ph * s.stride_h - s.pad_h + mask[i] / s.kernel_w;
+      const int w = pw * s.stride_w - s.pad_w + mask[i] % s.kernel_w;
+      diff[h * s.width + w] += top_diff[i];
+    }
+  }
+}
+
+template <typename Dtype>
+void AveUnpoolPlane(const PoolingShape& s, const Dtype* top_diff,
+    Dtype* bottom_diff, const int p) {
+  top_diff += p * s.pooled_height * s.pooled_width;
+  Dtype* diff = bottom_diff + p * s.height * s.width;
+  caffe_set(s.height * s.width, Dtype(0), diff);
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    for (int pw = 0; pw < s.pooled_width; ++pw) {
+      int hstart = ph * s.stride_h - s.pad_h;
+      int wstart = pw * s.stride_w - s.pad_w;
+      int hend = min(hstart + s.kernel_h, s.height + s.pad_h);
+      int wend = min(wstart + s.kernel_w, s.width + s.pad_w);
+      const int pool_size = (hend - hstart) * (wend - wstart);
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      hend = min(hend, s.height);
+      wend = min(wend, s.width);
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          diff[h * s.width + w] +=
+              top_diff[ph * s.pooled_width + pw] / pool_size;
+        }
+      }
+    }
+  }
+}
+
+// Runs plane_fn for every (n, c) plane, spread over Caffe::cpu_thread_pool()
+// if the blob is large enough to be worth it. Planes are independent.
+void RunPlanes(const int planes, const int count,
+    const boost::function<void(int)>& plane_fn) {
+  if (planes > 1 && count >= kMinParallelPoolCount) {
+    Caffe::cpu_thread_pool()->Run(planes, plane_fn);
+  } else {
+    for (int p = 0; p < planes; ++p) {
+      plane_fn(p);
+    }
+  }
+}
+
+}  // namespace
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -89,9 +468,10 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   if (top->size() > 1) {
     (*top)[1]->ReshapeLike(*(*top)[0]);
   }
-  // If max pooling, we will initialize the vector index part.
+  // If max pooling, we will initialize the vector index part. The CPU
+  // implementation uses it even when the mask is also output to top[1].
   if (this->layer_param_.pooling_param().pool() ==
-      PoolingParameter_PoolMethod_MAX && top->size() == 1) {
+      PoolingParameter_PoolMethod_MAX) {
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
   }
@@ -103,101 +483,34 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  const int top_count = (*top)[0]->count();
+  const PoolingShape shape = { height_, width_, pooled_height_,
+      pooled_width_, kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_,
+      pad_w_ };
+  const int planes = bottom[0]->num() * channels_;
   // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top->size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more code.
+  // Different pooling methods. Each (n, c) plane is pooled independently,
+  // with specialized kernels for the common 2x2 and 3x3 windows of stride 2.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
-    if (use_top_mask) {
+    if (top->size() > 1) {
       top_mask = (*top)[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
-    }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += (*top)[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += (*top)[0]->offset(0, 1);
-        } else {
-          mask += (*top)[0]->offset(0, 1);
-        }
-      }
     }
+    // The CPU mask holds window offsets rather than the indices that the
+    // GPU implementation stores.
+    RunPlanes(planes, bottom[0]->count(), boost::bind(
+        &MaxPoolPlane<Dtype>, boost::cref(shape), bottom_data, top_data,
+        max_idx_.mutable_cpu_data(), top_mask, _1));
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += (*top)[0]->offset(0, 1);
-      }
-    }
+    RunPlanes(planes, bottom[0]->count(), boost::bind(
+        &AvePoolPlane<Dtype>, boost::cref(shape), bottom_data, top_data,
+        _1));
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -215,69 +528,22 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set((*bottom)[0]->count(), Dtype(0), bottom_diff);
-  // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
-  const int* mask = NULL;  // suppress warnings about uninitialized variables
-  const Dtype* top_mask = NULL;
+  const PoolingShape shape = { height_, width_, pooled_height_,
+      pooled_width_, kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_,
+      pad_w_ };
+  const int planes = top[0]->num() * channels_;
+  // Different pooling methods. Each plane of bottom_diff is zeroed and
+  // accumulated by the task that owns it.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
-    if (use_top_mask) {
-      top_mask = top[1]->cpu_data();
-    } else {
-      mask = max_idx_.cpu_data();
-    }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += (*bottom)[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
-    }
+    RunPlanes(planes, (*bottom)[0]->count(), boost::bind(
+        &MaxUnpoolPlane<Dtype>, boost::cref(shape), top_diff,
+        max_idx_.cpu_data(), bottom_diff, _1));
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
-            }
-          }
-        }
-        // offset
-        bottom_diff += (*bottom)[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-      }
-    }
+    RunPlanes(planes, (*bottom)[0]->count(), boost::bind(
+        &AveUnpoolPlane<Dtype>, boost::cref(shape), top_diff, bottom_diff,
+        _1));
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
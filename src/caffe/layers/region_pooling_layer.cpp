@@ -0,0 +1,177 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+using std::min;
+using std::max;
+
+namespace {
+
+// Below this many top elements, regions are pooled on the calling thread.
+const int kMinParallelRegionCount = 1 << 12;
+
+}  // namespace
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const RegionPoolingParameter& region_param =
+      this->layer_param_.region_pooling_param();
+  CHECK_GT(region_param.pyramid_level_size(), 0)
+      << "Region pooling needs at least one pyramid_level.";
+  pyramid_levels_.clear();
+  bins_ = 0;
+  for (int l = 0; l < region_param.pyramid_level_size(); ++l) {
+    const int level = region_param.pyramid_level(l);
+    CHECK_GT(level, 0) << "Pyramid levels cannot be zero.";
+    pyramid_levels_.push_back(level);
+    bins_ += level * level;
+  }
+  spatial_scale_ = region_param.spatial_scale();
+  CHECK_GT(spatial_scale_, 0) << "spatial_scale must be positive.";
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  num_ = bottom[0]->num();
+  channels_ = bottom[0]->channels();
+  height_ = bottom[0]->height();
+  width_ = bottom[0]->width();
+  CHECK_EQ(bottom[1]->count() / bottom[1]->num(), 5)
+      << "Regions are given as (n, x1, y1, x2, y2) rows.";
+  if (pyramid_levels_.size() == 1) {
+    (*top)[0]->Reshape(bottom[1]->num(), channels_, pyramid_levels_[0],
+        pyramid_levels_[0]);
+  } else {
+    (*top)[0]->Reshape(bottom[1]->num(), channels_ * bins_, 1, 1);
+  }
+  max_idx_.Reshape((*top)[0]->num(), (*top)[0]->channels(),
+      (*top)[0]->height(), (*top)[0]->width());
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::ForwardRegion(const Dtype* bottom_data,
+    const Dtype* regions, Dtype* top_data, int* max_idx, const int r) {
+  const Dtype* region = regions + r * 5;
+  const int n = static_cast<int>(region[0]);
+  CHECK(n >= 0 && n < num_) << "Region " << r << " is of a missing image.";
+  const int region_start_w = round(region[1] * spatial_scale_);
+  const int region_start_h = round(region[2] * spatial_scale_);
+  const int region_end_w = round(region[3] * spatial_scale_);
+  const int region_end_h = round(region[4] * spatial_scale_);
+  // Regions smaller than a feature are stretched to one.
+  const int region_height = max(region_end_h - region_start_h + 1, 1);
+  const int region_width = max(region_end_w - region_start_w + 1, 1);
+  top_data += r * channels_ * bins_;
+  max_idx += r * channels_ * bins_;
+  int level_offset = 0;
+  for (int l = 0; l < pyramid_levels_.size(); ++l) {
+    const int level = pyramid_levels_[l];
+    const Dtype bin_h = static_cast<Dtype>(region_height) / level;
+    const Dtype bin_w = static_cast<Dtype>(region_width) / level;
+    for (int c = 0; c < channels_; ++c) {
+      const Dtype* plane =
+          bottom_data + (n * channels_ + c) * height_ * width_;
+      const int offset = channels_ * level_offset + c * level * level;
+      Dtype* level_top = top_data + offset;
+      int* level_idx = max_idx + offset;
+      for (int ph = 0; ph < level; ++ph) {
+        int hstart = floor(ph * bin_h) + region_start_h;
+        int hend = ceil((ph + 1) * bin_h) + region_start_h;
+        hstart = min(max(hstart, 0), height_);
+        hend = min(max(hend, 0), height_);
+        for (int pw = 0; pw < level; ++pw) {
+          int wstart = floor(pw * bin_w) + region_start_w;
+          int wend = ceil((pw + 1) * bin_w) + region_start_w;
+          wstart = min(max(wstart, 0), width_);
+          wend = min(max(wend, 0), width_);
+          // A bin outside the feature map pools to zero.
+          Dtype maxval = (hend > hstart && wend > wstart) ? -FLT_MAX : 0;
+          int maxidx = -1;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              if (plane[h * width_ + w] > maxval) {
+                maxval = plane[h * width_ + w];
+                maxidx = h * width_ + w;
+              }
+            }
+          }
+          level_top[ph * level + pw] = maxval;
+          level_idx[ph * level + pw] = maxidx;
+        }
+      }
+    }
+    level_offset += level * level;
+  }
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const int num_regions = bottom[1]->num();
+  const boost::function<void(int)> region_fn = boost::bind(
+      &RegionPoolingLayer<Dtype>::ForwardRegion, this,
+      bottom[0]->cpu_data(), bottom[1]->cpu_data(),
+      (*top)[0]->mutable_cpu_data(), max_idx_.mutable_cpu_data(), _1);
+  // Regions write disjoint parts of the top.
+  if (num_regions > 1 && (*top)[0]->count() >= kMinParallelRegionCount) {
+    Caffe::cpu_thread_pool()->Run(num_regions, region_fn);
+  } else {
+    for (int r = 0; r < num_regions; ++r) {
+      region_fn(r);
+    }
+  }
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  CHECK(!propagate_down[1]) << "Cannot backpropagate to region coordinates.";
+  if (!propagate_down[0]) {
+    return;
+  }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* regions = (*bottom)[1]->cpu_data();
+  const int* max_idx = max_idx_.cpu_data();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  caffe_set((*bottom)[0]->count(), Dtype(0), bottom_diff);
+  // Overlapping regions add to the same features, so each bin's gradient is
+  // routed to its maximum one region after another.
+  for (int r = 0; r < top[0]->num(); ++r) {
+    const int n = static_cast<int>(regions[r * 5]);
+    for (int l = 0, level_offset = 0; l < pyramid_levels_.size(); ++l) {
+      const int bins = pyramid_levels_[l] * pyramid_levels_[l];
+      for (int c = 0; c < channels_; ++c) {
+        Dtype* plane = bottom_diff + (n * channels_ + c) * height_ * width_;
+        const int offset =
+            (r * bins_ + level_offset) * channels_ + c * bins;
+        for (int b = 0; b < bins; ++b) {
+          if (max_idx[offset + b] >= 0) {
+            plane[max_idx[offset + b]] += top_diff[offset + b];
+          }
+        }
+      }
+      level_offset += bins;
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(RegionPoolingLayer);
+#endif
+
+INSTANTIATE_CLASS(RegionPoolingLayer);
+
+}  // namespace caffe
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Pools the level x level bins of one pyramid level; the bins of the level
+// start at level_offset bins into each region's channel-major block.
+template <typename Dtype>
+__global__ void RegionPoolForward(const int nthreads, const Dtype* bottom_data,
+    const Dtype* regions, const Dtype spatial_scale, const int channels,
+    const int height, const int width, const int level, const int bins,
+    const int level_offset, Dtype* top_data, int* max_idx) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int pw = index % level;
+    int ph = (index / level) % level;
+    int c = (index / level / level) % channels;
+    int r = index / level / level / channels;
+    const Dtype* region = regions + r * 5;
+    int n = region[0];
+    int region_start_w = round(region[1] * spatial_scale);
+    int region_start_h = round(region[2] * spatial_scale);
+    int region_end_w = round(region[3] * spatial_scale);
+    int region_end_h = round(region[4] * spatial_scale);
+    int region_height = max(region_end_h - region_start_h + 1, 1);
+    int region_width = max(region_end_w - region_start_w + 1, 1);
+    Dtype bin_h = static_cast<Dtype>(region_height) / level;
+    Dtype bin_w = static_cast<Dtype>(region_width) / level;
+    int hstart = floor(ph * bin_h) + region_start_h;
+    int hend = ceil((ph + 1) * bin_h) + region_start_h;
+    int wstart = floor(pw * bin_w) + region_start_w;
+    int wend = ceil((pw + 1) * bin_w) + region_start_w;
+    hstart = min(max(hstart, 0), height);
+    hend = min(max(hend, 0), height);
+    wstart = min(max(wstart, 0), width);
+    wend = min(max(wend, 0), width);
+    Dtype maxval = (hend > hstart && wend > wstart) ? -FLT_MAX : 0;
+    int maxidx = -1;
+    bottom_data += (n * channels + c) * height * width;
+    for (int h = hstart; h < hend; ++h) {
+      for (int w = wstart; w < wend; ++w) {
+        if (bottom_data[h * width + w] > maxval) {
+          maxidx = h * width + w;
+          maxval = bottom_data[maxidx];
+        }
+      }
+    }
+    int top_index = (r * bins + level_offset) * channels +
+        (c * level + ph) * level + pw;
+    top_data[top_index] = maxval;
+    max_idx[top_index] = maxidx;
+  }
+}
+
+// Gathers the gradient of every bottom feature from the bins of all regions
+// that picked it, which avoids atomic adds for overlapping regions.
+template <typename Dtype>
+__global__ void RegionPoolBackward(const int nthreads, const Dtype* top_diff,
+    const int* max_idx, const Dtype* regions, const int num_regions,
+    const Dtype spatial_scale, const int channels, const int height,
+    const int width, const int* levels, const int num_levels, const int bins,
+    Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int w = index % width;
+    int h = (index / width) % height;
+    int c = (index / width / height) % channels;
+    int n = index / width / height / channels;
+    Dtype gradient = 0;
+    for (int r = 0; r < num_regions; ++r) {
+      const Dtype* region = regions + r * 5;
+      if (static_cast<int>(region[0]) != n) {
+        continue;
+      }
+      int region_start_w = round(region[1] * spatial_scale);
+      int region_start_h = round(region[2] * spatial_scale);
+      int region_end_w = round(region[3] * spatial_scale);
+      int region_end_h = round(region[4] * spatial_scale);
+      int region_height = max(region_end_h - region_start_h + 1, 1);
+      int region_width = max(region_end_w - region_start_w + 1, 1);
+      int level_offset = 0;
+      for (int l = 0; l < num_levels; ++l) {
+        int level = levels[l];
+        Dtype bin_h = static_cast<Dtype>(region_height) / level;
+        Dtype bin_w = static_cast<Dtype>(region_width) / level;
+        // Only the bins whose span covers (h, w) can have picked it.
+        int phstart = floor(static_cast<Dtype>(h - region_start_h) / bin_h);
+        int phend = ceil(static_cast<Dtype>(h - region_start_h + 1) / bin_h);
+        int pwstart = floor(static_cast<Dtype>(w - region_start_w) / bin_w);
+        int pwend = ceil(static_cast<Dtype>(w - region_start_w + 1) / bin_w);
+        phstart = min(max(phstart - 1, 0), level);
+        phend = min(max(phend + 1, 0), level);
+        pwstart = min(max(pwstart - 1, 0), level);
+        pwend = min(max(pwend + 1, 0), level);
+        int offset = (r * bins + level_offset) * channels + c * level * level;
+        for (int ph = phstart; ph < phend; ++ph) {
+          for (int pw = pwstart; pw < pwend; ++pw) {
+            if (max_idx[offset + ph * level + pw] == h * width + w) {
+              gradient += top_diff[offset + ph * level + pw];
+            }
+          }
+        }
+        level_offset += level * level;
+      }
+    }
+    bottom_diff[index] = gradient;
+  }
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  const Dtype* regions = bottom[1]->gpu_data();
+  Dtype* top_data = (*top)[0]->mutable_gpu_data();
+  int* max_idx = max_idx_.mutable_gpu_data();
+  int level_offset = 0;
+  for (int l = 0; l < pyramid_levels_.size(); ++l) {
+    const int level = pyramid_levels_[l];
+    const int count = bottom[1]->num() * channels_ * level * level;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    RegionPoolForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+                               CAFFE_CUDA_NUM_THREADS>>>(
+        count, bottom_data, regions, spatial_scale_, channels_, height_,
+        width_, level, bins_, level_offset, top_data, max_idx);
+    CUDA_POST_KERNEL_CHECK;
+    level_offset += level * level;
+  }
+}
+
+template <typename Dtype>
+void RegionPoolingLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  CHECK(!propagate_down[1]) << "Cannot backpropagate to region coordinates.";
+  if (!propagate_down[0]) {
+    return;
+  }
+  // The levels are few, so they are copied over at every Backward.
+  Blob<int> levels(1, 1, 1, pyramid_levels_.size());
+  std::copy(pyramid_levels_.begin(), pyramid_levels_.end(),
+            levels.mutable_cpu_data());
+  const int count = (*bottom)[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  RegionPoolBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+                              CAFFE_CUDA_NUM_THREADS>>>(
+      count, top[0]->gpu_diff(), max_idx_.gpu_data(), (*bottom)[1]->gpu_data(),
+      top[0]->num(), spatial_scale_, channels_, height_, width_,
+      levels.gpu_data(), pyramid_levels_.size(), bins_,
+      (*bottom)[0]->mutable_gpu_diff());
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_CLASS(RegionPoolingLayer);
+
+}  // namespace caffe
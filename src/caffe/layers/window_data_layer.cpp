@@ -1,6 +1,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -23,9 +24,75 @@
 
 namespace caffe {
 
+// A least recently used cache of decoded images, keyed by their index in
+// the WindowFile and bounded by the bytes of their pixels. Each image keeps
+// the scale it was decoded at, see ReadImageToCVMatReduced.
+class WindowImageCache {
+ public:
+  explicit WindowImageCache(const size_t capacity)
+      : capacity_(capacity), size_(0) {}
+
+  // Returns the image cached for index and marks it most recently used, or
+  // returns NULL.
+  const cv::Mat* Get(const int index, int* scale) {
+    map<int, EntryList::iterator>::iterator it = lookup_.find(index);
+    if (it == lookup_.end()) {
+      return NULL;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *scale = it->second->scale;
+    return &it->second->image;
+  }
+
+  // Caches image for index in place of any older one, evicting the least
+  // recently used images until it fits. Images larger than the whole cache
+  // are not kept.
+  void Put(const int index, const cv::Mat& image, const int scale) {
+    Remove(index);
+    const size_t bytes = image.total() * image.elemSize();
+    if (bytes > capacity_) {
+      return;
+    }
+    while (size_ + bytes > capacity_) {
+      Remove(entries_.back().index);
+    }
+    Entry entry = { index, scale, image };
+    entries_.push_front(entry);
+    lookup_[index] = entries_.begin();
+    size_ += bytes;
+  }
+
+ private:
+  struct Entry {
+    int index;
+    int scale;
+    cv::Mat image;
+  };
+  typedef std::list<Entry> EntryList;
+
+  void Remove(const int index) {
+    map<int, EntryList::iterator>::iterator it = lookup_.find(index);
+    if (it == lookup_.end()) {
+      return;
+    }
+    size_ -= it->second->image.total() * it->second->image.elemSize();
+    entries_.erase(it->second);
+    lookup_.erase(it);
+  }
+
+  const size_t capacity_;
+  size_t size_;
+  EntryList entries_;  // Most recently used first.
+  map<int, EntryList::iterator> lookup_;
+};
+
 template <typename Dtype>
 WindowDataLayer<Dtype>::~WindowDataLayer<Dtype>() {
   this->JoinPrefetchThread();
+  if (image_cache_) {
+    LOG(INFO) << "Window image cache: " << cache_hits_ << " hits, "
+              << cache_misses_ << " misses";
+  }
 }
 
 template <typename Dtype>
@@ -36,7 +103,8 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // for background (non-object) windows. We use an overlap threshold
   // to decide which is which.
 
-  // window_file format
+  // window_file format, or the equivalent binary format written by the
+  // convert_window_file tool (see WindowFile)
   // repeated:
   //    # image_index
   //    img_path (abs path)
@@ -64,83 +132,19 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     prefetch_rng_.reset();
   }
 
-  std::ifstream infile(this->layer_param_.window_data_param().source().c_str());
-  CHECK(infile.good()) << "Failed to open window file "
-      << this->layer_param_.window_data_param().source() << std::endl;
+  windows_.Open(this->layer_param_.window_data_param().source());
+  // Windows come sorted by overlap, so foreground windows are the first ones
+  // and background windows the last.
+  num_fg_windows_ = windows_.CountOverlapAtLeast(
+      this->layer_param_.window_data_param().fg_threshold());
+  bg_windows_begin_ = std::max(num_fg_windows_, windows_.CountOverlapAtLeast(
+      this->layer_param_.window_data_param().bg_threshold()));
+  const int channels = windows_.image_channels(0);
 
-  map<int, int> label_hist;
-  label_hist.insert(std::make_pair(0, 0));
-
-  string hashtag;
-  int image_index, channels;
-  if (!(infile >> hashtag >> image_index)) {
-    LOG(FATAL) << "Window file is empty";
-  }
-  do {
-    CHECK_EQ(hashtag, "#");
-    // read image path
-    string image_path;
-    infile >> image_path;
-    // read image dimensions
-    vector<int> image_size(3);
-    infile >> image_size[0] >> image_size[1] >> image_size[2];
-    channels = image_size[0];
-    image_database_.push_back(std::make_pair(image_path, image_size));
-
-    // read each box
-    int num_windows;
-    infile >> num_windows;
-    const float fg_threshold =
-        this->layer_param_.window_data_param().fg_threshold();
-    const float bg_threshold =
-        this->layer_param_.window_data_param().bg_threshold();
-    for (int i = 0; i < num_windows; ++i) {
-      int label, x1, y1, x2, y2;
-      float overlap;
-      infile >> label >> overlap >> x1 >> y1 >> x2 >> y2;
-
-      vector<float> window(WindowDataLayer::NUM);
-      window[WindowDataLayer::IMAGE_INDEX] = image_index;
-      window[WindowDataLayer::LABEL] = label;
-      window[WindowDataLayer::OVERLAP] = overlap;
-      window[WindowDataLayer::X1] = x1;
-      window[WindowDataLayer::Y1] = y1;
-      window[WindowDataLayer::X2] = x2;
-      window[WindowDataLayer::Y2] = y2;
-
-      // add window to foreground list or background list
-      if (overlap >= fg_threshold) {
-        int label = window[WindowDataLayer::LABEL];
-        CHECK_GT(label, 0);
-        fg_windows_.push_back(window);
-        label_hist.insert(std::make_pair(label, 0));
-        label_hist[label]++;
-      } else if (overlap < bg_threshold) {
-        // background window, force label and overlap to 0
-        window[WindowDataLayer::LABEL] = 0;
-        window[WindowDataLayer::OVERLAP] = 0;
-        bg_windows_.push_back(window);
-        label_hist[0]++;
-      }
-    }
-
-    if (image_index % 100 == 0) {
-      LOG(INFO) << "num: " << image_index << " "
-          << image_path << " "
-          << image_size[0] << " "
-          << image_size[1] << " "
-          << image_size[2] << " "
-          << "windows to process: " << num_windows;
-    }
-  } while (infile >> hashtag >> image_index);
-
-  LOG(INFO) << "Number of images: " << image_index+1;
-
-  for (map<int, int>::iterator it = label_hist.begin();
-      it != label_hist.end(); ++it) {
-    LOG(INFO) << "class " << it->first << " has " << label_hist[it->first]
-              << " samples";
-  }
+  LOG(INFO) << "Number of images: " << windows_.num_images();
+  LOG(INFO) << "Number of foreground windows: " << num_fg_windows_;
+  LOG(INFO) << "Number of background windows: "
+      << windows_.num_windows() - bg_windows_begin_;
 
   LOG(INFO) << "Amount of context padding: "
       << this->layer_param_.window_data_param().context_pad();
@@ -148,12 +152,18 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   LOG(INFO) << "Crop mode: "
       << this->layer_param_.window_data_param().crop_mode();
 
+  const uint64_t cache_bytes =
+      this->layer_param_.window_data_param().cache_bytes();
+  if (cache_bytes > 0) {
+    LOG(INFO) << "Caching up to " << cache_bytes << " bytes of images";
+    image_cache_.reset(new WindowImageCache(cache_bytes));
+  }
+
   // image
   const int crop_size = this->transform_param_.crop_size();
   CHECK_GT(crop_size, 0);
   const int batch_size = this->layer_param_.window_data_param().batch_size();
   (*top)[0]->Reshape(batch_size, channels, crop_size, crop_size);
-  this->prefetch_data_.Reshape(batch_size, channels, crop_size, crop_size);
 
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -166,7 +176,6 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       (*top)[0]->channels() * (*top)[0]->height() * (*top)[0]->width();
   // label
   (*top)[1]->Reshape(batch_size, 1, 1, 1);
-  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
 }
 
 template <typename Dtype>
@@ -179,12 +188,12 @@ unsigned int WindowDataLayer<Dtype>::PrefetchRand() {
 
 // Thread fetching the data
 template <typename Dtype>
-void WindowDataLayer<Dtype>::InternalThreadEntry() {
+void WindowDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
   // At each iteration, sample N windows where N*p are foreground (object)
   // windows and N*(1-p) are background (non-object) windows
 
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
   const Dtype scale = this->layer_param_.window_data_param().scale();
   const int batch_size = this->layer_param_.window_data_param().batch_size();
   const int context_pad = this->layer_param_.window_data_param().context_pad();
@@ -192,17 +201,25 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.window_data_param().fg_fraction();
-  const Dtype* mean = this->data_mean_.cpu_data();
+  const Dtype* mean = this->mean_;
   const int mean_off = (this->data_mean_.width() - crop_size) / 2;
   const int mean_width = this->data_mean_.width();
   const int mean_height = this->data_mean_.height();
+  const int mean_value_size = this->transform_param_.mean_value_size();
+  if (mean_value_size > 0) {
+    CHECK(mean_value_size == 1 || mean_value_size == this->datum_channels_) <<
+        "Specify either 1 mean_value or as many as channels: " <<
+        this->datum_channels_;
+  }
   cv::Size cv_crop_size(crop_size, crop_size);
   const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
 
   bool use_square = (crop_mode == "square") ? true : false;
+  const bool reduced_decode =
+      this->layer_param_.window_data_param().reduced_decode();
 
   // zero out batch
-  caffe_set(this->prefetch_data_.count(), Dtype(0), top_data);
+  caffe_set(batch->data_.count(), Dtype(0), top_data);
 
   const int num_fg = static_cast<int>(static_cast<float>(batch_size)
       * fg_fraction);
@@ -214,9 +231,15 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
       // sample a window
       const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
-          fg_windows_[rand_index % fg_windows_.size()] :
-          bg_windows_[rand_index % bg_windows_.size()];
+      const int window_index = (is_fg) ?
+          rand_index % num_fg_windows_ :
+          bg_windows_begin_ + rand_index %
+              (windows_.num_windows() - bg_windows_begin_);
+      // background windows are labeled 0
+      const int label = (is_fg) ? windows_.window_label(window_index) : 0;
+      if (is_fg) {
+        CHECK_GT(label, 0);
+      }
 
       bool do_mirror = false;
       if (mirror && PrefetchRand() % 2) {
@@ -224,21 +247,68 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
       }
 
       // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      cv::Mat cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-      if (!cv_img.data) {
-        LOG(ERROR) << "Could not open or find file " << image.first;
-        return;
+      const int image_index = windows_.window_image(window_index);
+      const char* image_path = windows_.image_path(image_index);
+      const int image_height = windows_.image_height(image_index);
+      const int image_width = windows_.image_width(image_index);
+
+      int x1 = windows_.window_x1(window_index);
+      int y1 = windows_.window_y1(window_index);
+      int x2 = windows_.window_x2(window_index);
+      int y2 = windows_.window_y2(window_index);
+
+      // Decode as small as the window allows with reduced_decode: it must
+      // still cover at least crop_size x crop_size pixels, and context only
+      // enlarges it.
+      int min_height = 0;
+      int min_width = 0;
+      int max_scale = 1;
+      if (reduced_decode) {
+        const int window_height = y2 - y1 + 1;
+        const int window_width = x2 - x1 + 1;
+        min_height = (crop_size * image_height + window_height - 1) /
+            window_height;
+        min_width = (crop_size * image_width + window_width - 1) /
+            window_width;
+        while (max_scale < 8 && image_height / (max_scale * 2) >= min_height &&
+               image_width / (max_scale * 2) >= min_width) {
+          max_scale *= 2;
+        }
+      }
+      // A cached image serves any window it has enough pixels for.
+      cv::Mat cv_img;
+      int decode_scale = 1;
+      const cv::Mat* cached = image_cache_ ?
+          image_cache_->Get(image_index, &decode_scale) : NULL;
+      if (cached && decode_scale <= max_scale) {
+        cv_img = *cached;
+        ++cache_hits_;
+      } else {
+        if (reduced_decode) {
+          if (!ReadImageToCVMatReduced(image_path, min_height, min_width,
+                                       true, &cv_img, &decode_scale)) {
+            return;
+          }
+        } else {
+          decode_scale = 1;
+          cv_img = cv::imread(image_path, CV_LOAD_IMAGE_COLOR);
+          if (!cv_img.data) {
+            LOG(ERROR) << "Could not open or find file " << image_path;
+            return;
+          }
+        }
+        if (image_cache_) {
+          image_cache_->Put(image_index, cv_img, decode_scale);
+          ++cache_misses_;
+        }
       }
+      x1 /= decode_scale;
+      y1 /= decode_scale;
+      x2 /= decode_scale;
+      y2 /= decode_scale;
       const int channels = cv_img.channels();
 
       // crop window out of image and warp it
-      int x1 = window[WindowDataLayer<Dtype>::X1];
-      int y1 = window[WindowDataLayer<Dtype>::Y1];
-      int x2 = window[WindowDataLayer<Dtype>::X2];
-      int y2 = window[WindowDataLayer<Dtype>::Y2];
 
       int pad_w = 0;
       int pad_h = 0;
@@ -324,8 +394,10 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
       }
 
       cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
+      // Resize into a buffer of its own: cv_img may be cached, and flipping
+      // must not write to it.
+      cv::Mat cv_cropped_img;
+      cv::resize(cv_img(roi), cv_cropped_img,
           cv_crop_size, 0, 0, cv::INTER_LINEAR);
 
       // horizontal flip at random
@@ -335,6 +407,9 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
 
       // copy the warped window into top_data
       for (int c = 0; c < channels; ++c) {
+        const Dtype channel_mean = mean_value_size ?
+            this->transform_param_.mean_value(mean_value_size == 1 ? 0 : c) :
+            0;
         for (int h = 0; h < cv_cropped_img.rows; ++h) {
           for (int w = 0; w < cv_cropped_img.cols; ++w) {
             Dtype pixel =
@@ -342,16 +417,16 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
 
             top_data[((item_id * channels + c) * crop_size + h + pad_h)
                      * crop_size + w + pad_w]
-                = (pixel
-                    - mean[(c * mean_height + h + mean_off + pad_h)
-                           * mean_width + w + mean_off + pad_w])
+                = (pixel - (mean_value_size ? channel_mean :
+                    mean[(c * mean_height + h + mean_off + pad_h)
+                         * mean_width + w + mean_off + pad_w]))
                   * scale;
           }
         }
       }
 
       // get window label
-      top_label[item_id] = window[WindowDataLayer<Dtype>::LABEL];
+      top_label[item_id] = label;
 
       #if 0
       // useful debugging code for dumping transformed windows to disk
@@ -361,11 +436,11 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
       ss >> file_id;
       std::ofstream inf((string("dump/") + file_id +
           string("_info.txt")).c_str(), std::ofstream::out);
-      inf << image.first << std::endl
-          << window[WindowDataLayer<Dtype>::X1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::X2]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y2]+1 << std::endl
+      inf << image_path << std::endl
+          << windows_.window_x1(window_index)+1 << std::endl
+          << windows_.window_y1(window_index)+1 << std::endl
+          << windows_.window_x2(window_index)+1 << std::endl
+          << windows_.window_y2(window_index)+1 << std::endl
           << do_mirror << std::endl
           << top_label[item_id] << std::endl
           << is_fg << std::endl;
@@ -0,0 +1,183 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The transforms of F(2x2, 3x3) from Lavin and Gray, "Fast Algorithms for
+// Convolutional Neural Networks": a 3x3 filter g becomes G g G^T, a 4x4 input
+// tile d becomes B^T d B, and the 4x4 elementwise product m of the two
+// becomes the 2x2 output tile A^T m A. Transformed values are stride apart,
+// so that each of the 16 elements forms its own matrix for the GEMMs.
+
+template <typename Dtype>
+void TransformFilter(const Dtype* g, const int stride, Dtype* u) {
+  Dtype t[4][3];
+  for (int j = 0; j < 3; ++j) {
+    t[0][j] = g[j];
+    t[1][j] = (g[j] + g[3 + j] + g[6 + j]) / 2;
+    t[2][j] = (g[j] - g[3 + j] + g[6 + j]) / 2;
+    t[3][j] = g[6 + j];
+  }
+  for (int i = 0; i < 4; ++i) {
+    u[(i * 4) * stride] = t[i][0];
+    u[(i * 4 + 1) * stride] = (t[i][0] + t[i][1] + t[i][2]) / 2;
+    u[(i * 4 + 2) * stride] = (t[i][0] - t[i][1] + t[i][2]) / 2;
+    u[(i * 4 + 3) * stride] = t[i][2];
+  }
+}
+
+template <typename Dtype>
+void TransformInputTile(const Dtype d[4][4], const int stride, Dtype* v) {
+  Dtype t[4][4];
+  for (int j = 0; j < 4; ++j) {
+    t[0][j] = d[0][j] - d[2][j];
+    t[1][j] = d[1][j] + d[2][j];
+    t[2][j] = d[2][j] - d[1][j];
+    t[3][j] = d[1][j] - d[3][j];
+  }
+  for (int i = 0; i < 4; ++i) {
+    v[(i * 4) * stride] = t[i][0] - t[i][2];
+    v[(i * 4 + 1) * stride] = t[i][1] + t[i][2];
+    v[(i * 4 + 2) * stride] = t[i][2] - t[i][1];
+    v[(i * 4 + 3) * stride] = t[i][1] - t[i][3];
+  }
+}
+
+template <typename Dtype>
+void TransformOutputTile(const Dtype* m, const int stride, Dtype y[2][2]) {
+  Dtype t[2][4];
+  for (int j = 0; j < 4; ++j) {
+    const Dtype m0 = m[j * stride];
+    const Dtype m1 = m[(4 + j) * stride];
+    const Dtype m2 = m[(8 + j) * stride];
+    const Dtype m3 = m[(12 + j) * stride];
+    t[0][j] = m0 + m1 + m2;
+    t[1][j] = m1 - m2 - m3;
+  }
+  for (int i = 0; i < 2; ++i) {
+    y[i][0] = t[i][0] + t[i][1] + t[i][2];
+    y[i][1] = t[i][1] - t[i][2] - t[i][3];
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK(this->kernel_h_ == 3 && this->kernel_w_ == 3)
+      << "The WINOGRAD engine only handles 3x3 kernels.";
+  CHECK(this->stride_h_ == 1 && this->stride_w_ == 1)
+      << "The WINOGRAD engine only handles unit stride.";
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  tiles_h_ = (this->height_out_ + 1) / 2;
+  tiles_w_ = (this->width_out_ + 1) / 2;
+  transformed_weights_.Reshape(16, this->num_output_,
+      this->channels_ / this->group_, 1);
+  transformed_input_.Reshape(16, this->channels_, tiles_h_, tiles_w_);
+  transformed_output_.Reshape(16, this->num_output_, tiles_h_, tiles_w_);
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const int height = this->height_;
+  const int width = this->width_;
+  const int height_out = this->height_out_;
+  const int width_out = this->width_out_;
+  const int tiles = tiles_h_ * tiles_w_;
+  const int group_channels = this->channels_ / this->group_;
+  // Filters change between iterations while training, so they are
+  // transformed on every pass; it is cheap next to the GEMMs.
+  const int filters = this->num_output_ * group_channels;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* u = transformed_weights_.mutable_cpu_data();
+  for (int f = 0; f < filters; ++f) {
+    TransformFilter(weight + f * 9, filters, u + f);
+  }
+  Dtype* v = transformed_input_.mutable_cpu_data();
+  Dtype* m = transformed_output_.mutable_cpu_data();
+  const int input_stride = this->channels_ * tiles;
+  const int output_stride = this->num_output_ * tiles;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      // Transform the input tiles, which overlap by two rows and columns and
+      // read zeros outside the image.
+      for (int c = 0; c < this->channels_; ++c) {
+        const Dtype* im = bottom_data + bottom[i]->offset(n, c);
+        for (int th = 0; th < tiles_h_; ++th) {
+          for (int tw = 0; tw < tiles_w_; ++tw) {
+            const int h_start = th * 2 - this->pad_h_;
+            const int w_start = tw * 2 - this->pad_w_;
+            Dtype d[4][4];
+            for (int y = 0; y < 4; ++y) {
+              const int h = h_start + y;
+              for (int x = 0; x < 4; ++x) {
+                const int w = w_start + x;
+                d[y][x] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                    im[h * width + w] : Dtype(0);
+              }
+            }
+            TransformInputTile(d, input_stride,
+                v + c * tiles + th * tiles_w_ + tw);
+          }
+        }
+      }
+      // Multiply each of the 16 transformed elements over channels.
+      for (int e = 0; e < 16; ++e) {
+        for (int g = 0; g < this->group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, tiles,
+              group_channels, (Dtype)1.,
+              u + e * filters + g * this->M_ * group_channels,
+              v + e * input_stride + g * group_channels * tiles, (Dtype)0.,
+              m + e * output_stride + g * this->M_ * tiles);
+        }
+      }
+      // Transform back, dropping the last row or column of tiles that
+      // overhang an odd sized output.
+      for (int o = 0; o < this->num_output_; ++o) {
+        Dtype* out = top_data + (*top)[i]->offset(n, o);
+        for (int th = 0; th < tiles_h_; ++th) {
+          for (int tw = 0; tw < tiles_w_; ++tw) {
+            Dtype y[2][2];
+            TransformOutputTile(m + o * tiles + th * tiles_w_ + tw,
+                output_stride, y);
+            for (int dy = 0; dy < 2 && th * 2 + dy < height_out; ++dy) {
+              for (int dx = 0; dx < 2 && tw * 2 + dx < width_out; ++dx) {
+                out[(th * 2 + dy) * width_out + tw * 2 + dx] = y[dy][dx];
+              }
+            }
+          }
+        }
+      }
+      // Add bias.
+      if (this->bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+            this->N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            this->bias_multiplier_.cpu_data(),
+            (Dtype)1., top_data + (*top)[i]->offset(n));
+      }
+      if (this->fused_activation_) {
+        this->fused_activation_->Forward_cpu(this->num_output_ * this->N_,
+            top_data + (*top)[i]->offset(n));
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "caffe/common.hpp"
+#include "caffe/fused_activation.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
@@ -18,6 +19,271 @@
 
 namespace caffe {
 
+using google::protobuf::RepeatedPtrField;
+
+namespace {
+
+// Whether a layer after layer_id that is still in the net reads blob.
+bool ConsumedAfter(const RepeatedPtrField<LayerParameter>& layers,
+    const vector<bool>& removed, const int layer_id, const string& blob) {
+  for (int i = layer_id + 1; i < layers.size(); ++i) {
+    for (int j = 0; !removed[i] && j < layers.Get(i).bottom_size(); ++j) {
+      if (layers.Get(i).bottom(j) == blob) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Whether the layer at layer_id can be merged with the single input layer
+// prev_id into one layer that reads the bottoms of prev_id and writes the top
+// of layer_id.
+bool CanMerge(const RepeatedPtrField<LayerParameter>& layers,
+    const vector<bool>& removed, const int prev_id, const int layer_id) {
+  const LayerParameter& prev = layers.Get(prev_id);
+  const LayerParameter& layer = layers.Get(layer_id);
+  if (prev.top_size() != 1 || prev.loss_weight_size() > 0 ||
+      layer.bottom_size() != 1 || layer.top_size() != 1 ||
+      layer.loss_weight_size() > 0 || layer.bottom(0) != prev.top(0)) {
+    return false;
+  }
+  // Unless the layer works in place, any later reader of the top of prev
+  // would get the output of the merged layer instead.
+  return layer.top(0) == layer.bottom(0) ||
+      !ConsumedAfter(layers, removed, layer_id, prev.top(0));
+}
+
+// Makes second compute second(first(x)), where first is linear.
+void ComposeAffine(const PowerParameter& first, PowerParameter* second) {
+  second->set_shift(second->scale() * first.shift() + second->shift());
+  second->set_scale(second->scale() * first.scale());
+}
+
+// Whether the linear Power layer power can be folded into the weights and
+// bias of producer.
+bool CanFoldAffine(const LayerParameter& producer,
+    const LayerParameter& power) {
+  if (power.power_param().power() != 1 || producer.param_size() > 0 ||
+      producer.has_fused_activation()) {
+    return false;
+  }
+  bool bias_term;
+  switch (producer.type()) {
+  case LayerParameter_LayerType_CONVOLUTION:
+    bias_term = producer.convolution_param().bias_term();
+    break;
+  case LayerParameter_LayerType_INNER_PRODUCT:
+    bias_term = producer.inner_product_param().bias_term();
+    break;
+  default:
+    return false;
+  }
+  // Without a bias there is nowhere to add the shift.
+  return bias_term || power.power_param().shift() == 0;
+}
+
+// Scales the weights and bias of a Convolution or InnerProduct layer by
+// affine.scale() and adds affine.shift() to its bias.
+void FoldAffine(const PowerParameter& affine, LayerParameter* layer_param) {
+  if (layer_param->blobs_size() == 0) {
+    return;
+  }
+  BlobProto* weights = layer_param->mutable_blobs(0);
+  for (int i = 0; i < weights->data_size(); ++i) {
+    weights->set_data(i, weights->data(i) * affine.scale());
+  }
+  if (layer_param->blobs_size() > 1) {
+    BlobProto* bias = layer_param->mutable_blobs(1);
+    for (int i = 0; i < bias->data_size(); ++i) {
+      bias->set_data(i, bias->data(i) * affine.scale() + affine.shift());
+    }
+  }
+}
+
+template <typename Dtype>
+void FoldAffine(const PowerParameter& affine,
+    vector<shared_ptr<Blob<Dtype> > >* blobs) {
+  Blob<Dtype>* weights = (*blobs)[0].get();
+  caffe_scal(weights->count(), Dtype(affine.scale()),
+             weights->mutable_cpu_data());
+  if (blobs->size() > 1) {
+    Blob<Dtype>* bias = (*blobs)[1].get();
+    caffe_scal(bias->count(), Dtype(affine.scale()), bias->mutable_cpu_data());
+    caffe_add_scalar(bias->count(), Dtype(affine.shift()),
+                     bias->mutable_cpu_data());
+  }
+}
+
+// Makes the InnerProduct layer layer_param a Convolution whose kernel spans
+// its channels x height x width bottom. That computes the same outputs from
+// the same weights, which are only shaped differently, and slides over larger
+// bottoms to give a map of outputs.
+void ConvolutionizeInnerProduct(const int channels, const int height,
+    const int width, LayerParameter* layer_param) {
+  const InnerProductParameter& inner_product_param =
+      layer_param->inner_product_param();
+  ConvolutionParameter* convolution_param =
+      layer_param->mutable_convolution_param();
+  convolution_param->set_num_output(inner_product_param.num_output());
+  convolution_param->set_bias_term(inner_product_param.bias_term());
+  convolution_param->set_kernel_h(height);
+  convolution_param->set_kernel_w(width);
+  // CuDNNConvolutionLayer cannot apply a fused activation.
+  if (layer_param->has_fused_activation()) {
+    convolution_param->set_engine(ConvolutionParameter_Engine_CAFFE);
+  }
+  if (inner_product_param.has_weight_filler()) {
+    convolution_param->mutable_weight_filler()->CopyFrom(
+        inner_product_param.weight_filler());
+  }
+  if (inner_product_param.has_bias_filler()) {
+    convolution_param->mutable_bias_filler()->CopyFrom(
+        inner_product_param.bias_filler());
+  }
+  if (layer_param->blobs_size() > 0) {
+    BlobProto* weights = layer_param->mutable_blobs(0);
+    CHECK_EQ(weights->data_size(),
+             static_cast<int>(inner_product_param.num_output()) * channels *
+             height * width)
+        << "Weights of " << layer_param->name() << " do not fit its bottom";
+    weights->set_num(inner_product_param.num_output());
+    weights->set_channels(channels);
+    weights->set_height(height);
+    weights->set_width(width);
+  }
+  layer_param->clear_inner_product_param();
+  layer_param->set_type(LayerParameter_LayerType_CONVOLUTION);
+  LOG(INFO) << "Setting up InnerProduct layer " << layer_param->name()
+            << " as a " << height << "x" << width << " Convolution";
+}
+
+// Removes the Dropout layer at layer_id, which passes its bottom through
+// unchanged at test time. One that does not work in place has its bottom
+// renamed to its top in the layers before it, so that the layers after it
+// and the users of the net still find the blob by the same name.
+void RemoveDropout(const int layer_id, NetParameter* param,
+    vector<bool>* removed) {
+  const LayerParameter& dropout = param->layers(layer_id);
+  if (dropout.bottom_size() != 1 || dropout.top_size() != 1 ||
+      dropout.loss_weight_size() > 0) {
+    return;
+  }
+  const string bottom = dropout.bottom(0);
+  const string top = dropout.top(0);
+  if (bottom != top) {
+    for (int i = 0; i < param->input_size(); ++i) {
+      if (param->input(i) == bottom) {
+        return;
+      }
+    }
+    if (ConsumedAfter(param->layers(), *removed, layer_id, bottom)) {
+      return;
+    }
+    for (int i = 0; i < layer_id; ++i) {
+      const LayerParameter& layer_param = param->layers(i);
+      for (int j = 0; j < layer_param.bottom_size(); ++j) {
+        if (layer_param.bottom(j) == top) {
+          return;
+        }
+      }
+      for (int j = 0; j < layer_param.top_size(); ++j) {
+        if (layer_param.top(j) == top) {
+          return;
+        }
+      }
+    }
+    for (int i = 0; i < layer_id; ++i) {
+      LayerParameter* layer_param = param->mutable_layers(i);
+      for (int j = 0; j < layer_param->bottom_size(); ++j) {
+        if (layer_param->bottom(j) == bottom) {
+          layer_param->set_bottom(j, top);
+        }
+      }
+      for (int j = 0; j < layer_param->top_size(); ++j) {
+        if (layer_param->top(j) == bottom) {
+          layer_param->set_top(j, top);
+        }
+      }
+    }
+  }
+  LOG(INFO) << "Removing Dropout layer " << dropout.name();
+  (*removed)[layer_id] = true;
+}
+
+// Merges the Power layer at layer_id into the linear Power layers right
+// before it, and then, if it is linear, folds it into the weights and bias
+// of the Convolution or InnerProduct layer before those.
+void MergePower(const int layer_id, NetParameter* param,
+    vector<bool>* removed) {
+  RepeatedPtrField<LayerParameter>* layers = param->mutable_layers();
+  LayerParameter* power = layers->Mutable(layer_id);
+  for (int prev_id = layer_id - 1; prev_id >= 0; --prev_id) {
+    if ((*removed)[prev_id]) {
+      continue;
+    }
+    if (!CanMerge(*layers, *removed, prev_id, layer_id)) {
+      return;
+    }
+    LayerParameter* prev = layers->Mutable(prev_id);
+    if (prev->type() == LayerParameter_LayerType_POWER &&
+        prev->power_param().power() == 1) {
+      LOG(INFO) << "Merging Power layer " << prev->name() << " into "
+                << power->name();
+      ComposeAffine(prev->power_param(), power->mutable_power_param());
+      power->set_bottom(0, prev->bottom(0));
+      (*removed)[prev_id] = true;
+      continue;
+    }
+    if (CanFoldAffine(*prev, *power)) {
+      LOG(INFO) << "Folding Power layer " << power->name()
+                << " into the weights of " << prev->name();
+      FoldAffine(power->power_param(), prev);
+      PowerParameter folded_affine(power->power_param());
+      ComposeAffine(prev->folded_affine(), &folded_affine);
+      prev->mutable_folded_affine()->CopyFrom(folded_affine);
+      prev->set_top(0, power->top(0));
+      (*removed)[layer_id] = true;
+    }
+    return;
+  }
+}
+
+// Whether the layer after producer can be fused into it: an in-place neuron
+// on the single top of a Convolution or InnerProduct layer whose engine
+// applies fused activations.
+template <typename Dtype>
+bool CanFuseActivation(const LayerParameter& producer,
+    const LayerParameter& neuron) {
+  switch (producer.type()) {
+  case LayerParameter_LayerType_CONVOLUTION: {
+    ConvolutionParameter_Engine engine =
+        producer.convolution_param().engine();
+#ifdef USE_CUDNN
+    if (engine == ConvolutionParameter_Engine_DEFAULT) {
+      engine = ConvolutionParameter_Engine_CUDNN;
+    }
+#endif
+    if (engine == ConvolutionParameter_Engine_CUDNN) {
+      return false;
+    }
+    break;
+  }
+  case LayerParameter_LayerType_INNER_PRODUCT:
+    break;
+  default:
+    return false;
+  }
+  return producer.top_size() == 1 && producer.loss_weight_size() == 0 &&
+      !producer.has_fused_activation() &&
+      neuron.bottom_size() == 1 && neuron.top_size() == 1 &&
+      neuron.bottom(0) == producer.top(0) &&
+      neuron.top(0) == producer.top(0) &&
+      FusedActivation<Dtype>::CanFuse(neuron);
+}
+
+}  // namespace
+
 template <typename Dtype>
 Net<Dtype>::Net(const NetParameter& param) {
   Init(param);
@@ -38,6 +304,22 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   FilterNet(in_param, &filtered_param);
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
+  const bool test_phase = filtered_param.state().has_phase() ?
+      filtered_param.state().phase() == TEST : Caffe::phase() == Caffe::TEST;
+  if (filtered_param.optimize_inference()) {
+    if (test_phase) {
+      NetParameter optimized_param;
+      OptimizeInference(filtered_param, &optimized_param);
+      filtered_param.Swap(&optimized_param);
+    } else {
+      LOG(INFO) << "Not optimizing a net for inference outside the TEST phase";
+    }
+  }
+  if (filtered_param.fuse_activations()) {
+    NetParameter fused_param;
+    FuseActivations(filtered_param, &fused_param);
+    filtered_param.Swap(&fused_param);
+  }
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
@@ -61,6 +343,17 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   top_id_vecs_.resize(param.layers_size());
   bottom_need_backward_.resize(param.layers_size());
   for (int layer_id = 0; layer_id < param.layers_size(); ++layer_id) {
+    if (param.fully_convolutional() &&
+        param.layers(layer_id).type() ==
+        LayerParameter_LayerType_INNER_PRODUCT &&
+        param.layers(layer_id).bottom_size() > 0 &&
+        blob_name_to_idx.count(param.layers(layer_id).bottom(0))) {
+      // The bottom has the shape the input_dim give it by now.
+      const Blob<Dtype>& bottom =
+          *blobs_[blob_name_to_idx[param.layers(layer_id).bottom(0)]];
+      ConvolutionizeInnerProduct(bottom.channels(), bottom.height(),
+          bottom.width(), param.mutable_layers(layer_id));
+    }
     const LayerParameter& layer_param = param.layers(layer_id);
     layers_.push_back(shared_ptr<Layer<Dtype> >(GetLayer<Dtype>(layer_param)));
     layer_names_.push_back(layer_param.name());
@@ -95,6 +388,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     // After this layer is connected, set it up.
     LOG(INFO) << "Setting up " << layer_names_[layer_id];
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], &top_vecs_[layer_id]);
+    if (layer_param.has_folded_affine() && layer_param.blobs_size() == 0) {
+      FoldAffine(layer_param.folded_affine(), &layers_[layer_id]->blobs());
+    }
     for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
       if (blob_loss_weights_.size() <= top_id_vecs_[layer_id][top_id]) {
         blob_loss_weights_.resize(top_id_vecs_[layer_id][top_id] + 1, Dtype(0));
@@ -215,9 +511,53 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  // A fused activation is looked up as the layer it was fused into, which
+  // now computes its top.
+  for (size_t layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerParameter& layer_param = layers_[layer_id]->layer_param();
+    if (layer_param.has_fused_activation()) {
+      layer_names_index_.insert(
+          make_pair(layer_param.fused_activation().name(), layer_id));
+    }
+  }
   GetLearningRateAndWeightDecay();
+  // Inputs are filled in before Forward and outputs read after it, and data
+  // layers may point their tops at memory of their own.
+  blob_memory_pinned_.assign(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    blob_memory_pinned_[net_input_blob_indices_[i]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    blob_memory_pinned_[net_output_blob_indices_[i]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int top_id = 0; bottom_id_vecs_[layer_id].empty() &&
+         top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      blob_memory_pinned_[top_id_vecs_[layer_id][top_id]] = true;
+    }
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(blob_names_index_.count(param.keep_blob(i)))
+        << "Unknown blob " << param.keep_blob(i) << " in keep_blob";
+    blob_memory_pinned_[blob_names_index_[param.keep_blob(i)]] = true;
+  }
+  share_blob_memory_ = param.share_blob_memory() && test_phase;
+  checkpointing_ = param.checkpoint_size() > 0 && !share_blob_memory_;
+  planned_memory_used_ = memory_used_;
+  layer_segment_.assign(layers_.size(), 0);
+  segment_begin_.assign(1, 0);
+  intact_segment_ = 0;
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
+  if (share_blob_memory_) {
+    PlanBlobMemory();
+  } else if (param.share_blob_memory()) {
+    LOG(INFO) << "Not sharing blob memory outside the TEST phase";
+  }
+  if (checkpointing_) {
+    SetUpCheckpoints(param);
+    PlanCheckpointMemory();
+  }
   // Don't display debug info by default.
   debug_info_ = false;
 }
@@ -266,6 +606,58 @@ void Net<Dtype>::FilterNet(const NetParameter& param,
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::OptimizeInference(const NetParameter& param,
+    NetParameter* param_optimized) {
+  param_optimized->CopyFrom(param);
+  vector<bool> removed(param.layers_size(), false);
+  for (int i = 0; i < param.layers_size(); ++i) {
+    switch (param_optimized->layers(i).type()) {
+    case LayerParameter_LayerType_DROPOUT:
+      RemoveDropout(i, param_optimized, &removed);
+      break;
+    case LayerParameter_LayerType_SILENCE:
+      LOG(INFO) << "Removing Silence layer "
+                << param_optimized->layers(i).name();
+      removed[i] = true;
+      break;
+    case LayerParameter_LayerType_POWER:
+      MergePower(i, param_optimized, &removed);
+      break;
+    default:
+      break;
+    }
+  }
+  RepeatedPtrField<LayerParameter> layers;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    if (!removed[i]) {
+      layers.Add()->CopyFrom(param_optimized->layers(i));
+    }
+  }
+  param_optimized->mutable_layers()->Swap(&layers);
+  LOG(INFO) << "Optimized the net for inference from " << param.layers_size()
+            << " to " << param_optimized->layers_size() << " layers";
+}
+
+template <typename Dtype>
+void Net<Dtype>::FuseActivations(const NetParameter& param,
+    NetParameter* param_fused) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layers();
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    LayerParameter* fused_layer_param = param_fused->add_layers();
+    fused_layer_param->CopyFrom(layer_param);
+    if (i + 1 < param.layers_size() &&
+        CanFuseActivation<Dtype>(layer_param, param.layers(i + 1))) {
+      const LayerParameter& neuron_param = param.layers(++i);
+      LOG(INFO) << "Fusing " << neuron_param.name() << " into "
+                << layer_param.name();
+      fused_layer_param->mutable_fused_activation()->CopyFrom(neuron_param);
+    }
+  }
+}
+
 template <typename Dtype>
 bool Net<Dtype>::StateMeetsRule(const NetState& state,
     const NetStateRule& rule, const string& layer_name) {
@@ -508,6 +900,7 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
+    intact_segment_ = layer_segment_[i];
   }
   return loss;
 }
@@ -567,8 +960,13 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!share_blob_memory_)
+      << "Nets that share blob memory cannot run backward.";
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (layer_segment_[i] != intact_segment_) {
+        RecomputeSegment(layer_segment_[i]);
+      }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], &bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
@@ -654,14 +1052,39 @@ void Net<Dtype>::ShareTrainedLayersWith(Net* other) {
         layers_[target_layer_id]->blobs();
     CHECK_EQ(target_blobs.size(), source_layer->blobs().size())
         << "Incompatible number of blobs for layer " << source_layer_name;
+    // Weights folded from the source ones are a copy rather than shared.
+    const LayerParameter& target_param =
+        layers_[target_layer_id]->layer_param();
+    const bool fold = target_param.has_folded_affine() &&
+        !source_layer->layer_param().has_folded_affine();
+    // As in CopyTrainedLayersFrom, a fully convolutional net keeps its
+    // Convolution shape for the InnerProduct weights.
+    const bool convolutionized = source_layer->layer_param().type() ==
+        LayerParameter_LayerType_INNER_PRODUCT &&
+        target_param.type() == LayerParameter_LayerType_CONVOLUTION;
     for (int j = 0; j < target_blobs.size(); ++j) {
       Blob<Dtype>* source_blob = source_layer->blobs()[j].get();
-      CHECK_EQ(target_blobs[j]->num(), source_blob->num());
-      CHECK_EQ(target_blobs[j]->channels(), source_blob->channels());
-      CHECK_EQ(target_blobs[j]->height(), source_blob->height());
-      CHECK_EQ(target_blobs[j]->width(), source_blob->width());
-      target_blobs[j]->ShareData(*source_blob);
+      if (convolutionized) {
+        CHECK_EQ(target_blobs[j]->count(), source_blob->count())
+            << "Incompatible InnerProduct weights for layer "
+            << source_layer_name;
+      } else {
+        CHECK_EQ(target_blobs[j]->num(), source_blob->num());
+        CHECK_EQ(target_blobs[j]->channels(), source_blob->channels());
+        CHECK_EQ(target_blobs[j]->height(), source_blob->height());
+        CHECK_EQ(target_blobs[j]->width(), source_blob->width());
+      }
+      if (fold) {
+        caffe_copy(source_blob->count(), source_blob->cpu_data(),
+                   target_blobs[j]->mutable_cpu_data());
+      } else {
+        target_blobs[j]->ShareData(*source_blob);
+      }
+    }
+    if (fold) {
+      FoldAffine(target_param.folded_affine(), &target_blobs);
     }
+    layers_[target_layer_id]->BlobsChanged();
   }
 }
 
@@ -685,6 +1108,339 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
   }
+  if (share_blob_memory_) {
+    PlanBlobMemory();
+  } else if (checkpointing_) {
+    PlanCheckpointMemory();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareAliasedData() {
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerParameter_LayerType type =
+        layers_[layer_id]->layer_param().type();
+    if (type != LayerParameter_LayerType_SPLIT &&
+        type != LayerParameter_LayerType_FLATTEN) {
+      continue;
+    }
+    for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+      top_vecs_[layer_id][top_id]->ShareData(*bottom_vecs_[layer_id][0]);
+    }
+  }
+}
+
+template <typename Dtype>
+int Net<Dtype>::GroupAliasedBlobs(vector<int>* blob_group,
+    vector<int>* group_owner, vector<size_t>* group_size) {
+  ShareAliasedData();
+  // Group by the layers rather than by the memory the blobs hold, which an
+  // earlier plan may have shared between blobs that a new one keeps apart.
+  vector<int> alias_of(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    alias_of[blob_id] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerParameter_LayerType type =
+        layers_[layer_id]->layer_param().type();
+    if (type != LayerParameter_LayerType_SPLIT &&
+        type != LayerParameter_LayerType_FLATTEN) {
+      continue;
+    }
+    const int bottom_id = bottom_id_vecs_[layer_id][0];
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      alias_of[top_id_vecs_[layer_id][top_id]] = alias_of[bottom_id];
+    }
+  }
+  vector<int> owner_group(blobs_.size(), -1);
+  blob_group->assign(blobs_.size(), -1);
+  group_owner->clear();
+  group_size->clear();
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const size_t count = blobs_[blob_id]->count();
+    if (count == 0) {
+      continue;
+    }
+    const int owner = alias_of[blob_id];
+    if (owner_group[owner] < 0) {
+      owner_group[owner] = group_owner->size();
+      group_owner->push_back(owner);
+      group_size->push_back(0);
+    }
+    const int group = owner_group[owner];
+    (*blob_group)[blob_id] = group;
+    (*group_size)[group] = std::max((*group_size)[group], count);
+  }
+  return group_owner->size();
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanBlobMemory() {
+  vector<int> blob_group;
+  vector<int> group_owner;
+  vector<size_t> group_size;
+  const int num_groups =
+      GroupAliasedBlobs(&blob_group, &group_owner, &group_size);
+  vector<bool> group_pinned(num_groups, false);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_group[blob_id] >= 0 && blob_memory_pinned_[blob_id]) {
+      group_pinned[blob_group[blob_id]] = true;
+    }
+  }
+  // The first and last layer using each group.
+  vector<int> group_begin(num_groups, layers_.size());
+  vector<int> group_end(num_groups, -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < 2; ++i) {
+      const vector<int>& blob_ids =
+          i ? top_id_vecs_[layer_id] : bottom_id_vecs_[layer_id];
+      for (int j = 0; j < blob_ids.size(); ++j) {
+        const int group = blob_group[blob_ids[j]];
+        if (group >= 0) {
+          group_begin[group] = std::min(group_begin[group], layer_id);
+          group_end[group] = std::max(group_end[group], layer_id);
+        }
+      }
+    }
+  }
+  vector<pair<int, int> > groups_by_begin;
+  for (int group = 0; group < num_groups; ++group) {
+    groups_by_begin.push_back(make_pair(group_begin[group], group));
+  }
+  std::sort(groups_by_begin.begin(), groups_by_begin.end());
+  // Hand out buffers in layer order.
+  vector<size_t> buffer_size;
+  vector<int> buffer_end;
+  vector<int> group_buffer(num_groups, -1);
+  size_t naive_size = 0;
+  size_t pinned_size = 0;
+  for (int i = 0; i < num_groups; ++i) {
+    const int group = groups_by_begin[i].second;
+    const size_t size = group_size[group];
+    // Like memory_used_, count only the tops.
+    const bool input = std::find(net_input_blob_indices_.begin(),
+        net_input_blob_indices_.end(), group_owner[group]) !=
+        net_input_blob_indices_.end();
+    if (!input) {
+      naive_size += size;
+    }
+    if (group_pinned[group]) {
+      pinned_size += input ? 0 : size;
+      continue;
+    }
+    // The smallest free buffer that fits, or else the largest free one.
+    int best = -1;
+    for (int buffer = 0; buffer < buffer_size.size(); ++buffer) {
+      if (buffer_end[buffer] >= group_begin[group]) {
+        continue;
+      }
+      if (best < 0) {
+        best = buffer;
+        continue;
+      }
+      const bool fits = buffer_size[buffer] >= size;
+      const bool best_fits = buffer_size[best] >= size;
+      if (fits ? !best_fits || buffer_size[buffer] < buffer_size[best] :
+          !best_fits && buffer_size[buffer] > buffer_size[best]) {
+        best = buffer;
+      }
+    }
+    if (best < 0) {
+      best = buffer_size.size();
+      buffer_size.push_back(0);
+      buffer_end.push_back(-1);
+    }
+    buffer_size[best] = std::max(buffer_size[best], size);
+    buffer_end[best] = group_end[group];
+    group_buffer[group] = best;
+  }
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_size.size());
+  planned_memory_used_ = pinned_size;
+  for (int buffer = 0; buffer < buffers.size(); ++buffer) {
+    buffers[buffer].reset(
+        new SyncedMemory(buffer_size[buffer] * sizeof(Dtype)));
+    planned_memory_used_ += buffer_size[buffer];
+  }
+  for (int group = 0; group < num_groups; ++group) {
+    if (group_buffer[group] >= 0) {
+      blobs_[group_owner[group]]->SetDataMemory(buffers[group_buffer[group]]);
+    }
+  }
+  // Point the blobs that share data with the owners at the new memory.
+  ShareAliasedData();
+  LOG(INFO) << "Blobs share " << buffers.size() << " buffers; memory "
+            << "required for data: " << planned_memory_used_ * sizeof(Dtype)
+            << " instead of " << naive_size * sizeof(Dtype);
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpCheckpoints(const NetParameter& param) {
+  vector<int> first_writer(blobs_.size(), -1);
+  vector<int> last_writer(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int blob_id = top_id_vecs_[layer_id][top_id];
+      if (first_writer[blob_id] < 0) {
+        first_writer[blob_id] = layer_id;
+      }
+      last_writer[blob_id] = layer_id;
+    }
+  }
+  vector<bool> segment_end(layers_.size(), false);
+  for (int i = 0; i < param.checkpoint_size(); ++i) {
+    CHECK(blob_names_index_.count(param.checkpoint(i)))
+        << "Unknown blob " << param.checkpoint(i) << " in checkpoint";
+    const int blob_id = blob_names_index_[param.checkpoint(i)];
+    blob_memory_pinned_[blob_id] = true;
+    if (last_writer[blob_id] >= 0) {
+      segment_end[last_writer[blob_id]] = true;
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    layer_segment_[layer_id] = segment_begin_.size() - 1;
+    if (segment_end[layer_id] && layer_id + 1 < layers_.size()) {
+      segment_begin_.push_back(layer_id + 1);
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    // Replaying a later in-place layer would apply it twice.
+    CHECK(first_writer[blob_id] < 0 || layer_segment_[first_writer[blob_id]] ==
+          layer_segment_[last_writer[blob_id]])
+        << "Blob " << blob_names_[blob_id] << " is written in more than one "
+        << "checkpoint segment; checkpoint it after layer "
+        << layer_names_[last_writer[blob_id]] << " instead.";
+    // The loss weights live in the diffs of the loss blobs.
+    if (blob_loss_weights_[blob_id] != 0) {
+      blob_memory_pinned_[blob_id] = true;
+    }
+  }
+  LOG(INFO) << "Checkpoints split the net into " << segment_begin_.size()
+            << " segments";
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanCheckpointMemory() {
+  vector<int> blob_group;
+  vector<int> group_owner;
+  vector<size_t> group_size;
+  const int num_groups =
+      GroupAliasedBlobs(&blob_group, &group_owner, &group_size);
+  vector<bool> group_pinned(num_groups, false);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_group[blob_id] >= 0 && blob_memory_pinned_[blob_id]) {
+      group_pinned[blob_group[blob_id]] = true;
+    }
+  }
+  // The segment using each group; the groups that are used in no segment or
+  // in several stay where they are.
+  vector<int> group_segment(num_groups, -1);
+  vector<bool> group_used(num_groups, false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < 2; ++i) {
+      const vector<int>& blob_ids =
+          i ? top_id_vecs_[layer_id] : bottom_id_vecs_[layer_id];
+      for (int j = 0; j < blob_ids.size(); ++j) {
+        const int group = blob_group[blob_ids[j]];
+        if (group < 0) {
+          continue;
+        }
+        if (group_used[group] &&
+            group_segment[group] != layer_segment_[layer_id]) {
+          group_pinned[group] = true;
+        }
+        group_used[group] = true;
+        group_segment[group] = layer_segment_[layer_id];
+      }
+    }
+  }
+  const int num_segments = segment_begin_.size();
+  vector<vector<pair<size_t, int> > > segment_groups(num_segments);
+  vector<vector<pair<size_t, int> > > segment_blobs(num_segments);
+  size_t naive_size = 0;
+  size_t pinned_size = 0;
+  for (int group = 0; group < num_groups; ++group) {
+    const size_t size = group_size[group];
+    // Like memory_used_, count only the tops.
+    const bool input = std::find(net_input_blob_indices_.begin(),
+        net_input_blob_indices_.end(), group_owner[group]) !=
+        net_input_blob_indices_.end();
+    if (!input) {
+      naive_size += size;
+    }
+    if (!group_used[group] || group_pinned[group]) {
+      pinned_size += input ? 0 : size;
+      continue;
+    }
+    segment_groups[group_segment[group]].push_back(make_pair(size, group));
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int group = blob_group[blob_id];
+    if (group >= 0 && group_used[group] && !group_pinned[group]) {
+      segment_blobs[group_segment[group]].push_back(
+          make_pair(blobs_[blob_id]->count(), blob_id));
+    }
+  }
+  // The i-th largest data and diff of every segment share a buffer.
+  vector<size_t> data_size;
+  vector<size_t> diff_size;
+  for (int segment = 0; segment < num_segments; ++segment) {
+    std::sort(segment_groups[segment].rbegin(), segment_groups[segment].rend());
+    std::sort(segment_blobs[segment].rbegin(), segment_blobs[segment].rend());
+    data_size.resize(std::max(data_size.size(),
+                              segment_groups[segment].size()), 0);
+    for (int i = 0; i < segment_groups[segment].size(); ++i) {
+      data_size[i] = std::max(data_size[i], segment_groups[segment][i].first);
+    }
+    diff_size.resize(std::max(diff_size.size(),
+                              segment_blobs[segment].size()), 0);
+    for (int i = 0; i < segment_blobs[segment].size(); ++i) {
+      diff_size[i] = std::max(diff_size[i], segment_blobs[segment][i].first);
+    }
+  }
+  vector<shared_ptr<SyncedMemory> > data_buffers(data_size.size());
+  planned_memory_used_ = pinned_size;
+  for (int i = 0; i < data_buffers.size(); ++i) {
+    data_buffers[i].reset(new SyncedMemory(data_size[i] * sizeof(Dtype)));
+    planned_memory_used_ += data_size[i];
+  }
+  vector<shared_ptr<SyncedMemory> > diff_buffers(diff_size.size());
+  for (int i = 0; i < diff_buffers.size(); ++i) {
+    diff_buffers[i].reset(new SyncedMemory(diff_size[i] * sizeof(Dtype)));
+  }
+  for (int segment = 0; segment < num_segments; ++segment) {
+    for (int i = 0; i < segment_groups[segment].size(); ++i) {
+      const int group = segment_groups[segment][i].second;
+      blobs_[group_owner[group]]->SetDataMemory(data_buffers[i]);
+    }
+    for (int i = 0; i < segment_blobs[segment].size(); ++i) {
+      blobs_[segment_blobs[segment][i].second]->SetDiffMemory(diff_buffers[i]);
+    }
+  }
+  ShareAliasedData();
+  // Nothing is left of the last forward pass.
+  intact_segment_ = -1;
+  LOG(INFO) << "Blobs between checkpoints share " << data_buffers.size()
+            << " buffers; memory required for data: "
+            << planned_memory_used_ * sizeof(Dtype) << " instead of "
+            << naive_size * sizeof(Dtype);
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(const int segment) {
+  const int begin = segment_begin_[segment];
+  const int end = segment + 1 < segment_begin_.size() ?
+      segment_begin_[segment + 1] : layers_.size();
+  for (int i = begin; i < end; ++i) {
+    // Layers without bottoms would read new data; their tops are kept.
+    if (bottom_vecs_[i].empty()) {
+      continue;
+    }
+    layers_[i]->set_replay(true);
+    layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
+    layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
+    layers_[i]->set_replay(false);
+  }
+  intact_segment_ = segment;
 }
 
 template <typename Dtype>
@@ -705,15 +1461,43 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
     DLOG(INFO) << "Copying source layer " << source_layer_name;
     vector<shared_ptr<Blob<Dtype> > >& target_blobs =
         layers_[target_layer_id]->blobs();
+    const LayerParameter& target_param =
+        layers_[target_layer_id]->layer_param();
     CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
         << "Incompatible number of blobs for layer " << source_layer_name;
+    // A fully convolutional net takes the InnerProduct weights as they are
+    // and only shapes them as its Convolution kernels.
+    const bool convolutionized =
+        source_layer.type() == LayerParameter_LayerType_INNER_PRODUCT &&
+        target_param.type() == LayerParameter_LayerType_CONVOLUTION;
     for (int j = 0; j < target_blobs.size(); ++j) {
+      if (convolutionized) {
+        const BlobProto& source_blob = source_layer.blobs(j);
+        Blob<Dtype>* target_blob = target_blobs[j].get();
+        CHECK_EQ(target_blob->count(), source_blob.num() *
+            source_blob.channels() * source_blob.height() *
+            source_blob.width())
+            << "Incompatible InnerProduct weights for layer "
+            << source_layer_name;
+        const int num = target_blob->num();
+        const int channels = target_blob->channels();
+        const int height = target_blob->height();
+        const int width = target_blob->width();
+        target_blob->FromProto(source_blob);
+        target_blob->Reshape(num, channels, height, width);
+        continue;
+      }
       CHECK_EQ(target_blobs[j]->num(), source_layer.blobs(j).num());
       CHECK_EQ(target_blobs[j]->channels(), source_layer.blobs(j).channels());
       CHECK_EQ(target_blobs[j]->height(), source_layer.blobs(j).height());
       CHECK_EQ(target_blobs[j]->width(), source_layer.blobs(j).width());
       target_blobs[j]->FromProto(source_layer.blobs(j));
     }
+    if (target_param.has_folded_affine() &&
+        !source_layer.has_folded_affine()) {
+      FoldAffine(target_param.folded_affine(), &target_blobs);
+    }
+    layers_[target_layer_id]->BlobsChanged();
   }
 }
 
@@ -781,6 +1565,9 @@ void Net<Dtype>::Update() {
     if (debug_info_) { UpdateDebugInfo(i); }
     params_[i]->Update();
   }
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->BlobsChanged();
+  }
 }
 
 template <typename Dtype>
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/quantization.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The side of the square tiles in which ForwardConvolution transposes the
+// quantized column buffer, small enough for a tile of rows to stay in cache.
+const int kTransposeTile = 32;
+
+}  // namespace
+
+template <typename Dtype>
+QuantizedGemm<Dtype>::QuantizedGemm(const QuantizationParameter& param)
+    : input_scale_(param.input_scale()),
+      drop_float_weights_(param.drop_float_weights()),
+      float_weights_dropped_(false), rows_(0), cols_(0) {
+  CHECK_GT(input_scale_, 0) << "quantization_param needs a positive "
+      << "input_scale; calibrate_quantization picks one.";
+}
+
+template <typename Dtype>
+void QuantizedGemm<Dtype>::QuantizeWeights(const int rows, const int cols,
+    Blob<Dtype>* weight_blob) {
+  if (!weights_.empty() && rows == rows_ && cols == cols_) {
+    return;
+  }
+  CHECK(!float_weights_dropped_) << "The float weights were dropped for "
+      << rows_ << " x " << cols_ << " weights, not " << rows << " x " << cols;
+  CHECK_EQ(rows * cols, weight_blob->count());
+  const Dtype* weights = weight_blob->cpu_data();
+  rows_ = rows;
+  cols_ = cols;
+  weights_.resize(rows_ * cols_);
+  weight_scales_.resize(rows_);
+  for (int r = 0; r < rows_; ++r) {
+    const Dtype* row = weights + r * cols_;
+    Dtype max_abs = 0;
+    for (int c = 0; c < cols_; ++c) {
+      max_abs = std::max(max_abs, std::fabs(row[c]));
+    }
+    // An all-zero row quantizes to zeros with any scale.
+    weight_scales_[r] = max_abs > 0 ? max_abs / 127 : Dtype(1);
+    caffe_cpu_quantize_s8(cols_, row, weight_scales_[r],
+                          &weights_[r * cols_]);
+  }
+  if (drop_float_weights_) {
+    // Point the blob at empty memory so that its own is freed.
+    weight_blob->Reshape(0, 0, 0, 0);
+    weight_blob->SetDataMemory(
+        shared_ptr<SyncedMemory>(new SyncedMemory(0)));
+    weight_blob->SetDiffMemory(
+        shared_ptr<SyncedMemory>(new SyncedMemory(0)));
+    float_weights_dropped_ = true;
+  }
+}
+
+template <typename Dtype>
+void QuantizedGemm<Dtype>::Invalidate() {
+  // Without the float weights the quantized ones are all there is.
+  if (float_weights_dropped_) {
+    LOG(WARNING) << "Keeping the quantized weights, as the float ones were "
+                 << "dropped";
+    return;
+  }
+  weights_.clear();
+}
+
+template <typename Dtype>
+void QuantizedGemm<Dtype>::ForwardInnerProduct(const int m,
+    const Dtype* bottom, Dtype* top) {
+  CHECK(!weights_.empty()) << "QuantizeWeights must come first.";
+  input_.resize(m * cols_);
+  output_.resize(m * rows_);
+  caffe_cpu_quantize_s8(m * cols_, bottom, input_scale_, &input_[0]);
+  caffe_cpu_gemm_s8(m, rows_, cols_, &input_[0], &weights_[0], &output_[0]);
+  for (int i = 0; i < m; ++i) {
+    for (int j = 0; j < rows_; ++j) {
+      top[i * rows_ + j] =
+          output_[i * rows_ + j] * input_scale_ * weight_scales_[j];
+    }
+  }
+}
+
+template <typename Dtype>
+void QuantizedGemm<Dtype>::ForwardConvolution(const int row_begin,
+    const int rows, const int n, const Dtype* col, Dtype* top) {
+  CHECK(!weights_.empty()) << "QuantizeWeights must come first.";
+  CHECK_LE(row_begin + rows, rows_);
+  // caffe_cpu_gemm_s8 reads both operands along cols_, so the column buffer
+  // is quantized as it is and then transposed to n x cols_.
+  col_.resize(cols_ * n);
+  input_.resize(n * cols_);
+  output_.resize(rows * n);
+  caffe_cpu_quantize_s8(cols_ * n, col, input_scale_, &col_[0]);
+  for (int k0 = 0; k0 < cols_; k0 += kTransposeTile) {
+    const int k_end = std::min(cols_, k0 + kTransposeTile);
+    for (int p0 = 0; p0 < n; p0 += kTransposeTile) {
+      const int p_end = std::min(n, p0 + kTransposeTile);
+      for (int k = k0; k < k_end; ++k) {
+        for (int p = p0; p < p_end; ++p) {
+          input_[p * cols_ + k] = col_[k * n + p];
+        }
+      }
+    }
+  }
+  caffe_cpu_gemm_s8(rows, n, cols_, &weights_[row_begin * cols_], &input_[0],
+                    &output_[0]);
+  for (int r = 0; r < rows; ++r) {
+    const Dtype scale = input_scale_ * weight_scales_[row_begin + r];
+    for (int p = 0; p < n; ++p) {
+      top[r * n + p] = output_[r * n + p] * scale;
+    }
+  }
+}
+
+INSTANTIATE_CLASS(QuantizedGemm);
+
+}  // namespace caffe
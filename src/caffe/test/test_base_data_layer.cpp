@@ -0,0 +1,87 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Fills its i-th batch since set up with i.
+template <typename Dtype>
+class CountingDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit CountingDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param), batch_size_(4), batches_(0) {}
+  virtual ~CountingDataLayer() { this->JoinPrefetchThread(); }
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+    (*top)[0]->Reshape(batch_size_, 1, 1, 1);
+    this->datum_channels_ = 1;
+    this->datum_height_ = 1;
+    this->datum_width_ = 1;
+    this->datum_size_ = 1;
+    batches_ = 0;
+  }
+
+  int batch_size_;
+
+ protected:
+  virtual inline int prefetch_count() const { return 1; }
+  virtual void LoadBatch(Batch<Dtype>* batch) {
+    caffe_set(batch->data_.count(), Dtype(batches_++),
+        batch->data_.mutable_cpu_data());
+  }
+
+  int batches_;
+};
+
+template <typename TypeParam>
+class BaseDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  BaseDataLayerTest() : blob_top_data_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+  }
+
+  virtual ~BaseDataLayerTest() { delete blob_top_data_; }
+
+  Blob<Dtype>* const blob_top_data_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BaseDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BaseDataLayerTest, TestSetUpAgain) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  CountingDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(0, this->blob_top_data_->cpu_data()[i]);
+  }
+  // The top points at the batch just handed out, which setting up again
+  // frees: the top must not keep using that memory, although it shrinks.
+  shared_ptr<SyncedMemory> batch_memory = this->blob_top_data_->data();
+  layer.batch_size_ = 2;
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_NE(batch_memory.get(), this->blob_top_data_->data().get());
+  EXPECT_EQ(2, this->blob_top_data_->num());
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ(iter, this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -378,6 +378,346 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionPadStride1) {
+  // Stride 1 with padding takes the contiguous row copy path of im2col.
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->height(), 6);
+  EXPECT_EQ(this->blob_top_->width(), 4);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionRectPadStride) {
+  // Unequal padding, with strides over 1 and a kernel column sometimes
+  // entirely inside the padding.
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->set_pad_h(1);
+  convolution_param->set_pad_w(2);
+  convolution_param->set_stride_h(2);
+  convolution_param->set_stride_w(3);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientPadStride1) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestMultithreadedIm2col) {
+  // A bottom large enough for im2col and col2im to split channels over
+  // Caffe::cpu_threads(), which must not change the results.
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(2, 16, 12, 12);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, &(this->blob_top_vec_));
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+             this->blob_top_->mutable_cpu_diff());
+  Blob<Dtype> single_top, single_bottom_diff;
+  vector<bool> propagate_down(1, true);
+  for (int num_threads = 1; num_threads <= 3; num_threads += 2) {
+    Caffe::set_cpu_threads(num_threads);
+    layer.Forward(bottom_vec, &(this->blob_top_vec_));
+    layer.Backward(this->blob_top_vec_, propagate_down, &bottom_vec);
+    if (num_threads == 1) {
+      single_top.CopyFrom(*this->blob_top_, false, true);
+      single_bottom_diff.CopyFrom(bottom, true, true);
+      continue;
+    }
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_EQ(single_top.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+    }
+    for (int i = 0; i < bottom.count(); ++i) {
+      EXPECT_EQ(single_bottom_diff.cpu_diff()[i], bottom.cpu_diff()[i]);
+    }
+  }
+  Caffe::set_cpu_threads(0);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestColBatch) {
+  // Unrolling several images into one GEMM, including a last batch that is
+  // only partly full, must match unrolling one at a time.
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(5, 4, 7, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> single_layer(layer_param);
+  single_layer.SetUp(bottom_vec, &(this->blob_top_vec_));
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+             this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  single_layer.Forward(bottom_vec, &(this->blob_top_vec_));
+  single_layer.Backward(this->blob_top_vec_, propagate_down, &bottom_vec);
+  Blob<Dtype> single_top, single_bottom_diff, single_weight_diff;
+  single_top.CopyFrom(*this->blob_top_, false, true);
+  single_bottom_diff.CopyFrom(bottom, true, true);
+  single_weight_diff.CopyFrom(*single_layer.blobs()[0], true, true);
+  // 0 lets the memory budget, here enough for all images, choose.
+  const int col_batch_sizes[] = { 2, 0 };
+  for (int b = 0; b < 2; ++b) {
+    convolution_param->set_col_batch_size(col_batch_sizes[b]);
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, &(this->blob_top_vec_));
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      layer.blobs()[i]->CopyFrom(*single_layer.blobs()[i]);
+    }
+    layer.Forward(bottom_vec, &(this->blob_top_vec_));
+    layer.Backward(this->blob_top_vec_, propagate_down, &bottom_vec);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(single_top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+                  1e-4);
+    }
+    for (int i = 0; i < bottom.count(); ++i) {
+      EXPECT_NEAR(single_bottom_diff.cpu_diff()[i], bottom.cpu_diff()[i],
+                  1e-4);
+    }
+    for (int i = 0; i < single_weight_diff.count(); ++i) {
+      EXPECT_NEAR(single_weight_diff.cpu_diff()[i],
+                  layer.blobs()[0]->cpu_diff()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientColBatch) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_col_batch_size(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolution1x1) {
+  // 1x1 kernels are convolved without im2col.
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradient1x1) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionWinograd) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Odd output sizes leave partial tiles at the bottom and right edges.
+  Blob<Dtype> bottom(2, 4, 7, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  // The engine is picked by the layer factory.
+  LayerParameter layer_param;
+  layer_param.set_type(LayerParameter_LayerType_CONVOLUTION);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  for (int pad = 0; pad <= 2; ++pad) {
+    for (int group = 1; group <= 2; ++group) {
+      convolution_param->set_pad(pad);
+      convolution_param->set_group(group);
+      shared_ptr<Layer<Dtype> > layer(GetLayer<Dtype>(layer_param));
+      layer->SetUp(bottom_vec, &(this->blob_top_vec_));
+      layer->Forward(bottom_vec, &(this->blob_top_vec_));
+      caffe_conv(&bottom, convolution_param, layer->blobs(),
+          this->MakeReferenceTop(this->blob_top_));
+      const Dtype* top_data = this->blob_top_->cpu_data();
+      const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4)
+            << "pad " << pad << " group " << group;
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientWinograd) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestQuantizedConvolution) {
+  // The int8 forward pass of the TEST phase stays close to the float one,
+  // with groups and several images per GEMM.
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  Blob<Dtype> bottom(5, 4, 7, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->set_col_batch_size(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  // Clamps the few bottom values beyond 4 standard deviations.
+  layer_param.mutable_quantization_param()->set_input_scale(4. / 127);
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, &(this->blob_top_vec_));
+  layer.Forward(bottom_vec, &(this->blob_top_vec_));
+  caffe_conv(&bottom, convolution_param, layer.blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 0.3);
+  }
+  // New weights are quantized again once the layer is told of them.
+  caffe_scal(layer.blobs()[0]->count(), Dtype(-1),
+             layer.blobs()[0]->mutable_cpu_data());
+  layer.BlobsChanged();
+  layer.Forward(bottom_vec, &(this->blob_top_vec_));
+  caffe_conv(&bottom, convolution_param, layer.blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 0.3);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
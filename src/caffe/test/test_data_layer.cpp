@@ -24,7 +24,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       : backend_(DataParameter_DB_LEVELDB),
         blob_top_data_(new Blob<Dtype>()),
         blob_top_label_(new Blob<Dtype>()),
-        seed_(1701) {}
+        seed_(1701),
+        num_workers_(1) {}
   virtual void SetUp() {
     filename_.reset(new string());
     MakeTempDir(filename_.get());
@@ -119,6 +120,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_workers(num_workers_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -158,6 +160,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_workers(num_workers_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -208,6 +211,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_workers(num_workers_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -262,6 +266,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_workers(num_workers_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -321,6 +326,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
   int seed_;
+  int num_workers_;
 };
 
 TYPED_TEST_CASE(DataLayerTest, TestDtypesAndDevices);
@@ -331,6 +337,13 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadWorkersLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->num_workers_ = 3;
+  this->FillLevelDB(unique_pixels);
+  this->TestRead();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLevelDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -347,6 +360,16 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that random crops stay reproducible when they are spread over several
+// transformation workers.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededWorkersLevelDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->num_workers_ = 3;
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -369,6 +392,13 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadWorkersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->num_workers_ = 3;
+  this->FillLMDB(unique_pixels);
+  this->TestRead();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -385,6 +415,16 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that random crops stay reproducible when they are spread over several
+// transformation workers.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededWorkersLMDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->num_workers_ = 3;
+  this->FillLMDB(unique_pixels);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -0,0 +1,270 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DataTransformerTest : public ::testing::Test {
+ protected:
+  DataTransformerTest() : seed_(1701) {}
+
+  virtual void SetUp() {
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  void FillDatum(const int channels, const int height, const int width,
+                 Datum* datum) {
+    datum->set_channels(channels);
+    datum->set_height(height);
+    datum->set_width(width);
+    const int size = channels * height * width;
+    string data(size, 0);
+    for (int i = 0; i < size; ++i) {
+      data[i] = static_cast<char>((i * 37 + 11) % 256);
+    }
+    datum->set_data(data);
+    mean_.resize(size);
+    caffe_rng_uniform<Dtype>(size, 0, 255, &mean_[0]);
+  }
+
+  // The per-element loops DataTransformer used before it was vectorized,
+  // drawing crop offsets and mirroring from rng in the same order.
+  void ReferenceTransform(const TransformationParameter& param,
+                          const Datum& datum, Caffe::RNG* rng,
+                          Dtype* transformed_data) {
+    const string& data = datum.data();
+    const int channels = datum.channels();
+    const int height = datum.height();
+    const int width = datum.width();
+    const int crop_size = param.crop_size();
+    const Dtype scale = param.scale();
+    const Dtype* mean = &mean_[0];
+    if (crop_size == 0) {
+      for (int j = 0; j < data.size(); ++j) {
+        Dtype datum_element =
+            static_cast<Dtype>(static_cast<uint8_t>(data[j]));
+        transformed_data[j] = (datum_element - mean[j]) * scale;
+      }
+      return;
+    }
+    caffe::rng_t* gen = static_cast<caffe::rng_t*>(rng->generator());
+    const int h_off = (*gen)() % (height - crop_size);
+    const int w_off = (*gen)() % (width - crop_size);
+    const bool mirror = param.mirror() && (*gen)() % 2;
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < crop_size; ++h) {
+        for (int w = 0; w < crop_size; ++w) {
+          int data_index = (c * height + h + h_off) * width + w + w_off;
+          int top_index = (c * crop_size + h) * crop_size +
+              (mirror ? crop_size - 1 - w : w);
+          Dtype datum_element =
+              static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
+          transformed_data[top_index] =
+              (datum_element - mean[data_index]) * scale;
+        }
+      }
+    }
+  }
+
+  // Checks that DataTransformer matches ReferenceTransform bit for bit over
+  // a few random crops.
+  void TestMatchesReference(const TransformationParameter& param,
+                            const Datum& datum) {
+    const int crop_size = param.crop_size();
+    const int count = crop_size ? datum.channels() * crop_size * crop_size :
+        datum.data().size();
+    Caffe::set_random_seed(seed_);
+    DataTransformer<Dtype> transformer(param);
+    transformer.InitRand();
+    Caffe::set_random_seed(seed_);
+    Caffe::RNG rng(caffe_rng_rand());
+    vector<Dtype> expected(count);
+    vector<Dtype> actual(count);
+    for (int iter = 0; iter < 10; ++iter) {
+      ReferenceTransform(param, datum, &rng, &expected[0]);
+      transformer.Transform(0, datum,
+          param.mean_value_size() ? NULL : &mean_[0], &actual[0]);
+      EXPECT_EQ(0, memcmp(&expected[0], &actual[0], count * sizeof(Dtype)))
+          << "iteration " << iter;
+    }
+  }
+
+  // Sets mean_value in param to one value per channel of datum, and mean_ to
+  // the equivalent mean image for ReferenceTransform.
+  void SetMeanValues(const Datum& datum, TransformationParameter* param) {
+    const int channel_size = datum.height() * datum.width();
+    for (int c = 0; c < datum.channels(); ++c) {
+      const float mean_value = 100 + 10.3 * c;
+      param->add_mean_value(mean_value);
+      for (int i = 0; i < channel_size; ++i) {
+        mean_[c * channel_size + i] = mean_value;
+      }
+    }
+  }
+
+  int seed_;
+  vector<Dtype> mean_;
+};
+
+TYPED_TEST_CASE(DataTransformerTest, TestDtypes);
+
+TYPED_TEST(DataTransformerTest, TestUint8TransformAllSimdLevels) {
+  // Cover every vector width and its scalar remainder, both directions.
+  const int max_n = 70;
+  vector<uint8_t> x(max_n);
+  for (int i = 0; i < max_n; ++i) {
+    x[i] = static_cast<uint8_t>((i * 53 + 7) % 256);
+  }
+  vector<TypeParam> mean(max_n);
+  caffe_rng_uniform<TypeParam>(max_n, 0, 255, &mean[0]);
+  const TypeParam scale = 1. / 255;
+  vector<TypeParam> expected(max_n);
+  vector<TypeParam> actual(max_n);
+  const SimdLevel levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+  for (int n = 1; n <= max_n; ++n) {
+    for (int mirror = 0; mirror < 2; ++mirror) {
+      for (int i = 0; i < n; ++i) {
+        expected[mirror ? n - 1 - i : i] =
+            (static_cast<TypeParam>(x[i]) - mean[i]) * scale;
+      }
+      for (int l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+        caffe_cpu_uint8_transform(n, &x[0], &mean[0], scale, mirror,
+                                  &actual[0], levels[l]);
+        EXPECT_EQ(0, memcmp(&expected[0], &actual[0], n * sizeof(TypeParam)))
+            << "n " << n << " mirror " << mirror << " level " << levels[l];
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestUint8TransformBroadcastMean) {
+  const int max_n = 40;
+  vector<uint8_t> x(max_n);
+  for (int i = 0; i < max_n; ++i) {
+    x[i] = static_cast<uint8_t>((i * 53 + 7) % 256);
+  }
+  const TypeParam mean = 104.7;
+  const TypeParam scale = 1. / 255;
+  vector<TypeParam> expected(max_n);
+  vector<TypeParam> actual(max_n);
+  const SimdLevel levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+  for (int n = 1; n <= max_n; ++n) {
+    for (int mirror = 0; mirror < 2; ++mirror) {
+      for (int i = 0; i < n; ++i) {
+        expected[mirror ? n - 1 - i : i] =
+            (static_cast<TypeParam>(x[i]) - mean) * scale;
+      }
+      for (int l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+        caffe_cpu_uint8_transform(n, &x[0], mean, scale, mirror, &actual[0],
+                                  levels[l]);
+        EXPECT_EQ(0, memcmp(&expected[0], &actual[0], n * sizeof(TypeParam)))
+            << "n " << n << " mirror " << mirror << " level " << levels[l];
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestNoCrop) {
+  TransformationParameter param;
+  param.set_scale(0.017);
+  Datum datum;
+  this->FillDatum(3, 5, 7, &datum);
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestCrop) {
+  TransformationParameter param;
+  param.set_scale(0.017);
+  param.set_crop_size(13);
+  Datum datum;
+  this->FillDatum(3, 19, 17, &datum);
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestCropMirror) {
+  TransformationParameter param;
+  param.set_scale(0.017);
+  param.set_crop_size(13);
+  param.set_mirror(true);
+  Datum datum;
+  this->FillDatum(3, 19, 17, &datum);
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestNoCropMeanValues) {
+  TransformationParameter param;
+  param.set_scale(0.017);
+  Datum datum;
+  this->FillDatum(3, 5, 7, &datum);
+  this->SetMeanValues(datum, &param);
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestCropMirrorMeanValues) {
+  TransformationParameter param;
+  param.set_scale(0.017);
+  param.set_crop_size(13);
+  param.set_mirror(true);
+  Datum datum;
+  this->FillDatum(3, 19, 17, &datum);
+  this->SetMeanValues(datum, &param);
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestCropSingleMeanValue) {
+  TransformationParameter param;
+  param.set_crop_size(13);
+  param.add_mean_value(127.5);
+  Datum datum;
+  this->FillDatum(3, 19, 17, &datum);
+  for (int i = 0; i < this->mean_.size(); ++i) {
+    this->mean_[i] = 127.5;
+  }
+  this->TestMatchesReference(param, datum);
+}
+
+TYPED_TEST(DataTransformerTest, TestDrawRandomAhead) {
+  // Drawing the random numbers of several items first and transforming the
+  // items in any order must match transforming them one by one.
+  TransformationParameter param;
+  param.set_crop_size(13);
+  param.set_mirror(true);
+  Datum datum;
+  this->FillDatum(3, 19, 17, &datum);
+  const int num_items = 5;
+  const int item_size = 3 * 13 * 13;
+  vector<TypeParam> expected(num_items * item_size);
+  vector<TypeParam> actual(num_items * item_size);
+  Caffe::set_random_seed(this->seed_);
+  DataTransformer<TypeParam> sequential(param);
+  sequential.InitRand();
+  for (int i = 0; i < num_items; ++i) {
+    sequential.Transform(i, datum, &this->mean_[0], &expected[0]);
+  }
+  Caffe::set_random_seed(this->seed_);
+  DataTransformer<TypeParam> ahead(param);
+  ahead.InitRand();
+  vector<typename DataTransformer<TypeParam>::RandomDraws> draws(num_items);
+  for (int i = 0; i < num_items; ++i) {
+    ahead.DrawRandom(&draws[i]);
+  }
+  for (int i = num_items - 1; i >= 0; --i) {
+    ahead.Transform(i, datum, datum.data().data(), &this->mean_[0],
+                    &actual[0], draws[i]);
+  }
+  EXPECT_EQ(0, memcmp(&expected[0], &actual[0],
+                      expected.size() * sizeof(TypeParam)));
+}
+
+}  // namespace caffe
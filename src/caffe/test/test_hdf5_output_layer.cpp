@@ -120,4 +120,59 @@ TYPED_TEST(HDF5OutputLayerTest, TestForward) {
       this->output_file_name_;
 }
 
+TYPED_TEST(HDF5OutputLayerTest, TestAppend) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Three bottoms written over three forward passes to compressed datasets
+  // whose chunks do not line up with the batches.
+  Blob<Dtype> first(4, 3, 2, 2);
+  Blob<Dtype> second(4, 1, 1, 1);
+  Blob<Dtype> third(4, 5, 1, 1);
+  this->blob_bottom_vec_.push_back(&first);
+  this->blob_bottom_vec_.push_back(&second);
+  this->blob_bottom_vec_.push_back(&third);
+  LayerParameter param;
+  HDF5OutputParameter* hdf5_output_param = param.mutable_hdf5_output_param();
+  hdf5_output_param->set_file_name(this->output_file_name_);
+  hdf5_output_param->add_dataset_name("features");
+  hdf5_output_param->set_chunk_size(3);
+  hdf5_output_param->set_compression_level(1);
+  const int num_passes = 3;
+  {
+    HDF5OutputLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int pass = 0; pass < num_passes; ++pass) {
+      for (int i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+        Blob<Dtype>* bottom = this->blob_bottom_vec_[i];
+        for (int j = 0; j < bottom->count(); ++j) {
+          bottom->mutable_cpu_data()[j] = 1000 * pass + 100 * i + j;
+        }
+      }
+      layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    }
+  }
+  hid_t file_id = H5Fopen(this->output_file_name_.c_str(), H5F_ACC_RDONLY,
+                          H5P_DEFAULT);
+  ASSERT_GE(file_id, 0) << "Failed to open HDF5 file" <<
+      this->output_file_name_;
+  const char* names[] = {"features", HDF5_DATA_LABEL_NAME, "data_2"};
+  for (int i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+    const Blob<Dtype>* bottom = this->blob_bottom_vec_[i];
+    Blob<Dtype> blob;
+    hdf5_load_nd_dataset(file_id, names[i], 0, 4, &blob);
+    EXPECT_EQ(num_passes * bottom->num(), blob.num());
+    EXPECT_EQ(bottom->channels(), blob.channels());
+    EXPECT_EQ(bottom->height(), blob.height());
+    EXPECT_EQ(bottom->width(), blob.width());
+    for (int pass = 0; pass < num_passes; ++pass) {
+      for (int j = 0; j < bottom->count(); ++j) {
+        EXPECT_EQ(1000 * pass + 100 * i + j,
+                  blob.cpu_data()[pass * bottom->count() + j]);
+      }
+    }
+  }
+  herr_t status = H5Fclose(file_id);
+  EXPECT_GE(status, 0) << "Failed to close HDF5 file " <<
+      this->output_file_name_;
+}
+
 }  // namespace caffe
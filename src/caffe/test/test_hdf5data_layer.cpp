@@ -121,4 +121,72 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Chunks that do not line up with the batches or the files still hand out
+  // the rows of both files in order.
+  LayerParameter param;
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_chunk_size(3);
+  hdf5_data_param->set_resident_chunks(2);
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+
+  const int num_rows = 10;
+  const int data_size = 8 * 6 * 5;
+  for (int iter = 0; iter < 10; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < batch_size; ++i) {
+      const int row = (iter * batch_size + i) % num_rows;
+      const int file_offset =
+          ((iter * batch_size + i) / num_rows) % 2 == 0 ? 0 : 2400;
+      EXPECT_EQ(row + 1, this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < data_size; ++j) {
+        EXPECT_EQ(file_offset + row * data_size + j,
+                  this->blob_top_data_->cpu_data()[i * data_size + j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
+  // With five resident chunks of two rows, each file is shuffled as a whole,
+  // so four batches hand out every row of both files exactly once.
+  LayerParameter param;
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_chunk_size(2);
+  hdf5_data_param->set_resident_chunks(5);
+  hdf5_data_param->set_shuffle(true);
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+
+  const int data_size = 8 * 6 * 5;
+  vector<int> row_count(20, 0);
+  for (int iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < batch_size; ++i) {
+      const Dtype* data = this->blob_top_data_->cpu_data() + i * data_size;
+      const int first = static_cast<int>(data[0]);
+      ASSERT_EQ(0, first % data_size);
+      const int row = first / data_size;
+      ASSERT_LT(row, 20);
+      ++row_count[row];
+      EXPECT_EQ(row % 10 + 1, this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < data_size; ++j) {
+        EXPECT_EQ(first + j, data[j]);
+      }
+    }
+  }
+  for (int row = 0; row < 20; ++row) {
+    EXPECT_EQ(1, row_count[row]) << "row " << row;
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,102 @@
+#include <stdint.h>
+
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {};
+
+TEST_F(HostAllocatorTest, TestBlockSize) {
+  HostAllocator allocator;
+  EXPECT_EQ(64, allocator.BlockSize(1, false));
+  EXPECT_EQ(64, allocator.BlockSize(64, false));
+  EXPECT_EQ(80, allocator.BlockSize(65, false));
+  EXPECT_EQ(1024, allocator.BlockSize(1024, false));
+  EXPECT_EQ(1280, allocator.BlockSize(1025, false));
+  for (size_t size = 1; size < 100000; size = size * 3 / 2 + 1) {
+    const size_t block_size = allocator.BlockSize(size, false);
+    EXPECT_GE(block_size, size);
+    EXPECT_LE(block_size, size + size / 4 + 64);
+  }
+  const size_t huge = HostAllocator::kHugePageSize;
+  EXPECT_EQ(2 * huge, allocator.BlockSize(huge + 1, true));
+  EXPECT_EQ(huge + huge / 4, allocator.BlockSize(huge + 1, false));
+}
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  HostAllocator allocator;
+  for (size_t size = 1; size < 100000; size = size * 3 / 2 + 1) {
+    void* ptr = allocator.Allocate(size);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % HostAllocator::kAlignment);
+    memset(ptr, 1, size);  // NOLINT(caffe/alt_fn)
+    allocator.Free(ptr);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestReuseAndStats) {
+  HostAllocator allocator;
+  void* first = allocator.Allocate(1000);
+  const size_t block_size = allocator.BlockSize(1000, false);
+  EXPECT_EQ(block_size, allocator.stats().bytes_in_use);
+  allocator.Free(first);
+  EXPECT_EQ(0, allocator.stats().bytes_in_use);
+  EXPECT_EQ(block_size, allocator.stats().bytes_cached);
+  // Any request of the same size class gets the cached block back.
+  void* second = allocator.Allocate(990);
+  EXPECT_EQ(first, second);
+  void* third = allocator.Allocate(1000);
+  EXPECT_NE(second, third);
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(3, stats.num_allocs);
+  EXPECT_EQ(1, stats.num_cache_hits);
+  EXPECT_EQ(2 * block_size, stats.bytes_in_use);
+  EXPECT_EQ(2 * block_size, stats.peak_bytes_in_use);
+  EXPECT_EQ(0, stats.bytes_cached);
+  allocator.Free(second);
+  allocator.Free(third);
+  allocator.ReleaseCache();
+  stats = allocator.stats();
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_EQ(2 * block_size, stats.peak_bytes_in_use);
+  EXPECT_EQ(0, stats.bytes_cached);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  HostAllocator allocator;
+  allocator.set_cache_limit(0);
+  allocator.Free(allocator.Allocate(1000));
+  EXPECT_EQ(0, allocator.stats().bytes_cached);
+  allocator.Free(allocator.Allocate(1000));
+  EXPECT_EQ(0, allocator.stats().num_cache_hits);
+
+  allocator.set_cache_limit(3000);
+  void* small = allocator.Allocate(1000);
+  void* large = allocator.Allocate(2000);
+  allocator.Free(small);
+  allocator.Free(large);
+  // Both fit separately but not together; the larger one is evicted.
+  EXPECT_EQ(allocator.BlockSize(1000, false), allocator.stats().bytes_cached);
+}
+
+TEST_F(HostAllocatorTest, TestHugePages) {
+  HostAllocator allocator;
+  allocator.set_huge_pages(true);
+  const size_t size = HostAllocator::kHugePageSize + 1;
+  char* ptr = static_cast<char*>(allocator.Allocate(size));
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) %
+            HostAllocator::kHugePageSize);
+  EXPECT_EQ(2 * HostAllocator::kHugePageSize,
+            allocator.stats().bytes_in_use);
+  ptr[0] = 1;
+  ptr[size - 1] = 1;
+  allocator.Free(ptr);
+}
+
+}  // namespace caffe
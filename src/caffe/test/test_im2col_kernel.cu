@@ -39,11 +39,8 @@ class Im2colKernelTest : public ::testing::Test {
     height_ = blob_bottom_->height();
     width_ = blob_bottom_->width();
     channels_ = blob_bottom_->channels();
-    pad_ = 0;
-    stride_ = 2;
     kernel_size_ = 3;
-    height_col_ = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
-    width_col_ = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    SetGeometry(0, 2);
   }
 
   virtual ~Im2colKernelTest() {
@@ -52,6 +49,72 @@ class Im2colKernelTest : public ::testing::Test {
       delete blob_top_cpu_;
   }
 
+  void SetGeometry(const int pad, const int stride) {
+    pad_ = pad;
+    stride_ = stride;
+    height_col_ = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+    width_col_ = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
+  }
+
+  // Runs im2col_cpu and the GPU kernel, with several grid sizes, on
+  // blob_bottom_ and checks that they agree exactly.
+  void CompareGPUToCPU() {
+    Caffe::set_mode(Caffe::GPU);
+
+    // Reshape the blobs to correct size for im2col output
+    this->blob_top_->Reshape(this->blob_bottom_->num(),
+            this->channels_ * this->kernel_size_ * this->kernel_size_,
+            this->height_col_,
+            this->width_col_);
+
+    this->blob_top_cpu_->Reshape(this->blob_bottom_->num(),
+            this->channels_ * this->kernel_size_ * this->kernel_size_,
+            this->height_col_,
+            this->width_col_);
+
+    const Dtype* bottom_data = this->blob_bottom_->gpu_data();
+    Dtype* top_data = this->blob_top_->mutable_gpu_data();
+    Dtype* cpu_data = this->blob_top_cpu_->mutable_cpu_data();
+
+    // CPU Version
+    for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+      im2col_cpu(this->blob_bottom_->cpu_data() + this->blob_bottom_->offset(n),
+        this->channels_, this->height_, this->width_,
+        this->kernel_size_, this->kernel_size_, this->pad_, this->pad_,
+        this->stride_, this->stride_,
+        cpu_data + this->blob_top_cpu_->offset(n));
+    }
+
+    // GPU version
+    int num_kernels = this->channels_ * this->height_col_ * this->width_col_;
+    int default_grid_dim = CAFFE_GET_BLOCKS(num_kernels);
+
+    // Launch with different grid sizes
+    for (int grid_div = 2; grid_div <= 8; grid_div++) {
+      for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+        int grid_dim = default_grid_dim/grid_div;
+        // NOLINT_NEXT_LINE(whitespace/operators)
+        im2col_gpu_kernel<Dtype><<<grid_dim, CAFFE_CUDA_NUM_THREADS>>>(
+          num_kernels, bottom_data + this->blob_bottom_->offset(n),
+          this->height_, this->width_, this->kernel_size_, this->kernel_size_,
+          this->pad_, this->pad_, this->stride_, this->stride_,
+          this->height_col_, this->width_col_,
+          top_data + this->blob_top_->offset(n));
+        CUDA_POST_KERNEL_CHECK;
+      }
+
+      // Compare results against CPU version
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        Dtype cpuval = cpu_data[i];
+        Dtype gpuval = this->blob_top_->cpu_data()[i];
+        EXPECT_EQ(cpuval, gpuval);
+        if (cpuval != gpuval) {
+          break;
+        }
+      }
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_;
   Blob<Dtype>* const blob_top_;
   Blob<Dtype>* const blob_top_cpu_;
@@ -68,60 +131,18 @@ class Im2colKernelTest : public ::testing::Test {
 TYPED_TEST_CASE(Im2colKernelTest, TestDtypes);
 
 TYPED_TEST(Im2colKernelTest, TestGPU) {
-  Caffe::set_mode(Caffe::GPU);
-
-  // Reshape the blobs to correct size for im2col output
-  this->blob_top_->Reshape(this->blob_bottom_->num(),
-          this->channels_ * this->kernel_size_ * this->kernel_size_,
-          this->height_col_,
-          this->width_col_);
-
-  this->blob_top_cpu_->Reshape(this->blob_bottom_->num(),
-          this->channels_ * this->kernel_size_ * this->kernel_size_,
-          this->height_col_,
-          this->width_col_);
-
-  const TypeParam* bottom_data = this->blob_bottom_->gpu_data();
-  TypeParam* top_data = this->blob_top_->mutable_gpu_data();
-  TypeParam* cpu_data = this->blob_top_cpu_->mutable_cpu_data();
-
-  // CPU Version
-  for (int n = 0; n < this->blob_bottom_->num(); ++n) {
-    im2col_cpu(this->blob_bottom_->cpu_data() + this->blob_bottom_->offset(n),
-      this->channels_, this->height_, this->width_,
-      this->kernel_size_, this->kernel_size_, this->pad_, this->pad_,
-      this->stride_, this->stride_,
-      cpu_data + this->blob_top_cpu_->offset(n));
-  }
-
-  // GPU version
-  int num_kernels = this->channels_ * this->height_col_ * this->width_col_;
-  int default_grid_dim = CAFFE_GET_BLOCKS(num_kernels);
+  this->CompareGPUToCPU();
+}
 
-  // Launch with different grid sizes
-  for (int grid_div = 2; grid_div <= 8; grid_div++) {
-    for (int n = 0; n < this->blob_bottom_->num(); ++n) {
-      int grid_dim = default_grid_dim/grid_div;
-      // NOLINT_NEXT_LINE(whitespace/operators)
-      im2col_gpu_kernel<TypeParam><<<grid_dim, CAFFE_CUDA_NUM_THREADS>>>(
-        num_kernels, bottom_data + this->blob_bottom_->offset(n),
-        this->height_, this->width_, this->kernel_size_, this->kernel_size_,
-        this->pad_, this->pad_, this->stride_, this->stride_,
-        this->height_col_, this->width_col_,
-        top_data + this->blob_top_->offset(n));
-      CUDA_POST_KERNEL_CHECK;
-    }
+TYPED_TEST(Im2colKernelTest, TestGPUPadStride1) {
+  // Covers the stride 1 row copy path of im2col_cpu, with padding.
+  this->SetGeometry(1, 1);
+  this->CompareGPUToCPU();
+}
 
-    // Compare results against CPU version
-    for (int i = 0; i < this->blob_top_->count(); ++i) {
-      TypeParam cpuval = cpu_data[i];
-      TypeParam gpuval = this->blob_top_->cpu_data()[i];
-      EXPECT_EQ(cpuval, gpuval);
-      if (cpuval != gpuval) {
-        break;
-      }
-    }
-  }
+TYPED_TEST(Im2colKernelTest, TestGPUPadStride2) {
+  this->SetGeometry(2, 2);
+  this->CompareGPUToCPU();
 }
 
 }  // namespace caffe
@@ -110,4 +110,65 @@ TYPED_TEST(InnerProductLayerTest, TestGradient) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestQuantizedForward) {
+  // The int8 forward pass of the TEST phase stays close to the float one.
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  // The bottom is uniform in [0, 1].
+  layer_param.mutable_quantization_param()->set_input_scale(1. / 127);
+  InnerProductLayer<Dtype> quantized_layer(layer_param);
+  quantized_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    quantized_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  quantized_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i], 0.2);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(InnerProductLayerTest, TestQuantizedForwardDropFloatWeights) {
+  // Freeing the float weights leaves the int8 forward pass as it was.
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  layer_param.mutable_quantization_param()->set_input_scale(1. / 127);
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  layer_param.mutable_quantization_param()->set_drop_float_weights(true);
+  InnerProductLayer<Dtype> dropping_layer(layer_param);
+  dropping_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    dropping_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  for (int iter = 0; iter < 2; ++iter) {
+    dropping_layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    EXPECT_EQ(0, dropping_layer.blobs()[0]->count());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_EQ(expected.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+    }
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
 }  // namespace caffe
@@ -1,6 +1,7 @@
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
+#include "caffe/data_layers.hpp"
 #include "caffe/internal_thread.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -19,5 +20,45 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+// Spins until it is asked to stop.
+class LoopingThread : public InternalThread {
+ public:
+  LoopingThread() : iterations_(0) {}
+  int iterations_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    while (!must_stop()) {
+      ++iterations_;
+    }
+  }
+};
+
+TEST_F(InternalThreadTest, TestStopLoopingThread) {
+  LoopingThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.is_started());
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+}
+
+// Pops from an empty queue, so it can only exit by being interrupted.
+class BlockedThread : public InternalThread {
+ public:
+  BlockingQueue<Batch<float>*> queue_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    queue_.pop();
+  }
+};
+
+TEST_F(InternalThreadTest, TestStopBlockedThread) {
+  BlockedThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+}
+
 }  // namespace caffe
 
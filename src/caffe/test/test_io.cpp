@@ -0,0 +1,85 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class IOTest : public ::testing::Test {};
+
+TEST_F(IOTest, TestParseDatumHeaderUint8) {
+  Datum datum;
+  datum.set_channels(2);
+  datum.set_height(3);
+  datum.set_width(4);
+  datum.set_label(7);
+  string pixels;
+  for (int i = 0; i < 24; ++i) {
+    pixels.push_back(static_cast<char>(i * 10));
+  }
+  datum.set_data(pixels);
+  const string serialized = datum.SerializeAsString();
+
+  Datum header;
+  const char* data;
+  int data_size;
+  EXPECT_TRUE(ParseDatumHeaderFromArray(serialized.data(), serialized.size(),
+      &header, &data, &data_size));
+  EXPECT_EQ(2, header.channels());
+  EXPECT_EQ(3, header.height());
+  EXPECT_EQ(4, header.width());
+  EXPECT_EQ(7, header.label());
+  EXPECT_EQ(0, header.data().size());
+  // The pixels are not copied but point into the serialized buffer.
+  ASSERT_EQ(24, data_size);
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+  EXPECT_EQ(pixels, string(data, data_size));
+}
+
+TEST_F(IOTest, TestParseDatumHeaderFloat) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(3);
+  datum.set_label(1);
+  for (int i = 0; i < 3; ++i) {
+    datum.add_float_data(i * 0.5);
+  }
+  const string serialized = datum.SerializeAsString();
+
+  Datum header;
+  const char* data;
+  int data_size;
+  EXPECT_TRUE(ParseDatumHeaderFromArray(serialized.data(), serialized.size(),
+      &header, &data, &data_size));
+  EXPECT_TRUE(data == NULL);
+  EXPECT_EQ(0, data_size);
+  EXPECT_EQ(1, header.label());
+  ASSERT_EQ(3, header.float_data_size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i * 0.5, header.float_data(i));
+  }
+}
+
+TEST_F(IOTest, TestParseDatumHeaderTruncated) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(8);
+  datum.set_data(string(8, 'x'));
+  const string serialized = datum.SerializeAsString();
+
+  Datum header;
+  const char* data;
+  int data_size;
+  EXPECT_FALSE(ParseDatumHeaderFromArray(serialized.data(),
+      serialized.size() - 1, &header, &data, &data_size));
+}
+
+}  // namespace caffe
@@ -1,8 +1,10 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -144,6 +146,81 @@ TYPED_TEST(MathFunctionsTest, TestCopyCPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestElementwiseMultithreadedCPU) {
+  // Splitting element-wise kernels over threads must not change any result.
+  const int n = this->blob_bottom_->count();
+  const TypeParam* a = this->blob_bottom_->cpu_data();
+  const TypeParam* b = this->blob_top_->cpu_data();
+  vector<TypeParam> serial(n * 6);
+  vector<TypeParam> threaded(n * 6);
+  vector<TypeParam>* outputs[] = { &serial, &threaded };
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_cpu_threads(run ? 3 : 1);
+    Caffe::set_cpu_grain_size(run ? 1000 : 1 << 15);
+    TypeParam* y = &(*outputs[run])[0];
+    caffe_add(n, a, b, y);
+    caffe_mul(n, a, b, y + n);
+    caffe_exp(n, a, y + 2 * n);
+    caffe_powx(n, b, TypeParam(2), y + 3 * n);
+    caffe_copy(n, b, y + 4 * n);
+    caffe_cpu_axpby(n, TypeParam(0.5), a, TypeParam(-2), y + 4 * n);
+    caffe_set(n, TypeParam(3), y + 5 * n);
+    caffe_add_scalar(n, TypeParam(-1), y + 5 * n);
+  }
+  Caffe::set_cpu_grain_size(1 << 15);
+  Caffe::set_cpu_threads(0);
+  for (int i = 0; i < serial.size(); ++i) {
+    EXPECT_EQ(serial[i], threaded[i]) << "index " << i;
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestQuantizeS8CPU) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam scale = 0.01;
+  vector<int8_t> y(n);
+  caffe_cpu_quantize_s8(n, x, scale, &y[0]);
+  for (int i = 0; i < n; ++i) {
+    const TypeParam expected =
+        std::min(TypeParam(127), std::max(TypeParam(-127), x[i] / scale));
+    EXPECT_NEAR(expected, y[i], 0.5 + 1e-4) << "index " << i;
+  }
+}
+
+TEST(GemmS8Test, TestGemmS8CPU) {
+  // Every SIMD level, and splitting over threads, gives the exact products.
+  const int M = 7;
+  const int N = 150;
+  const int K = 1037;
+  vector<int8_t> A(M * K);
+  vector<int8_t> B(N * K);
+  unsigned int seed = 1701;
+  for (int i = 0; i < A.size(); ++i) {
+    A[i] = rand_r(&seed) % 255 - 127;
+  }
+  for (int i = 0; i < B.size(); ++i) {
+    B[i] = rand_r(&seed) % 255 - 127;
+  }
+  vector<int32_t> expected(M * N, 0);
+  for (int i = 0; i < M; ++i) {
+    for (int j = 0; j < N; ++j) {
+      for (int k = 0; k < K; ++k) {
+        expected[i * N + j] += A[i * K + k] * B[j * K + k];
+      }
+    }
+  }
+  const SimdLevel levels[] = { SIMD_NONE, SIMD_SSE2, SIMD_AVX2 };
+  Caffe::set_cpu_threads(3);
+  for (int l = 0; l < 3; ++l) {
+    vector<int32_t> C(M * N);
+    caffe_cpu_gemm_s8(M, N, K, &A[0], &B[0], &C[0], levels[l]);
+    for (int i = 0; i < C.size(); ++i) {
+      EXPECT_EQ(expected[i], C[i]) << "level " << levels[l] << " index " << i;
+    }
+  }
+  Caffe::set_cpu_threads(0);
+}
+
 #ifndef CPU_ONLY
 
 // TODO: Fix caffe_gpu_hamming_distance and re-enable this test.
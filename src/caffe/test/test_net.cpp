@@ -534,7 +534,7 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitReshapableNet() {
+  virtual void InitReshapableNet(const string& net_options = "") {
     const string& proto =
         "name: 'ReshapableNetwork' "
         "input: 'data' "
@@ -592,10 +592,440 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  type: SOFTMAX "
         "  bottom: 'norm1' "
         "  top: 'softmax' "
+        "} " + net_options;
+    InitNetFromProtoString(proto);
+  }
+
+  // The last blob is larger than the first, whose memory it can reuse.
+  virtual void InitWideningNet(const string& net_options = "") {
+    const string& proto =
+        "name: 'WideningNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 4 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 2 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'prob' "
+        "  type: SOFTMAX "
+        "  bottom: 'ip3' "
+        "  top: 'prob' "
+        "} " + net_options;
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitActivationsNet(const bool fuse_activations) {
+    string proto =
+        "name: 'ActivationsNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 6 "
+        "input_dim: 5 "
+        "input: 'label' "
+        "input_dim: 2 "
+        "input_dim: 4 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'conv' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu' "
+        "  type: RELU "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "  relu_param { "
+        "    negative_slope: 0.1 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'conv' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'sigmoid' "
+        "  type: SIGMOID "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'tanh' "
+        "  type: TANH "
+        "  bottom: 'ip2' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'power' "
+        "  type: POWER "
+        "  bottom: 'ip2' "
+        "  top: 'ip2' "
+        "  power_param { "
+        "    scale: 2 "
+        "    shift: 0.5 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip2' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} "
+        "force_backward: true ";
+    if (!fuse_activations) {
+      proto += "fuse_activations: false ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitInferenceNet(const bool optimize_inference) {
+    string proto =
+        "name: 'InferenceNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 6 "
+        "input_dim: 5 "
+        "state: { phase: TEST } "
+        "layers: { "
+        "  name: 'conv' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'drop1' "
+        "  type: DROPOUT "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "} "
+        "layers: { "
+        "  name: 'power1' "
+        "  type: POWER "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "  power_param { "
+        "    scale: 2 "
+        "    shift: 1 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'power2' "
+        "  type: POWER "
+        "  bottom: 'conv' "
+        "  top: 'scaled' "
+        "  power_param { "
+        "    scale: 0.5 "
+        "    shift: -0.25 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu' "
+        "  type: RELU "
+        "  bottom: 'scaled' "
+        "  top: 'scaled' "
+        "} "
+        "layers: { "
+        "  name: 'ip' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'scaled' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'drop2' "
+        "  type: DROPOUT "
+        "  bottom: 'ip' "
+        "  top: 'out' "
+        "} "
+        "layers: { "
+        "  name: 'silence' "
+        "  type: SILENCE "
+        "  bottom: 'data' "
         "} ";
+    if (optimize_inference) {
+      proto += "optimize_inference: true ";
+    }
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitDenseNet(const bool fully_convolutional) {
+    string proto =
+        "name: 'DenseNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 4 "
+        "input_dim: 4 "
+        "layers: { "
+        "  name: 'conv' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu' "
+        "  type: RELU "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'conv' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip1_relu' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'prob' "
+        "  type: SOFTMAX "
+        "  bottom: 'ip2' "
+        "  top: 'prob' "
+        "} ";
+    if (fully_convolutional) {
+      proto += "fully_convolutional: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitCheckpointNet(const string& net_options = "") {
+    const string& proto =
+        "name: 'CheckpointNetwork' "
+        "input: 'data' "
+        "input_dim: 4 "
+        "input_dim: 3 "
+        "input_dim: 6 "
+        "input_dim: 6 "
+        "input: 'label' "
+        "input_dim: 4 "
+        "input_dim: 3 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'conv1' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 5 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layers: { "
+        "  name: 'drop1' "
+        "  type: DROPOUT "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layers: { "
+        "  name: 'conv2' "
+        "  type: CONVOLUTION "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'drop2' "
+        "  type: DROPOUT "
+        "  bottom: 'conv2' "
+        "  top: 'drop2' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'drop2' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 100 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'sigmoid' "
+        "  type: SIGMOID "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.5 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: EUCLIDEAN_LOSS "
+        "  bottom: 'ip2' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} "
+        "force_backward: true ";
+    InitNetFromProtoString(proto + net_options);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -1184,6 +1614,388 @@ TYPED_TEST(NetTest, TestFromTo) {
   }
 }
 
+TYPED_TEST(NetTest, TestFuseActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  vector<shared_ptr<Blob<Dtype> > > inputs(2);
+  inputs[0].reset(new Blob<Dtype>(2, 3, 6, 5));
+  inputs[1].reset(new Blob<Dtype>(2, 4, 1, 1));
+  filler.Fill(inputs[0].get());
+  filler.Fill(inputs[1].get());
+  Dtype loss[2];
+  vector<shared_ptr<Blob<Dtype> > > blobs[2];
+  vector<shared_ptr<Blob<Dtype> > > params[2];
+  for (int fuse = 0; fuse < 2; ++fuse) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitActivationsNet(fuse);
+    // The ReLU is fused into conv, the Sigmoid into ip1 and the TanH into
+    // ip2; the Power layer no longer follows an inner product.
+    EXPECT_EQ(fuse ? 5 : 8, this->net_->layers().size());
+    // The fused activations are found as the layers they were fused into.
+    EXPECT_TRUE(this->net_->has_layer("relu"));
+    EXPECT_TRUE(this->net_->has_layer("sigmoid"));
+    EXPECT_TRUE(this->net_->has_layer("tanh"));
+    EXPECT_TRUE(this->net_->has_layer("power"));
+    EXPECT_EQ(fuse, this->net_->layer_by_name("relu") ==
+              this->net_->layer_by_name("conv"));
+    EXPECT_EQ(fuse, this->net_->layer_by_name("sigmoid") ==
+              this->net_->layer_by_name("ip1"));
+    EXPECT_EQ(fuse, this->net_->layer_by_name("tanh") ==
+              this->net_->layer_by_name("ip2"));
+    for (int i = 0; i < inputs.size(); ++i) {
+      this->net_->input_blobs()[i]->CopyFrom(*inputs[i]);
+    }
+    loss[fuse] = this->net_->ForwardBackward(this->net_->input_blobs());
+    this->CopyNetBlobs(true, &blobs[fuse]);
+    this->CopyNetParams(true, &params[fuse]);
+  }
+  const Dtype kErrorMargin = 1e-5;
+  EXPECT_NEAR(loss[0], loss[1], kErrorMargin);
+  // The fused net has the same blobs, and the data of its activated tops
+  // and the diffs of its inputs and parameters match those of the unfused
+  // one.
+  ASSERT_EQ(blobs[0].size(), blobs[1].size());
+  for (int i = 0; i < blobs[0].size(); ++i) {
+    ASSERT_EQ(blobs[0][i]->count(), blobs[1][i]->count());
+    for (int j = 0; j < blobs[0][i]->count(); ++j) {
+      EXPECT_NEAR(blobs[0][i]->cpu_data()[j], blobs[1][i]->cpu_data()[j],
+                  kErrorMargin);
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < blobs[0][i]->count(); ++j) {
+      EXPECT_NEAR(blobs[0][i]->cpu_diff()[j], blobs[1][i]->cpu_diff()[j],
+                  kErrorMargin);
+    }
+  }
+  ASSERT_EQ(params[0].size(), params[1].size());
+  for (int i = 0; i < params[0].size(); ++i) {
+    ASSERT_EQ(params[0][i]->count(), params[1][i]->count());
+    for (int j = 0; j < params[0][i]->count(); ++j) {
+      EXPECT_NEAR(params[0][i]->cpu_data()[j], params[1][i]->cpu_data()[j],
+                  kErrorMargin);
+      EXPECT_NEAR(params[0][i]->cpu_diff()[j], params[1][i]->cpu_diff()[j],
+                  kErrorMargin);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestOptimizeInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 6, 5);
+  filler.Fill(&data);
+  // Dropout layers read the phase from Caffe rather than from the net.
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_random_seed(this->seed_);
+  this->InitInferenceNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  // The eight layers and the split of data between conv and silence.
+  EXPECT_EQ(9, reference_net->layers().size());
+  reference_net->input_blobs()[0]->CopyFrom(data);
+  reference_net->ForwardPrefilled();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*reference_net->blob_by_name("out"), false, true);
+  NetParameter weights;
+  reference_net->ToProto(&weights);
+
+  // Dropout and Silence layers go, power1 is merged into power2, which is
+  // folded into conv, and relu is then fused into conv. drop2 renames the
+  // top of ip to its own.
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitInferenceNet(true);
+  ASSERT_EQ(2, this->net_->layers().size());
+  EXPECT_EQ("conv", this->net_->layer_names()[0]);
+  EXPECT_EQ("ip", this->net_->layer_names()[1]);
+  EXPECT_TRUE(this->net_->has_blob("scaled"));
+  EXPECT_TRUE(this->net_->has_blob("out"));
+  EXPECT_FALSE(this->net_->has_blob("ip"));
+
+  // The optimized net computes the same outputs with weights loaded from the
+  // unoptimized one, shared with it, or saved from an optimized net.
+  const Dtype kErrorMargin = 1e-5;
+  for (int source = 0; source < 3; ++source) {
+    if (source == 0) {
+      this->net_->CopyTrainedLayersFrom(weights);
+    } else if (source == 1) {
+      Caffe::set_random_seed(this->seed_ + 1);
+      this->InitInferenceNet(true);
+      this->net_->ShareTrainedLayersWith(reference_net.get());
+    } else {
+      NetParameter optimized;
+      this->net_->ToProto(&optimized);
+      optimized.add_input_dim(data.num());
+      optimized.add_input_dim(data.channels());
+      optimized.add_input_dim(data.height());
+      optimized.add_input_dim(data.width());
+      optimized.mutable_state()->set_phase(TEST);
+      this->net_.reset(new Net<Dtype>(optimized));
+    }
+    this->net_->input_blobs()[0]->CopyFrom(data);
+    this->net_->ForwardPrefilled();
+    const Blob<Dtype>* out = this->net_->blob_by_name("out").get();
+    ASSERT_EQ(expected.count(), out->count());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], out->cpu_data()[i], kErrorMargin)
+          << "source " << source;
+    }
+  }
+  // Sharing folded weights copies them, leaving the reference ones intact.
+  reference_net->ForwardPrefilled();
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i],
+              reference_net->blob_by_name("out")->cpu_data()[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestFullyConvolutional) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 5, 6);
+  filler.Fill(&data);
+  Caffe::set_random_seed(this->seed_);
+  this->InitDenseNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  NetParameter weights;
+  reference_net->ToProto(&weights);
+
+  // ip1 spans the 2x2 conv output and ip2 the 1x1 output of ip1.
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitDenseNet(true);
+  const shared_ptr<Layer<Dtype> > ip1 = this->net_->layer_by_name("ip1");
+  EXPECT_EQ(LayerParameter_LayerType_CONVOLUTION, ip1->layer_param().type());
+  EXPECT_EQ(2, ip1->layer_param().convolution_param().kernel_h());
+  EXPECT_EQ(2, ip1->layer_param().convolution_param().kernel_w());
+  // Only the Caffe engine applies the activation fused into ip1.
+  EXPECT_EQ("ip1_relu", ip1->layer_param().fused_activation().name());
+  EXPECT_EQ(ConvolutionParameter_Engine_CAFFE,
+            ip1->layer_param().convolution_param().engine());
+  this->net_->CopyTrainedLayersFrom(weights);
+
+  // Over the 5x6 data the dense net gives the probabilities of each of the
+  // 2x3 windows of the input size the reference net classifies.
+  Blob<Dtype>* input = this->net_->input_blobs()[0];
+  input->ReshapeLike(data);
+  input->CopyFrom(data);
+  this->net_->Reshape();
+  this->net_->ForwardPrefilled();
+  const Blob<Dtype>* prob = this->net_->blob_by_name("prob").get();
+  ASSERT_EQ(2, prob->num());
+  ASSERT_EQ(3, prob->channels());
+  ASSERT_EQ(2, prob->height());
+  ASSERT_EQ(3, prob->width());
+  const Dtype kErrorMargin = 1e-5;
+  Blob<Dtype>* window = reference_net->input_blobs()[0];
+  for (int h = 0; h < prob->height(); ++h) {
+    for (int w = 0; w < prob->width(); ++w) {
+      for (int n = 0; n < window->num(); ++n) {
+        for (int c = 0; c < window->channels(); ++c) {
+          for (int y = 0; y < window->height(); ++y) {
+            caffe_copy(window->width(), data.cpu_data() +
+                data.offset(n, c, h + y, w),
+                window->mutable_cpu_data() + window->offset(n, c, y));
+          }
+        }
+      }
+      reference_net->ForwardPrefilled();
+      const Blob<Dtype>* expected = reference_net->blob_by_name("prob").get();
+      for (int n = 0; n < prob->num(); ++n) {
+        for (int c = 0; c < prob->channels(); ++c) {
+          EXPECT_NEAR(expected->data_at(n, c, 0, 0),
+                      prob->data_at(n, c, h, w), kErrorMargin)
+              << "window " << h << ", " << w;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareTrainedLayersFullyConvolutional) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDenseNet(false);
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitDenseNet(true);
+  this->net_->ShareTrainedLayersWith(reference_net.get());
+  // ip1 shares the InnerProduct weights in its Convolution shape.
+  const Blob<Dtype>* expected =
+      reference_net->layer_by_name("ip1")->blobs()[0].get();
+  const Blob<Dtype>* actual =
+      this->net_->layer_by_name("ip1")->blobs()[0].get();
+  EXPECT_EQ(expected->cpu_data(), actual->cpu_data());
+  EXPECT_EQ(5, actual->num());
+  EXPECT_EQ(4, actual->channels());
+  EXPECT_EQ(2, actual->height());
+  EXPECT_EQ(2, actual->width());
+  // Over the input size of the reference net both nets give the same output.
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(reference_net->input_blobs()[0]);
+  this->net_->input_blobs()[0]->CopyFrom(*reference_net->input_blobs()[0]);
+  reference_net->ForwardPrefilled();
+  this->net_->ForwardPrefilled();
+  const Blob<Dtype>* expected_prob = reference_net->blob_by_name("prob").get();
+  const Blob<Dtype>* prob = this->net_->blob_by_name("prob").get();
+  ASSERT_EQ(expected_prob->count(), prob->count());
+  const Dtype kErrorMargin = 1e-5;
+  for (int i = 0; i < prob->count(); ++i) {
+    EXPECT_NEAR(expected_prob->cpu_data()[i], prob->cpu_data()[i],
+                kErrorMargin);
+  }
+}
+
+TYPED_TEST(NetTest, TestShareBlobMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data[2];
+  data[0].Reshape(2, 3, 20, 17);
+  data[1].Reshape(3, 3, 33, 30);
+  filler.Fill(&data[0]);
+  filler.Fill(&data[1]);
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet();
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  EXPECT_EQ(reference_net->memory_used(),
+            reference_net->planned_memory_used());
+  Caffe::set_random_seed(this->seed_);
+  this->InitReshapableNet(
+      "share_blob_memory: true state: { phase: TEST } keep_blob: 'pool1' ");
+  const size_t planned_memory_used = this->net_->planned_memory_used();
+  EXPECT_LT(planned_memory_used, this->net_->memory_used());
+  // conv1 is dead once pool1 has read it, so norm1 can reuse its memory.
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->cpu_data(),
+            this->net_->blob_by_name("norm1")->cpu_data());
+  // Outputs and kept blobs match the net without shared memory, also after
+  // reshaping the input.
+  const char* kept_blobs[] = { "data", "pool1", "softmax" };
+  for (int i = 0; i < 2; ++i) {
+    shared_ptr<Net<Dtype> > nets[] = { reference_net, this->net_ };
+    for (int j = 0; j < 2; ++j) {
+      nets[j]->input_blobs()[0]->ReshapeLike(data[i]);
+      nets[j]->input_blobs()[0]->CopyFrom(data[i]);
+      nets[j]->Reshape();
+      nets[j]->ForwardPrefilled();
+    }
+    for (int j = 0; j < sizeof(kept_blobs) / sizeof(kept_blobs[0]); ++j) {
+      const Blob<Dtype>* expected =
+          reference_net->blob_by_name(kept_blobs[j]).get();
+      const Blob<Dtype>* actual = this->net_->blob_by_name(kept_blobs[j]).get();
+      ASSERT_EQ(expected->count(), actual->count());
+      for (int k = 0; k < expected->count(); ++k) {
+        EXPECT_EQ(expected->cpu_data()[k], actual->cpu_data()[k])
+            << kept_blobs[j] << " input " << i;
+      }
+    }
+  }
+  // The plan for the original shape doesn't depend on the earlier ones.
+  this->net_->input_blobs()[0]->Reshape(1, 3, 100, 100);
+  this->net_->Reshape();
+  EXPECT_EQ(planned_memory_used, this->net_->planned_memory_used());
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->cpu_data(),
+            this->net_->blob_by_name("norm1")->cpu_data());
+  EXPECT_NE(this->net_->blob_by_name("conv1")->cpu_data(),
+            this->net_->blob_by_name("pool1")->cpu_data());
+  // A buffer is as large as the largest blob using it, also after shrinking.
+  Caffe::set_random_seed(this->seed_);
+  this->InitWideningNet();
+  reference_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitWideningNet("share_blob_memory: true state: { phase: TEST } ");
+  EXPECT_EQ(2 * (8 + 8 + 8), this->net_->planned_memory_used());
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->cpu_data(),
+            this->net_->blob_by_name("ip3")->cpu_data());
+  Blob<Dtype> narrow_data(1, 4, 1, 1);
+  filler.Fill(&narrow_data);
+  shared_ptr<Net<Dtype> > nets[] = { reference_net, this->net_ };
+  for (int i = 0; i < 2; ++i) {
+    nets[i]->input_blobs()[0]->ReshapeLike(narrow_data);
+    nets[i]->input_blobs()[0]->CopyFrom(narrow_data);
+    nets[i]->Reshape();
+    nets[i]->ForwardPrefilled();
+  }
+  EXPECT_EQ(8 + 8 + 8, this->net_->planned_memory_used());
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->cpu_data(),
+            this->net_->blob_by_name("ip3")->cpu_data());
+  const Blob<Dtype>* expected = reference_net->output_blobs()[0];
+  const Blob<Dtype>* actual = this->net_->output_blobs()[0];
+  ASSERT_EQ(expected->count(), actual->count());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_EQ(expected->cpu_data()[i], actual->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestCheckpoint) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TRAIN);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Caffe::set_random_seed(this->seed_);
+  this->InitCheckpointNet();
+  shared_ptr<Net<Dtype> > reference_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitCheckpointNet("checkpoint: 'drop2' ");
+  EXPECT_EQ(2, this->net_->num_segments());
+  const size_t planned_memory_used = this->net_->planned_memory_used();
+  EXPECT_LT(planned_memory_used, this->net_->memory_used());
+  // conv1 and ip1 are the largest dropped blobs of their segments.
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->cpu_data(),
+            this->net_->blob_by_name("ip1")->cpu_data());
+  // Backward recomputes conv1 and conv2, and must see the same dropout masks
+  // as the forward pass.
+  const Dtype kErrorMargin = 1e-5;
+  for (int iter = 0; iter < 2; ++iter) {
+    Blob<Dtype> data(4, 3, 6, 6);
+    Blob<Dtype> label(4, 3, 1, 1);
+    filler.Fill(&data);
+    filler.Fill(&label);
+    Dtype loss[2];
+    shared_ptr<Net<Dtype> > nets[] = { reference_net, this->net_ };
+    for (int i = 0; i < 2; ++i) {
+      nets[i]->input_blobs()[0]->CopyFrom(data);
+      nets[i]->input_blobs()[1]->CopyFrom(label);
+      Caffe::set_random_seed(this->seed_ + iter);
+      loss[i] = nets[i]->ForwardBackward(nets[i]->input_blobs());
+    }
+    EXPECT_NEAR(loss[0], loss[1], kErrorMargin);
+    const vector<shared_ptr<Blob<Dtype> > >& expected = reference_net->params();
+    const vector<shared_ptr<Blob<Dtype> > >& actual = this->net_->params();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      for (int j = 0; j < expected[i]->count(); ++j) {
+        EXPECT_NEAR(expected[i]->cpu_diff()[j], actual[i]->cpu_diff()[j],
+                    kErrorMargin) << "param " << i << " iteration " << iter;
+      }
+    }
+    const Blob<Dtype>* expected_data = reference_net->input_blobs()[0];
+    const Blob<Dtype>* actual_data = this->net_->input_blobs()[0];
+    for (int j = 0; j < expected_data->count(); ++j) {
+      EXPECT_NEAR(expected_data->cpu_diff()[j], actual_data->cpu_diff()[j],
+                  kErrorMargin) << "iteration " << iter;
+    }
+  }
+  // Halving the batch halves every blob but the loss, and ip1, which is larger
+  // than conv1, still fits the buffer they share.
+  this->net_->input_blobs()[0]->Reshape(2, 3, 6, 6);
+  this->net_->input_blobs()[1]->Reshape(2, 3, 1, 1);
+  this->net_->Reshape();
+  EXPECT_EQ((planned_memory_used - 1) / 2 + 1,
+            this->net_->planned_memory_used());
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->cpu_data(),
+            this->net_->blob_by_name("ip1")->cpu_data());
+}
+
 class FilterNetTest : public ::testing::Test {
  protected:
   void RunFilterNetTest(
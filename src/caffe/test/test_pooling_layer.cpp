@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <vector>
 
@@ -42,6 +44,82 @@ class PoolingLayerTest : public MultiDeviceTest<TypeParam> {
   Blob<Dtype>* const blob_top_mask_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
+
+  // Pools bottom by KxK windows of stride 2 with the straightforward loops,
+  // and checks that the layer's forward outputs, top mask (for MAX) and
+  // backward diff agree.
+  void TestStride2Kernel(const int kernel_size,
+      const PoolingParameter_PoolMethod pool, Blob<Dtype>* bottom) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(kernel_size);
+    pooling_param->set_stride(2);
+    pooling_param->set_pool(pool);
+    const bool is_max = pool == PoolingParameter_PoolMethod_MAX;
+    vector<Blob<Dtype>*> bottom_vec(1, bottom);
+    vector<Blob<Dtype>*> top_vec(1, blob_top_);
+    if (is_max) {
+      top_vec.push_back(blob_top_mask_);
+    }
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, &top_vec);
+    layer.Forward(bottom_vec, &top_vec);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_top_);
+    caffe_copy(blob_top_->count(), blob_top_->cpu_data(),
+               blob_top_->mutable_cpu_diff());
+    layer.Forward(bottom_vec, &top_vec);
+    layer.Backward(top_vec, vector<bool>(1, true), &bottom_vec);
+    const int height = bottom->height();
+    const int width = bottom->width();
+    const int pooled_height = blob_top_->height();
+    const int pooled_width = blob_top_->width();
+    vector<Dtype> bottom_diff(bottom->count(), 0);
+    for (int n = 0; n < bottom->num(); ++n) {
+      for (int c = 0; c < bottom->channels(); ++c) {
+        const Dtype* in = bottom->cpu_data() + bottom->offset(n, c);
+        Dtype* diff = &bottom_diff[bottom->offset(n, c)];
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            const int hend = std::min(ph * 2 + kernel_size, height);
+            const int wend = std::min(pw * 2 + kernel_size, width);
+            Dtype max_value = -FLT_MAX;
+            int max_index = -1;
+            Dtype sum = 0;
+            for (int h = ph * 2; h < hend; ++h) {
+              for (int w = pw * 2; w < wend; ++w) {
+                sum += in[h * width + w];
+                if (in[h * width + w] > max_value) {
+                  max_value = in[h * width + w];
+                  max_index = h * width + w;
+                }
+              }
+            }
+            const int pool_size = (hend - ph * 2) * (wend - pw * 2);
+            const int top_index = blob_top_->offset(n, c, ph, pw);
+            const Dtype top_diff = blob_top_->cpu_diff()[top_index];
+            if (is_max) {
+              EXPECT_EQ(max_value, blob_top_->cpu_data()[top_index]);
+              EXPECT_EQ(max_index, blob_top_mask_->cpu_data()[top_index]);
+              diff[max_index] += top_diff;
+            } else {
+              EXPECT_EQ(sum / pool_size, blob_top_->cpu_data()[top_index]);
+              for (int h = ph * 2; h < hend; ++h) {
+                for (int w = pw * 2; w < wend; ++w) {
+                  diff[h * width + w] += top_diff / pool_size;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    for (int i = 0; i < bottom->count(); ++i) {
+      EXPECT_EQ(bottom_diff[i], bottom->cpu_diff()[i]);
+    }
+  }
+
   // Test for 2x 2 square pooling layer
   void TestForwardSquare() {
     LayerParameter layer_param;
@@ -592,6 +670,40 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestStride2Kernels) {
+  // Odd sizes leave partial windows at the bottom and right edges, and rows
+  // wide enough for the vectorized kernels.
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(2, 3, 9, 21);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  for (int kernel_size = 2; kernel_size <= 3; ++kernel_size) {
+    this->TestStride2Kernel(kernel_size, PoolingParameter_PoolMethod_MAX,
+                            &bottom);
+    this->TestStride2Kernel(kernel_size, PoolingParameter_PoolMethod_AVE,
+                            &bottom);
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestMultithreaded) {
+  // A bottom large enough for the planes to be split over
+  // Caffe::cpu_threads().
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(2, 16, 33, 35);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  Caffe::set_cpu_threads(3);
+  for (int kernel_size = 2; kernel_size <= 3; ++kernel_size) {
+    this->TestStride2Kernel(kernel_size, PoolingParameter_PoolMethod_MAX,
+                            &bottom);
+    this->TestStride2Kernel(kernel_size, PoolingParameter_PoolMethod_AVE,
+                            &bottom);
+  }
+  Caffe::set_cpu_threads(0);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public ::testing::Test {
@@ -620,6 +732,82 @@ class CuDNNPoolingLayerTest : public ::testing::Test {
   Blob<Dtype>* const blob_top_mask_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
+
+  // Pools bottom by KxK windows of stride 2 with the straightforward loops,
+  // and checks that the layer's forward outputs, top mask (for MAX) and
+  // backward diff agree.
+  void TestStride2Kernel(const int kernel_size,
+      const PoolingParameter_PoolMethod pool, Blob<Dtype>* bottom) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(kernel_size);
+    pooling_param->set_stride(2);
+    pooling_param->set_pool(pool);
+    const bool is_max = pool == PoolingParameter_PoolMethod_MAX;
+    vector<Blob<Dtype>*> bottom_vec(1, bottom);
+    vector<Blob<Dtype>*> top_vec(1, blob_top_);
+    if (is_max) {
+      top_vec.push_back(blob_top_mask_);
+    }
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, &top_vec);
+    layer.Forward(bottom_vec, &top_vec);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_top_);
+    caffe_copy(blob_top_->count(), blob_top_->cpu_data(),
+               blob_top_->mutable_cpu_diff());
+    layer.Forward(bottom_vec, &top_vec);
+    layer.Backward(top_vec, vector<bool>(1, true), &bottom_vec);
+    const int height = bottom->height();
+    const int width = bottom->width();
+    const int pooled_height = blob_top_->height();
+    const int pooled_width = blob_top_->width();
+    vector<Dtype> bottom_diff(bottom->count(), 0);
+    for (int n = 0; n < bottom->num(); ++n) {
+      for (int c = 0; c < bottom->channels(); ++c) {
+        const Dtype* in = bottom->cpu_data() + bottom->offset(n, c);
+        Dtype* diff = &bottom_diff[bottom->offset(n, c)];
+        for (int ph = 0; ph < pooled_height; ++ph) {
+          for (int pw = 0; pw < pooled_width; ++pw) {
+            const int hend = std::min(ph * 2 + kernel_size, height);
+            const int wend = std::min(pw * 2 + kernel_size, width);
+            Dtype max_value = -FLT_MAX;
+            int max_index = -1;
+            Dtype sum = 0;
+            for (int h = ph * 2; h < hend; ++h) {
+              for (int w = pw * 2; w < wend; ++w) {
+                sum += in[h * width + w];
+                if (in[h * width + w] > max_value) {
+                  max_value = in[h * width + w];
+                  max_index = h * width + w;
+                }
+              }
+            }
+            const int pool_size = (hend - ph * 2) * (wend - pw * 2);
+            const int top_index = blob_top_->offset(n, c, ph, pw);
+            const Dtype top_diff = blob_top_->cpu_diff()[top_index];
+            if (is_max) {
+              EXPECT_EQ(max_value, blob_top_->cpu_data()[top_index]);
+              EXPECT_EQ(max_index, blob_top_mask_->cpu_data()[top_index]);
+              diff[max_index] += top_diff;
+            } else {
+              EXPECT_EQ(sum / pool_size, blob_top_->cpu_data()[top_index]);
+              for (int h = ph * 2; h < hend; ++h) {
+                for (int w = pw * 2; w < wend; ++w) {
+                  diff[h * width + w] += top_diff / pool_size;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    for (int i = 0; i < bottom->count(); ++i) {
+      EXPECT_EQ(bottom_diff[i], bottom->cpu_diff()[i]);
+    }
+  }
+
   // Test for 2x 2 square pooling layer
   void TestForwardSquare() {
     LayerParameter layer_param;
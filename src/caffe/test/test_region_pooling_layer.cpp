@@ -0,0 +1,143 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RegionPoolingLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RegionPoolingLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 6, 5)),
+        blob_bottom_regions_(new Blob<Dtype>(3, 5, 1, 1)),
+        blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    // Overlapping regions of both images, one hanging off the map.
+    const Dtype regions[] = {0, 0, 0, 4, 5,
+                             1, 1, 2, 3, 4,
+                             0, 2, 3, 7, 8};
+    caffe_copy(blob_bottom_regions_->count(), regions,
+               blob_bottom_regions_->mutable_cpu_data());
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_regions_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~RegionPoolingLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_regions_;
+    delete blob_top_;
+  }
+
+  // Pools a 4x4 map holding 0 ... 15 in row-major order over the regions.
+  void TestForwardRamp(const vector<int>& levels, const Dtype spatial_scale,
+      const vector<Dtype>& regions, const vector<Dtype>& expected) {
+    LayerParameter layer_param;
+    RegionPoolingParameter* region_param =
+        layer_param.mutable_region_pooling_param();
+    for (int l = 0; l < levels.size(); ++l) {
+      region_param->add_pyramid_level(levels[l]);
+    }
+    region_param->set_spatial_scale(spatial_scale);
+    Blob<Dtype> bottom(1, 1, 4, 4);
+    for (int i = 0; i < bottom.count(); ++i) {
+      bottom.mutable_cpu_data()[i] = i;
+    }
+    Blob<Dtype> bottom_regions(regions.size() / 5, 5, 1, 1);
+    caffe_copy(bottom_regions.count(), &regions[0],
+               bottom_regions.mutable_cpu_data());
+    vector<Blob<Dtype>*> bottom_vec;
+    bottom_vec.push_back(&bottom);
+    bottom_vec.push_back(&bottom_regions);
+    RegionPoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, &blob_top_vec_);
+    layer.Forward(bottom_vec, &blob_top_vec_);
+    ASSERT_EQ(expected.size(), blob_top_->count());
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i], blob_top_->cpu_data()[i]) << "bin " << i;
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_regions_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RegionPoolingLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RegionPoolingLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_region_pooling_param()->add_pyramid_level(2);
+  RegionPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 3);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 2);
+  EXPECT_EQ(this->blob_top_->width(), 2);
+  // A pyramid flattens its levels into the channels.
+  layer_param.mutable_region_pooling_param()->add_pyramid_level(1);
+  layer_param.mutable_region_pooling_param()->add_pyramid_level(3);
+  RegionPoolingLayer<Dtype> pyramid_layer(layer_param);
+  pyramid_layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 3);
+  EXPECT_EQ(this->blob_top_->channels(), 3 * (4 + 1 + 9));
+  EXPECT_EQ(this->blob_top_->height(), 1);
+  EXPECT_EQ(this->blob_top_->width(), 1);
+}
+
+TYPED_TEST(RegionPoolingLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> levels(1, 2);
+  // The whole map, then its centre.
+  const Dtype regions[] = {0, 0, 0, 3, 3,
+                           0, 1, 1, 2, 2};
+  const Dtype expected[] = {5, 7, 13, 15,
+                            5, 6, 9, 10};
+  this->TestForwardRamp(levels, 1, vector<Dtype>(regions, regions + 10),
+                        vector<Dtype>(expected, expected + 8));
+}
+
+TYPED_TEST(RegionPoolingLayerTest, TestForwardPyramid) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> levels;
+  levels.push_back(1);
+  levels.push_back(2);
+  // At half scale, (2, 2, 6, 6) covers rows and columns 1 to 3 of the map,
+  // which split into overlapping 2x2 bins at the second level.
+  const Dtype regions[] = {0, 2, 2, 6, 6};
+  const Dtype expected[] = {15,
+                            10, 11, 14, 15};
+  this->TestForwardRamp(levels, 0.5, vector<Dtype>(regions, regions + 5),
+                        vector<Dtype>(expected, expected + 5));
+}
+
+TYPED_TEST(RegionPoolingLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  RegionPoolingParameter* region_param =
+      layer_param.mutable_region_pooling_param();
+  region_param->add_pyramid_level(1);
+  region_param->add_pyramid_level(2);
+  RegionPoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_), 0);
+}
+
+}  // namespace caffe
@@ -0,0 +1,79 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ public:
+  void Increment(vector<int>* counts, int index) {
+    ++(*counts)[index];
+  }
+
+  void IncrementRange(vector<int>* counts, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      ++(*counts)[i];
+    }
+  }
+
+  // Runs a nested job from inside each task of an outer job.
+  void RunNested(ThreadPool* pool, vector<vector<int> >* counts, int index) {
+    pool->Run((*counts)[index].size(), boost::bind(&ThreadPoolTest::Increment,
+        this, &(*counts)[index], _1));
+  }
+};
+
+TEST_F(ThreadPoolTest, TestRunsEveryTaskOnce) {
+  for (int num_threads = 0; num_threads < 4; ++num_threads) {
+    ThreadPool pool(num_threads);
+    EXPECT_EQ(num_threads, pool.num_threads());
+    for (int num_tasks = 0; num_tasks < 20; ++num_tasks) {
+      vector<int> counts(num_tasks, 0);
+      pool.Run(num_tasks, boost::bind(&ThreadPoolTest::Increment, this,
+          &counts, _1));
+      for (int i = 0; i < num_tasks; ++i) {
+        EXPECT_EQ(1, counts[i]) << "threads " << num_threads << " task " << i;
+      }
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNestedRun) {
+  ThreadPool pool(2);
+  vector<vector<int> > counts(5, vector<int>(7, 0));
+  pool.Run(counts.size(), boost::bind(&ThreadPoolTest::RunNested, this,
+      &pool, &counts, _1));
+  for (int i = 0; i < counts.size(); ++i) {
+    for (int j = 0; j < counts[i].size(); ++j) {
+      EXPECT_EQ(1, counts[i][j]);
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestParallelForCoversEachIndexOnce) {
+  Caffe::set_cpu_threads(3);
+  const int grain_sizes[] = { 1, 7, 100, 1 << 15 };
+  for (int g = 0; g < sizeof(grain_sizes) / sizeof(grain_sizes[0]); ++g) {
+    Caffe::set_cpu_grain_size(grain_sizes[g]);
+    for (int n = 0; n < 300; n += 13) {
+      vector<int> counts(n, 0);
+      ParallelFor(n, boost::bind(&ThreadPoolTest::IncrementRange, this,
+          &counts, _1, _2));
+      for (int i = 0; i < n; ++i) {
+        EXPECT_EQ(1, counts[i]) << "grain " << grain_sizes[g] << " n " << n
+            << " index " << i;
+      }
+    }
+  }
+  Caffe::set_cpu_grain_size(1 << 15);
+  Caffe::set_cpu_threads(0);
+}
+
+}  // namespace caffe
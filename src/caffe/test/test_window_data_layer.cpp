@@ -0,0 +1,106 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class WindowDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  WindowDataLayerTest()
+      : seed_(1701),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    Caffe::set_random_seed(seed_);
+    // Image 0 (360 x 480) only has a foreground window and image 1
+    // (323 x 481) only a background one, so every batch reads image 1 for
+    // its background half and then image 0 for its foreground half.
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_;
+    outfile << "# 0\n" EXAMPLES_SOURCE_DIR "images/cat.jpg\n3\n360\n480\n1\n"
+            << "1 1.0 10 10 200 200\n"
+            << "# 1\n" EXAMPLES_SOURCE_DIR "images/fish-bike.jpg\n"
+            << "3\n323\n481\n1\n"
+            << "0 0.0 10 10 200 200\n";
+    outfile.close();
+  }
+
+  virtual ~WindowDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  // Runs iterations batches of 2 background and 2 foreground windows through
+  // a layer caching cache_bytes of images, and checks the labels and the
+  // cache counts. With a single prefetched batch, the thread has loaded
+  // exactly as many batches as were forwarded.
+  void TestCache(const uint64_t cache_bytes, const int iterations,
+                 const uint64_t hits, const uint64_t misses) {
+    LayerParameter param;
+    param.mutable_transform_param()->set_crop_size(32);
+    WindowDataParameter* window_data_param =
+        param.mutable_window_data_param();
+    window_data_param->set_source(filename_.c_str());
+    window_data_param->set_batch_size(4);
+    window_data_param->set_fg_fraction(0.5);
+    window_data_param->set_prefetch(1);
+    window_data_param->set_cache_bytes(cache_bytes);
+    WindowDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 4);
+    EXPECT_EQ(blob_top_data_->channels(), 3);
+    EXPECT_EQ(blob_top_data_->height(), 32);
+    EXPECT_EQ(blob_top_data_->width(), 32);
+    for (int iter = 0; iter < iterations; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(i < 2 ? 0 : 1, blob_top_label_->cpu_data()[i]);
+      }
+    }
+    EXPECT_EQ(hits, layer.cache_hits());
+    EXPECT_EQ(misses, layer.cache_misses());
+  }
+
+  int seed_;
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WindowDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(WindowDataLayerTest, TestCacheAllImages) {
+  // Both images are decoded once and every later window is a hit.
+  this->TestCache(2000000, 3, 10, 2);
+}
+
+TYPED_TEST(WindowDataLayerTest, TestCacheEviction) {
+  // Only one image fits, so each image evicts the other: the first window of
+  // either image misses and the second one hits.
+  this->TestCache(600000, 3, 6, 6);
+}
+
+TYPED_TEST(WindowDataLayerTest, TestCacheTooSmall) {
+  // Images larger than the whole cache are never kept.
+  this->TestCache(1000, 3, 0, 12);
+}
+
+}  // namespace caffe
@@ -0,0 +1,77 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/window_file.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WindowFileTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&text_filename_);
+    MakeTempFilename(&binary_filename_);
+    std::ofstream outfile(text_filename_.c_str());
+    outfile << "# 0\n/images/a.jpg\n3\n480\n640\n3\n"
+            << "1 0.9 10 20 110 220\n"
+            << "0 0.1 0 0 50 50\n"
+            << "2 0.6 30 40 130 240\n"
+            << "# 1\n/images/b.jpg\n3\n100\n200\n1\n"
+            << "3 0.6 1 2 3 4\n";
+  }
+
+  // Checks the windows of the text file above, sorted by overlap.
+  void CheckWindows(const WindowFile& windows) {
+    ASSERT_EQ(2, windows.num_images());
+    EXPECT_EQ(string("/images/a.jpg"), windows.image_path(0));
+    EXPECT_EQ(string("/images/b.jpg"), windows.image_path(1));
+    EXPECT_EQ(3, windows.image_channels(1));
+    EXPECT_EQ(100, windows.image_height(1));
+    EXPECT_EQ(200, windows.image_width(1));
+    ASSERT_EQ(4, windows.num_windows());
+    const int expected_labels[] = { 1, 2, 3, 0 };
+    const int expected_images[] = { 0, 0, 1, 0 };
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_EQ(expected_labels[j], windows.window_label(j));
+      EXPECT_EQ(expected_images[j], windows.window_image(j));
+    }
+    EXPECT_FLOAT_EQ(0.6, windows.window_overlap(1));
+    EXPECT_EQ(30, windows.window_x1(1));
+    EXPECT_EQ(40, windows.window_y1(1));
+    EXPECT_EQ(130, windows.window_x2(1));
+    EXPECT_EQ(240, windows.window_y2(1));
+    EXPECT_EQ(0, windows.CountOverlapAtLeast(0.95));
+    EXPECT_EQ(1, windows.CountOverlapAtLeast(0.7));
+    EXPECT_EQ(3, windows.CountOverlapAtLeast(0.6));
+    EXPECT_EQ(3, windows.CountOverlapAtLeast(0.5));
+    EXPECT_EQ(4, windows.CountOverlapAtLeast(0));
+  }
+
+  string text_filename_;
+  string binary_filename_;
+};
+
+TEST_F(WindowFileTest, TestReadText) {
+  WindowFile windows;
+  windows.Open(text_filename_);
+  this->CheckWindows(windows);
+}
+
+TEST_F(WindowFileTest, TestBinaryRoundTrip) {
+  WindowFile text_windows;
+  text_windows.Open(text_filename_);
+  text_windows.WriteBinary(binary_filename_);
+  WindowFile windows;
+  windows.Open(binary_filename_);
+  this->CheckWindows(windows);
+  // Reopening replaces the mapped file.
+  windows.Open(text_filename_);
+  this->CheckWindows(windows);
+}
+
+}  // namespace caffe
@@ -0,0 +1,28 @@
+#include "caffe/util/cpu_features.hpp"
+
+namespace caffe {
+
+namespace {
+
+SimdLevel DetectSimdLevel() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  // __builtin_cpu_supports also checks that the OS saves the AVX state.
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SIMD_SSE2;
+  }
+#endif
+  return SIMD_NONE;
+}
+
+}  // namespace
+
+SimdLevel CpuSimdLevel() {
+  static const SimdLevel level = DetectSimdLevel();
+  return level;
+}
+
+}  // namespace caffe
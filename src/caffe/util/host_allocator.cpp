@@ -0,0 +1,155 @@
+#include <boost/thread.hpp>
+#include <sys/mman.h>
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+const size_t HostAllocator::kAlignment;
+const size_t HostAllocator::kHugePageSize;
+
+class HostAllocator::sync {
+ public:
+  boost::mutex mutex_;
+};
+
+HostAllocator::HostAllocator()
+    : sync_(new sync()), cache_limit_(1 << 30), huge_pages_(false) {
+  stats_.bytes_in_use = 0;
+  stats_.peak_bytes_in_use = 0;
+  stats_.bytes_cached = 0;
+  stats_.num_allocs = 0;
+  stats_.num_cache_hits = 0;
+}
+
+HostAllocator::~HostAllocator() {
+  ReleaseCache();
+  CHECK(in_use_.empty()) << "Destroying allocator with " << in_use_.size()
+      << " blocks still in use";
+}
+
+HostAllocator* HostAllocator::Get() {
+  // Never destroyed, so that blobs freed during static destruction still
+  // find it.
+  static HostAllocator* allocator = new HostAllocator();
+  return allocator;
+}
+
+size_t HostAllocator::BlockSize(size_t size, bool huge_pages) const {
+  if (huge_pages && size >= kHugePageSize) {
+    return (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  }
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+  // Four classes between consecutive powers of two: round up to a multiple
+  // of a quarter of the power of two below size.
+  size_t power = kAlignment;
+  while (power * 2 < size) {
+    power *= 2;
+  }
+  const size_t step = power / 4;
+  return (size + step - 1) / step * step;
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  const size_t block_size = BlockSize(size, huge_pages_);
+  void* ptr = NULL;
+  std::map<size_t, std::vector<void*> >::iterator it = cache_.find(block_size);
+  if (it != cache_.end() && !it->second.empty()) {
+    ptr = it->second.back();
+    it->second.pop_back();
+    stats_.bytes_cached -= block_size;
+    ++stats_.num_cache_hits;
+  } else {
+    const bool huge = huge_pages_ && block_size >= kHugePageSize;
+    CHECK_EQ(posix_memalign(&ptr, huge ? kHugePageSize : kAlignment,
+        block_size), 0) << "Failed to allocate " << block_size << " bytes";
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+      // Only advice: without transparent huge page support, the block is
+      // simply backed by normal pages.
+      madvise(ptr, block_size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+  in_use_[ptr] = block_size;
+  ++stats_.num_allocs;
+  stats_.bytes_in_use += block_size;
+  if (stats_.bytes_in_use > stats_.peak_bytes_in_use) {
+    stats_.peak_bytes_in_use = stats_.bytes_in_use;
+  }
+  return ptr;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  std::map<void*, size_t>::iterator it = in_use_.find(ptr);
+  CHECK(it != in_use_.end()) << "Freeing a block not from this allocator";
+  const size_t block_size = it->second;
+  in_use_.erase(it);
+  stats_.bytes_in_use -= block_size;
+  if (block_size > cache_limit_) {
+    free(ptr);
+    return;
+  }
+  cache_[block_size].push_back(ptr);
+  stats_.bytes_cached += block_size;
+  ReleaseCacheTo(cache_limit_);
+}
+
+void HostAllocator::ReleaseCache() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  ReleaseCacheTo(0);
+}
+
+// Frees cached blocks, largest first, until at most bytes are cached. Call
+// with the mutex held.
+void HostAllocator::ReleaseCacheTo(size_t bytes) {
+  while (stats_.bytes_cached > bytes) {
+    std::map<size_t, std::vector<void*> >::iterator it = --cache_.end();
+    if (it->second.empty()) {
+      cache_.erase(it);
+      continue;
+    }
+    free(it->second.back());
+    it->second.pop_back();
+    stats_.bytes_cached -= it->first;
+  }
+}
+
+size_t HostAllocator::cache_limit() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return cache_limit_;
+}
+
+void HostAllocator::set_cache_limit(size_t bytes) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  cache_limit_ = bytes;
+  ReleaseCacheTo(cache_limit_);
+}
+
+bool HostAllocator::huge_pages() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return huge_pages_;
+}
+
+void HostAllocator::set_huge_pages(bool huge_pages) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  huge_pages_ = huge_pages;
+}
+
+HostAllocatorStats HostAllocator::stats() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return stats_;
+}
+
+}  // namespace caffe
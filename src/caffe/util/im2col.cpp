@@ -1,37 +1,173 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 
+#include "caffe/common.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+namespace {
+
+// Below this many column buffer elements, im2col_cpu and col2im_cpu run on
+// the calling thread only.
+const int kMinParallelColCount = 1 << 14;
+
+// The geometry shared by im2col and col2im. Column row (c, kh, kw) holds, at
+// (h, w), the image pixel of channel c at row h * stride_h - pad_h + kh and
+// column w * stride_w - pad_w + kw, or zero where that falls in the padding.
+struct Im2colShape {
+  int height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w;
+  int height_col, width_col;
+  // Distance between the starts of consecutive column rows.
+  int col_row_stride;
+
+  // Sets [*w_begin, *w_end) to the columns w of a column row for kernel
+  // column kw whose image column lies inside the image.
+  void ValidColumns(const int kw, int* w_begin, int* w_end) const {
+    const int shift = kw - pad_w;
+    *w_begin = (shift >= 0) ? 0 : (-shift + stride_w - 1) / stride_w;
+    const int last = width - 1 - shift;
+    *w_end = (last < 0) ? 0 : std::min(width_col, last / stride_w + 1);
+    *w_begin = std::min(*w_begin, *w_end);
+  }
+};
+
+// Fills the kernel_h * kernel_w column rows of image channel c. Rows are
+// handled whole: out of range image rows become zero rows, and otherwise only
+// the padded ends of a row are zeroed and the rest is copied, contiguously
+// if stride_w is 1.
+template <typename Dtype>
+void im2col_channel(const Im2colShape& s, const Dtype* data_im,
+    Dtype* data_col, const int c) {
+  const Dtype* im = data_im + c * s.height * s.width;
+  for (int kh = 0; kh < s.kernel_h; ++kh) {
+    for (int kw = 0; kw < s.kernel_w; ++kw) {
+      int w_begin, w_end;
+      s.ValidColumns(kw, &w_begin, &w_end);
+      const int w_shift = kw - s.pad_w;
+      Dtype* col = data_col +
+          ((c * s.kernel_h + kh) * s.kernel_w + kw) * s.col_row_stride;
+      for (int h = 0; h < s.height_col; ++h, col += s.width_col) {
+        const int h_im = h * s.stride_h - s.pad_h + kh;
+        if (h_im < 0 || h_im >= s.height) {
+          std::fill(col, col + s.width_col, Dtype(0));
+          continue;
+        }
+        const Dtype* im_row = im + h_im * s.width;
+        std::fill(col, col + w_begin, Dtype(0));
+        if (s.stride_w == 1) {
+          std::copy(im_row + w_begin + w_shift, im_row + w_end + w_shift,
+                    col + w_begin);
+        } else {
+          for (int w = w_begin; w < w_end; ++w) {
+            col[w] = im_row[w * s.stride_w + w_shift];
+          }
+        }
+        std::fill(col + w_end, col + s.width_col, Dtype(0));
+      }
+    }
+  }
+}
+
+// Accumulates the kernel_h * kernel_w column rows of image channel c into
+// that channel, in the same order as the naive loop over all column rows, so
+// the sums are identical.
+template <typename Dtype>
+void col2im_channel(const Im2colShape& s, const Dtype* data_col,
+    Dtype* data_im, const int c) {
+  Dtype* im = data_im + c * s.height * s.width;
+  std::fill(im, im + s.height * s.width, Dtype(0));
+  for (int kh = 0; kh < s.kernel_h; ++kh) {
+    for (int kw = 0; kw < s.kernel_w; ++kw) {
+      int w_begin, w_end;
+      s.ValidColumns(kw, &w_begin, &w_end);
+      const int w_shift = kw - s.pad_w;
+      const Dtype* col = data_col +
+          ((c * s.kernel_h + kh) * s.kernel_w + kw) * s.col_row_stride;
+      for (int h = 0; h < s.height_col; ++h, col += s.width_col) {
+        const int h_im = h * s.stride_h - s.pad_h + kh;
+        if (h_im < 0 || h_im >= s.height) {
+          continue;
+        }
+        Dtype* im_row = im + h_im * s.width;
+        if (s.stride_w == 1) {
+          for (int w = w_begin; w < w_end; ++w) {
+            im_row[w + w_shift] += col[w];
+          }
+        } else {
+          for (int w = w_begin; w < w_end; ++w) {
+            im_row[w * s.stride_w + w_shift] += col[w];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Runs channel_fn for every channel, spread over Caffe::cpu_thread_pool() if
+// the column buffer is large enough to be worth it. Channels write disjoint
+// parts of the output, so they need no synchronization.
+void RunChannels(const int channels, const int col_count,
+    const boost::function<void(int)>& channel_fn) {
+  if (channels > 1 && col_count >= kMinParallelColCount) {
+    Caffe::cpu_thread_pool()->Run(channels, channel_fn);
+  } else {
+    for (int c = 0; c < channels; ++c) {
+      channel_fn(c);
+    }
+  }
+}
+
+Im2colShape MakeShape(const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_row_stride) {
+  Im2colShape s;
+  s.height = height;
+  s.width = width;
+  s.kernel_h = kernel_h;
+  s.kernel_w = kernel_w;
+  s.pad_h = pad_h;
+  s.pad_w = pad_w;
+  s.stride_h = stride_h;
+  s.stride_w = stride_w;
+  s.height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  s.width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  s.col_row_stride = col_row_stride ? col_row_stride :
+      s.height_col * s.width_col;
+  CHECK_GE(s.col_row_stride, s.height_col * s.width_col);
+  return s;
+}
+
+}  // namespace
+
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col, const int col_row_stride) {
+  const Im2colShape s = MakeShape(height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, col_row_stride);
+  RunChannels(channels,
+      channels * kernel_h * kernel_w * s.height_col * s.width_col,
+      boost::bind(&im2col_channel<Dtype>, boost::cref(s), data_im, data_col,
+                  _1));
+}
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_col) {
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
-  int channels_col = channels * kernel_h * kernel_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % kernel_w;
-    int h_offset = (c / kernel_w) % kernel_h;
-    int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
-            data_im[(c_im * height + h_pad) * width + w_pad];
-        else
-          data_col[(c * height_col + h) * width_col + w] = 0;
-      }
-    }
-  }
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, data_col, 0);
 }
 
 // Explicit instantiation
@@ -43,6 +179,28 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_col);
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, float* data_col, const int col_row_stride);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, double* data_col, const int col_row_stride);
+
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_im, const int col_row_stride) {
+  const Im2colShape s = MakeShape(height, width, patch_h, patch_w,
+      pad_h, pad_w, stride_h, stride_w, col_row_stride);
+  RunChannels(channels,
+      channels * patch_h * patch_w * s.height_col * s.width_col,
+      boost::bind(&col2im_channel<Dtype>, boost::cref(s), data_col, data_im,
+                  _1));
+}
 
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
@@ -50,24 +208,8 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
-  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
-  int channels_col = channels * patch_h * patch_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % patch_w;
-    int h_offset = (c / patch_w) % patch_h;
-    int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
-      }
-    }
-  }
+  col2im_cpu(data_col, channels, height, width, patch_h, patch_w,
+      pad_h, pad_w, stride_h, stride_w, data_im, 0);
 }
 
 // Explicit instantiation
@@ -79,5 +221,13 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_im);
+template void col2im_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, float* data_im, const int col_row_stride);
+template void col2im_cpu<double>(const double* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, double* data_im, const int col_row_stride);
 
 }  // namespace caffe
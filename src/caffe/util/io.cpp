@@ -1,7 +1,9 @@
+#include <boost/thread.hpp>
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <leveldb/db.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -11,6 +13,7 @@
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -27,6 +30,7 @@ using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
+using google::protobuf::internal::WireFormatLite;
 
 bool ReadProtoFromTextFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
@@ -66,23 +70,141 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
-bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum) {
-  cv::Mat cv_img;
-  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
+namespace {
+
+// Reads the frame size from the SOF marker of a JPEG file, and returns false
+// if buffer does not start like one.
+bool ReadJPEGSize(const vector<uchar>& buffer, int* height, int* width) {
+  const int size = buffer.size();
+  if (size < 4 || buffer[0] != 0xFF || buffer[1] != 0xD8) {
+    return false;
+  }
+  int pos = 2;
+  while (pos + 4 <= size && buffer[pos] == 0xFF) {
+    const uchar marker = buffer[pos + 1];
+    if (marker == 0xFF) {  // Fill byte.
+      ++pos;
+      continue;
+    }
+    // SOF0 to SOF15, leaving out DHT, JPG and DAC.
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      if (pos + 9 > size) {
+        return false;
+      }
+      *height = (buffer[pos + 5] << 8) | buffer[pos + 6];
+      *width = (buffer[pos + 7] << 8) | buffer[pos + 8];
+      return true;
+    }
+    if (marker == 0xD9 || marker == 0xDA) {  // EOI or SOS before any SOF.
+      return false;
+    }
+    pos += 2 + ((buffer[pos + 2] << 8) | buffer[pos + 3]);
+  }
+  return false;
+}
+
+}  // namespace
 
-  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
-  if (!cv_img_origin.data) {
+bool ReadImageToCVMatReduced(const string& filename, const int min_height,
+    const int min_width, const bool is_color, cv::Mat* cv_img, int* scale) {
+  *scale = 1;
+  std::ifstream file(filename.c_str(), ios::in | ios::binary);
+  if (!file) {
     LOG(ERROR) << "Could not open or find file " << filename;
     return false;
   }
+  vector<uchar> buffer((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+#if CV_MAJOR_VERSION >= 3
+  int height, width;
+  if (ReadJPEGSize(buffer, &height, &width)) {
+    for (int factor = 8; factor > 1; factor /= 2) {
+      if (height / factor >= min_height && width / factor >= min_width) {
+        *scale = factor;
+        break;
+      }
+    }
+  }
+  switch (*scale) {
+  case 2:
+    cv_read_flag = (is_color ? cv::IMREAD_REDUCED_COLOR_2 :
+        cv::IMREAD_REDUCED_GRAYSCALE_2);
+    break;
+  case 4:
+    cv_read_flag = (is_color ? cv::IMREAD_REDUCED_COLOR_4 :
+        cv::IMREAD_REDUCED_GRAYSCALE_4);
+    break;
+  case 8:
+    cv_read_flag = (is_color ? cv::IMREAD_REDUCED_COLOR_8 :
+        cv::IMREAD_REDUCED_GRAYSCALE_8);
+    break;
+  }
+#endif
+  *cv_img = cv::imdecode(buffer, cv_read_flag);
+  if (!cv_img->data) {
+    LOG(ERROR) << "Could not decode file " << filename;
+    return false;
+  }
+  return true;
+}
+
+bool ReadImageToCVMat(const string& filename, const int height,
+    const int width, const bool is_color, const bool reduced_decode,
+    cv::Mat* cv_img) {
+  cv::Mat cv_img_origin;
+  if (reduced_decode && height > 0 && width > 0) {
+    int scale;
+    if (!ReadImageToCVMatReduced(filename, height, width, is_color,
+                                 &cv_img_origin, &scale)) {
+      return false;
+    }
+  } else {
+    int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+      CV_LOAD_IMAGE_GRAYSCALE);
+    cv_img_origin = cv::imread(filename, cv_read_flag);
+    if (!cv_img_origin.data) {
+      LOG(ERROR) << "Could not open or find file " << filename;
+      return false;
+    }
+  }
   if (height > 0 && width > 0) {
-    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
+    cv::resize(cv_img_origin, *cv_img, cv::Size(width, height));
   } else {
-    cv_img = cv_img_origin;
+    *cv_img = cv_img_origin;
+  }
+  return true;
+}
+
+void CVMatToPlanar(const cv::Mat& cv_img, char* data) {
+  CHECK_EQ(cv_img.depth(), CV_8U) << "Image data type must be unsigned byte";
+  const int channels = cv_img.channels();
+  const int channel_size = cv_img.rows * cv_img.cols;
+  for (int h = 0; h < cv_img.rows; ++h) {
+    const uchar* row = cv_img.ptr<uchar>(h);
+    char* out = data + h * cv_img.cols;
+    if (channels == 1) {
+      std::copy(row, row + cv_img.cols, out);
+      continue;
+    }
+    for (int w = 0; w < cv_img.cols; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        out[c * channel_size + w] = static_cast<char>(row[w * channels + c]);
+      }
+    }
   }
+}
 
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color,
+    const bool reduced_decode, Datum* datum) {
+  cv::Mat cv_img;
+  if (!ReadImageToCVMat(filename, height, width, is_color, reduced_decode,
+                        &cv_img)) {
+    return false;
+  }
   int num_channels = (is_color ? 3 : 1);
   datum->set_channels(num_channels);
   datum->set_height(cv_img.rows);
@@ -91,24 +213,44 @@ bool ReadImageToDatum(const string& filename, const int label,
   datum->clear_data();
   datum->clear_float_data();
   string* datum_string = datum->mutable_data();
-  if (is_color) {
-    for (int c = 0; c < num_channels; ++c) {
-      for (int h = 0; h < cv_img.rows; ++h) {
-        for (int w = 0; w < cv_img.cols; ++w) {
-          datum_string->push_back(
-            static_cast<char>(cv_img.at<cv::Vec3b>(h, w)[c]));
-        }
+  datum_string->resize(num_channels * cv_img.rows * cv_img.cols);
+  CVMatToPlanar(cv_img, &(*datum_string)[0]);
+  return true;
+}
+
+bool ParseDatumHeaderFromArray(const void* buffer, int size, Datum* header,
+    const char** data, int* data_size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+  CodedInputStream input(bytes, size);
+  *data = NULL;
+  *data_size = 0;
+  // Gather the (small) serialized fields other than data and parse those.
+  string fields;
+  int field_start = input.CurrentPosition();
+  while (uint32_t tag = input.ReadTag()) {
+    if (WireFormatLite::GetTagFieldNumber(tag) == Datum::kDataFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+        WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint32_t length;
+      if (!input.ReadVarint32(&length)) {
+        return false;
       }
-    }
-  } else {  // Faster than repeatedly testing is_color for each pixel w/i loop
-    for (int h = 0; h < cv_img.rows; ++h) {
-      for (int w = 0; w < cv_img.cols; ++w) {
-        datum_string->push_back(
-          static_cast<char>(cv_img.at<uchar>(h, w)));
-        }
+      *data = (length > 0) ?
+          reinterpret_cast<const char*>(bytes + input.CurrentPosition()) : NULL;
+      *data_size = length;
+      if (!input.Skip(length)) {
+        return false;
       }
+    } else {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+      fields.append(reinterpret_cast<const char*>(bytes + field_start),
+                    input.CurrentPosition() - field_start);
+    }
+    field_start = input.CurrentPosition();
   }
-  return true;
+  return input.ConsumedEntireMessage() && header->ParseFromString(fields);
 }
 
 leveldb::Options GetLevelDBOptions() {
@@ -119,6 +261,33 @@ leveldb::Options GetLevelDBOptions() {
   return options;
 }
 
+namespace {
+
+boost::mutex& hdf5_mutex() {
+  static boost::mutex mutex;
+  return mutex;
+}
+
+}  // namespace
+
+HDF5Lock::HDF5Lock() {
+  hdf5_mutex().lock();
+}
+
+HDF5Lock::~HDF5Lock() {
+  hdf5_mutex().unlock();
+}
+
+template <>
+hid_t hdf5_native_type<float>() {
+  return H5T_NATIVE_FLOAT;
+}
+
+template <>
+hid_t hdf5_native_type<double>() {
+  return H5T_NATIVE_DOUBLE;
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
@@ -1,11 +1,149 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#ifdef CAFFE_X86_SIMD
+#include <immintrin.h>  // NOLINT(build/include_order)
+#endif
+
+#ifndef USE_MKL
+// The MKL functions declared in mkl_alternate.hpp, spread over
+// caffe::ParallelFor.
+
+// A simple way to define the vsl unary functions. The operation should
+// be in the form e.g. y[i] = sqrt(a[i])
+#define DEFINE_VSL_UNARY_FUNC(name, operation) \
+  template<typename Dtype> \
+  struct v##name##Range { \
+    const Dtype* a; \
+    Dtype* y; \
+    void operator()(const int begin, const int end) const { \
+      for (int i = begin; i < end; ++i) { operation; } \
+    } \
+  }; \
+  template<typename Dtype> \
+  void v##name(const int n, const Dtype* a, Dtype* y) { \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    const v##name##Range<Dtype> range = { a, y }; \
+    caffe::ParallelFor(n, range); \
+  } \
+  void vs##name( \
+    const int n, const float* a, float* y) { \
+    v##name<float>(n, a, y); \
+  } \
+  void vd##name( \
+      const int n, const double* a, double* y) { \
+    v##name<double>(n, a, y); \
+  }
+
+DEFINE_VSL_UNARY_FUNC(Sqr, y[i] = a[i] * a[i]);
+DEFINE_VSL_UNARY_FUNC(Exp, y[i] = exp(a[i]));
+DEFINE_VSL_UNARY_FUNC(Abs, y[i] = fabs(a[i]));
+
+// A simple way to define the vsl unary functions with singular parameter b.
+// The operation should be in the form e.g. y[i] = pow(a[i], b)
+#define DEFINE_VSL_UNARY_FUNC_WITH_PARAM(name, operation) \
+  template<typename Dtype> \
+  struct v##name##Range { \
+    const Dtype* a; \
+    Dtype b; \
+    Dtype* y; \
+    void operator()(const int begin, const int end) const { \
+      for (int i = begin; i < end; ++i) { operation; } \
+    } \
+  }; \
+  template<typename Dtype> \
+  void v##name(const int n, const Dtype* a, const Dtype b, Dtype* y) { \
+    CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    const v##name##Range<Dtype> range = { a, b, y }; \
+    caffe::ParallelFor(n, range); \
+  } \
+  void vs##name( \
+    const int n, const float* a, const float b, float* y) { \
+    v##name<float>(n, a, b, y); \
+  } \
+  void vd##name( \
+      const int n, const double* a, const float b, double* y) { \
+    v##name<double>(n, a, b, y); \
+  }
+
+DEFINE_VSL_UNARY_FUNC_WITH_PARAM(Powx, y[i] = pow(a[i], b));
+
+// A simple way to define the vsl binary functions. The operation should
+// be in the form e.g. y[i] = a[i] + b[i]
+#define DEFINE_VSL_BINARY_FUNC(name, operation) \
+  template<typename Dtype> \
+  struct v##name##Range { \
+    const Dtype* a; \
+    const Dtype* b; \
+    Dtype* y; \
+    void operator()(const int begin, const int end) const { \
+      for (int i = begin; i < end; ++i) { operation; } \
+    } \
+  }; \
+  template<typename Dtype> \
+  void v##name(const int n, const Dtype* a, const Dtype* b, Dtype* y) { \
+    CHECK_GT(n, 0); CHECK(a); CHECK(b); CHECK(y); \
+    const v##name##Range<Dtype> range = { a, b, y }; \
+    caffe::ParallelFor(n, range); \
+  } \
+  void vs##name( \
+    const int n, const float* a, const float* b, float* y) { \
+    v##name<float>(n, a, b, y); \
+  } \
+  void vd##name( \
+      const int n, const double* a, const double* b, double* y) { \
+    v##name<double>(n, a, b, y); \
+  }
+
+DEFINE_VSL_BINARY_FUNC(Add, y[i] = a[i] + b[i]);
+DEFINE_VSL_BINARY_FUNC(Sub, y[i] = a[i] - b[i]);
+DEFINE_VSL_BINARY_FUNC(Mul, y[i] = a[i] * b[i]);
+DEFINE_VSL_BINARY_FUNC(Div, y[i] = a[i] / b[i]);
+
+// In addition, MKL comes with an additional function axpby that is not present
+// in standard blas. We mimic it in a single pass over X and Y.
+template<typename Dtype>
+struct vAxpbyRange {
+  Dtype alpha;
+  const Dtype* x;
+  int incx;
+  Dtype beta;
+  Dtype* y;
+  int incy;
+  void operator()(const int begin, const int end) const {
+    if (beta == 0) {
+      for (int i = begin; i < end; ++i) {
+        y[i * incy] = alpha * x[i * incx];
+      }
+    } else {
+      for (int i = begin; i < end; ++i) {
+        y[i * incy] = alpha * x[i * incx] + beta * y[i * incy];
+      }
+    }
+  }
+};
+void cblas_saxpby(const int N, const float alpha, const float* X,
+                         const int incX, const float beta, float* Y,
+                         const int incY) {
+  const vAxpbyRange<float> range = { alpha, X, incX, beta, Y, incY };
+  caffe::ParallelFor(N, range);
+}
+void cblas_daxpby(const int N, const double alpha, const double* X,
+                         const int incX, const double beta, double* Y,
+                         const int incY) {
+  const vAxpbyRange<double> range = { alpha, X, incX, beta, Y, incY };
+  caffe::ParallelFor(N, range);
+}
+#endif  // USE_MKL
 
 namespace caffe {
 
@@ -53,15 +191,41 @@ template <>
 void caffe_axpy<double>(const int N, const double alpha, const double* X,
     double* Y) { cblas_daxpy(N, alpha, X, 1, Y, 1); }
 
+namespace {
+
 template <typename Dtype>
-void caffe_set(const int N, const Dtype alpha, Dtype* Y) {
-  if (alpha == 0) {
-    memset(Y, 0, sizeof(Dtype) * N);  // NOLINT(caffe/alt_fn)
-    return;
+struct SetRange {
+  Dtype alpha;
+  Dtype* y;
+  void operator()(const int begin, const int end) const {
+    if (alpha == 0) {
+      // NOLINT_NEXT_LINE(caffe/alt_fn)
+      memset(y + begin, 0, sizeof(Dtype) * (end - begin));
+      return;
+    }
+    for (int i = begin; i < end; ++i) {
+      y[i] = alpha;
+    }
   }
-  for (int i = 0; i < N; ++i) {
-    Y[i] = alpha;
+};
+
+template <typename Dtype>
+struct AddScalarRange {
+  Dtype alpha;
+  Dtype* y;
+  void operator()(const int begin, const int end) const {
+    for (int i = begin; i < end; ++i) {
+      y[i] += alpha;
+    }
   }
+};
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_set(const int N, const Dtype alpha, Dtype* Y) {
+  const SetRange<Dtype> range = { alpha, Y };
+  ParallelFor(N, range);
 }
 
 template void caffe_set<int>(const int N, const int alpha, int* Y);
@@ -70,16 +234,14 @@ template void caffe_set<double>(const int N, const double alpha, double* Y);
 
 template <>
 void caffe_add_scalar(const int N, const float alpha, float* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] += alpha;
-  }
+  const AddScalarRange<float> range = { alpha, Y };
+  ParallelFor(N, range);
 }
 
 template <>
 void caffe_add_scalar(const int N, const double alpha, double* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] += alpha;
-  }
+  const AddScalarRange<double> range = { alpha, Y };
+  ParallelFor(N, range);
 }
 
 template <typename Dtype>
@@ -387,4 +549,347 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+namespace {
+
+// In the uint8_transform kernels, broadcast_mean means that mean points to a
+// single value to be subtracted from every element.
+
+template <typename Dtype>
+void uint8_transform_scalar(const int n, const uint8_t* x, const Dtype* mean,
+    const bool broadcast_mean, const Dtype scale, const bool mirror,
+    Dtype* y) {
+  const int mean_step = broadcast_mean ? 0 : 1;
+  if (mirror) {
+    for (int i = 0; i < n; ++i) {
+      y[n - 1 - i] = (static_cast<Dtype>(x[i]) - mean[i * mean_step]) * scale;
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      y[i] = (static_cast<Dtype>(x[i]) - mean[i * mean_step]) * scale;
+    }
+  }
+}
+
+#ifdef CAFFE_X86_SIMD
+
+// The vector kernels below transform the longest prefix of x that fills
+// whole vectors and leave the rest to uint8_transform_scalar. When mirroring,
+// the results of x[i...] are reversed within the register and stored ending
+// at y[n - i], so the remainder lands at the front of y.
+
+__attribute__((target("sse2")))
+void uint8_transform_sse2(const int n, const uint8_t* x, const float* mean,
+    const bool broadcast_mean, const float scale, const bool mirror,
+    float* y) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128 vmean = _mm_set1_ps(mean[0]);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128 v[4];
+    v[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    v[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    v[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    v[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    for (int k = 0; k < 4; ++k) {
+      const __m128 m =
+          broadcast_mean ? vmean : _mm_loadu_ps(mean + i + 4 * k);
+      const __m128 r = _mm_mul_ps(_mm_sub_ps(v[k], m), vscale);
+      if (mirror) {
+        _mm_storeu_ps(y + n - i - 4 * (k + 1),
+                      _mm_shuffle_ps(r, r, _MM_SHUFFLE(0, 1, 2, 3)));
+      } else {
+        _mm_storeu_ps(y + i + 4 * k, r);
+      }
+    }
+  }
+  uint8_transform_scalar(n - i, x + i, broadcast_mean ? mean : mean + i,
+                         broadcast_mean, scale, mirror, mirror ? y : y + i);
+}
+
+__attribute__((target("sse2")))
+void uint8_transform_sse2(const int n, const uint8_t* x, const double* mean,
+    const bool broadcast_mean, const double scale, const bool mirror,
+    double* y) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128d vscale = _mm_set1_pd(scale);
+  const __m128d vmean = _mm_set1_pd(mean[0]);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32_t word;
+    memcpy(&word, x + i, sizeof(word));  // NOLINT(caffe/alt_fn)
+    const __m128i ints = _mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), zero);
+    __m128d v[2];
+    v[0] = _mm_cvtepi32_pd(ints);
+    v[1] = _mm_cvtepi32_pd(_mm_shuffle_epi32(ints, _MM_SHUFFLE(1, 0, 3, 2)));
+    for (int k = 0; k < 2; ++k) {
+      const __m128d m =
+          broadcast_mean ? vmean : _mm_loadu_pd(mean + i + 2 * k);
+      const __m128d r = _mm_mul_pd(_mm_sub_pd(v[k], m), vscale);
+      if (mirror) {
+        _mm_storeu_pd(y + n - i - 2 * (k + 1), _mm_shuffle_pd(r, r, 1));
+      } else {
+        _mm_storeu_pd(y + i + 2 * k, r);
+      }
+    }
+  }
+  uint8_transform_scalar(n - i, x + i, broadcast_mean ? mean : mean + i,
+                         broadcast_mean, scale, mirror, mirror ? y : y + i);
+}
+
+__attribute__((target("avx2")))
+void uint8_transform_avx2(const int n, const uint8_t* x, const float* mean,
+    const bool broadcast_mean, const float scale, const bool mirror,
+    float* y) {
+  const __m256 vscale = _mm256_set1_ps(scale);
+  const __m256 vmean = _mm256_set1_ps(mean[0]);
+  const __m256i reverse = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i))));
+    const __m256 m = broadcast_mean ? vmean : _mm256_loadu_ps(mean + i);
+    const __m256 r = _mm256_mul_ps(_mm256_sub_ps(v, m), vscale);
+    if (mirror) {
+      _mm256_storeu_ps(y + n - i - 8, _mm256_permutevar8x32_ps(r, reverse));
+    } else {
+      _mm256_storeu_ps(y + i, r);
+    }
+  }
+  uint8_transform_scalar(n - i, x + i, broadcast_mean ? mean : mean + i,
+                         broadcast_mean, scale, mirror, mirror ? y : y + i);
+}
+
+__attribute__((target("avx2")))
+void uint8_transform_avx2(const int n, const uint8_t* x, const double* mean,
+    const bool broadcast_mean, const double scale, const bool mirror,
+    double* y) {
+  const __m256d vscale = _mm256_set1_pd(scale);
+  const __m256d vmean = _mm256_set1_pd(mean[0]);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32_t word;
+    memcpy(&word, x + i, sizeof(word));  // NOLINT(caffe/alt_fn)
+    const __m256d v = _mm256_cvtepi32_pd(
+        _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word)));
+    const __m256d m = broadcast_mean ? vmean : _mm256_loadu_pd(mean + i);
+    const __m256d r = _mm256_mul_pd(_mm256_sub_pd(v, m), vscale);
+    if (mirror) {
+      _mm256_storeu_pd(y + n - i - 4,
+                       _mm256_permute4x64_pd(r, _MM_SHUFFLE(0, 1, 2, 3)));
+    } else {
+      _mm256_storeu_pd(y + i, r);
+    }
+  }
+  uint8_transform_scalar(n - i, x + i, broadcast_mean ? mean : mean + i,
+                         broadcast_mean, scale, mirror, mirror ? y : y + i);
+}
+
+#endif  // CAFFE_X86_SIMD
+
+template <typename Dtype>
+void uint8_transform(const int n, const uint8_t* x, const Dtype* mean,
+    const bool broadcast_mean, const Dtype scale, const bool mirror,
+    Dtype* y, const SimdLevel level) {
+  switch (std::min(level, CpuSimdLevel())) {
+#ifdef CAFFE_X86_SIMD
+  case SIMD_AVX2:
+    uint8_transform_avx2(n, x, mean, broadcast_mean, scale, mirror, y);
+    break;
+  case SIMD_SSE2:
+    uint8_transform_sse2(n, x, mean, broadcast_mean, scale, mirror, y);
+    break;
+#endif
+  default:
+    uint8_transform_scalar(n, x, mean, broadcast_mean, scale, mirror, y);
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype* mean, const Dtype scale, const bool mirror, Dtype* y,
+    const SimdLevel level) {
+  uint8_transform(n, x, mean, false, scale, mirror, y, level);
+}
+
+template
+void caffe_cpu_uint8_transform<float>(const int n, const uint8_t* x,
+    const float* mean, const float scale, const bool mirror, float* y,
+    const SimdLevel level);
+
+template
+void caffe_cpu_uint8_transform<double>(const int n, const uint8_t* x,
+    const double* mean, const double scale, const bool mirror, double* y,
+    const SimdLevel level);
+
+template <typename Dtype>
+void caffe_cpu_uint8_transform(const int n, const uint8_t* x,
+    const Dtype mean, const Dtype scale, const bool mirror, Dtype* y,
+    const SimdLevel level) {
+  uint8_transform(n, x, &mean, true, scale, mirror, y, level);
+}
+
+template
+void caffe_cpu_uint8_transform<float>(const int n, const uint8_t* x,
+    const float mean, const float scale, const bool mirror, float* y,
+    const SimdLevel level);
+
+template
+void caffe_cpu_uint8_transform<double>(const int n, const uint8_t* x,
+    const double mean, const double scale, const bool mirror, double* y,
+    const SimdLevel level);
+
+namespace {
+
+template <typename Dtype>
+struct QuantizeS8Range {
+  const Dtype* x;
+  Dtype inv_scale;
+  int8_t* y;
+  void operator()(const int begin, const int end) const {
+    for (int i = begin; i < end; ++i) {
+      const Dtype v = std::min(Dtype(127),
+          std::max(Dtype(-127), x[i] * inv_scale));
+      y[i] = static_cast<int8_t>(std::floor(v + Dtype(0.5)));
+    }
+  }
+};
+
+int32_t dot_s8_scalar(const int K, const int8_t* a, const int8_t* b) {
+  int32_t sum = 0;
+  for (int k = 0; k < K; ++k) {
+    sum += static_cast<int32_t>(a[k]) * b[k];
+  }
+  return sum;
+}
+
+#ifdef CAFFE_X86_SIMD
+
+// The vector dot products multiply 16-bit lanes pairwise into 32-bit sums
+// (madd), which cannot overflow for int8 inputs, and leave the tail that does
+// not fill a whole vector to dot_s8_scalar.
+
+__attribute__((target("sse2")))
+int32_t dot_s8_sse2(const int K, const int8_t* a, const int8_t* b) {
+  __m128i sum = _mm_setzero_si128();
+  int k = 0;
+  for (; k + 16 <= K; k += 16) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+    // Sign-extend the bytes by unpacking them into the high halves of the
+    // 16-bit lanes and shifting them back down.
+    const __m128i a_lo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+    const __m128i a_hi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+    const __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+    const __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(a_lo, b_lo));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(a_hi, b_hi));
+  }
+  int32_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+      dot_s8_scalar(K - k, a + k, b + k);
+}
+
+__attribute__((target("avx2")))
+int32_t dot_s8_avx2(const int K, const int8_t* a, const int8_t* b) {
+  __m256i sum = _mm256_setzero_si256();
+  int k = 0;
+  for (; k + 16 <= K; k += 16) {
+    const __m256i va = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k)));
+    const __m256i vb = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+  }
+  const __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                     _mm256_extracti128_si256(sum, 1));
+  int32_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), half);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+      dot_s8_scalar(K - k, a + k, b + k);
+}
+
+#endif  // CAFFE_X86_SIMD
+
+typedef int32_t (*DotS8Fn)(const int K, const int8_t* a, const int8_t* b);
+
+// The number of columns of C computed by one task of caffe_cpu_gemm_s8, all
+// of them reading the same row of A while it stays in cache.
+const int kGemmS8ColumnBlock = 64;
+// The number of multiply-adds below which caffe_cpu_gemm_s8 runs inline.
+const int64_t kMinParallelGemmS8 = 1 << 20;
+
+struct GemmS8Task {
+  int N;
+  int K;
+  int column_blocks;
+  const int8_t* A;
+  const int8_t* B;
+  int32_t* C;
+  DotS8Fn dot;
+  void operator()(const int task) const {
+    const int i = task / column_blocks;
+    const int j_begin = (task % column_blocks) * kGemmS8ColumnBlock;
+    const int j_end = std::min(N, j_begin + kGemmS8ColumnBlock);
+    const int8_t* a = A + static_cast<int64_t>(i) * K;
+    int32_t* c = C + static_cast<int64_t>(i) * N;
+    for (int j = j_begin; j < j_end; ++j) {
+      c[j] = dot(K, a, B + static_cast<int64_t>(j) * K);
+    }
+  }
+};
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_cpu_quantize_s8(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y) {
+  CHECK_GT(scale, 0);
+  const QuantizeS8Range<Dtype> range = { x, Dtype(1) / scale, y };
+  ParallelFor(n, range);
+}
+
+template
+void caffe_cpu_quantize_s8<float>(const int n, const float* x,
+    const float scale, int8_t* y);
+
+template
+void caffe_cpu_quantize_s8<double>(const int n, const double* x,
+    const double scale, int8_t* y);
+
+void caffe_cpu_gemm_s8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C, const SimdLevel level) {
+  GemmS8Task task = { N, K, (N + kGemmS8ColumnBlock - 1) / kGemmS8ColumnBlock,
+                      A, B, C, dot_s8_scalar };
+  switch (std::min(level, CpuSimdLevel())) {
+#ifdef CAFFE_X86_SIMD
+  case SIMD_AVX2:
+    task.dot = dot_s8_avx2;
+    break;
+  case SIMD_SSE2:
+    task.dot = dot_s8_sse2;
+    break;
+#endif
+  default:
+    break;
+  }
+  const int num_tasks = M * task.column_blocks;
+  if (num_tasks > 1 &&
+      static_cast<int64_t>(M) * N * K >= kMinParallelGemmS8) {
+    Caffe::cpu_thread_pool()->Run(num_tasks, task);
+  } else {
+    for (int t = 0; t < num_tasks; ++t) {
+      task(t);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,129 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  // One call to Run. It lives on the caller's stack until all its tasks are
+  // done, and sits in jobs_ while it still has tasks nobody picked up.
+  struct Job {
+    const boost::function<void(int)>* task;
+    int num_tasks;
+    int next;
+    int done;
+  };
+
+  sync() : stop_(false) {}
+
+  // Hands out the next index of job; call with mutex_ held.
+  int Take(Job* job) {
+    const int index = job->next++;
+    if (job->next == job->num_tasks) {
+      jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+    }
+    return index;
+  }
+
+  boost::mutex mutex_;
+  boost::condition_variable work_available_;
+  boost::condition_variable job_done_;
+  std::deque<Job*> jobs_;
+  bool stop_;
+  boost::thread_group threads_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads), sync_(new sync()) {
+  CHECK_GE(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    sync_->threads_.create_thread(boost::bind(&ThreadPool::WorkerEntry, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->stop_ = true;
+  }
+  sync_->work_available_.notify_all();
+  sync_->threads_.join_all();
+}
+
+void ThreadPool::WorkerEntry() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (true) {
+    while (!sync_->stop_ && sync_->jobs_.empty()) {
+      sync_->work_available_.wait(lock);
+    }
+    if (sync_->stop_) {
+      return;
+    }
+    sync::Job* job = sync_->jobs_.front();
+    const int index = sync_->Take(job);
+    lock.unlock();
+    (*job->task)(index);
+    lock.lock();
+    if (++job->done == job->num_tasks) {
+      sync_->job_done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::Run(int num_tasks, const boost::function<void(int)>& task) {
+  if (num_tasks <= 0) {
+    return;
+  }
+  if (num_threads_ == 0 || num_tasks == 1) {
+    for (int i = 0; i < num_tasks; ++i) {
+      task(i);
+    }
+    return;
+  }
+  // The job is on our stack and pool threads may still be running its tasks,
+  // so an interrupted caller (e.g. a stopping prefetch thread) must not leave
+  // this function early.
+  boost::this_thread::disable_interruption no_interruption;
+  sync::Job job = { &task, num_tasks, 0, 0 };
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  sync_->jobs_.push_back(&job);
+  sync_->work_available_.notify_all();
+  while (job.next < job.num_tasks) {
+    const int index = sync_->Take(&job);
+    lock.unlock();
+    task(index);
+    lock.lock();
+    ++job.done;
+  }
+  while (job.done < job.num_tasks) {
+    sync_->job_done_.wait(lock);
+  }
+}
+
+namespace {
+
+void RunRange(const boost::function<void(int, int)>& range_fn, const int n,
+    const int range_size, const int range) {
+  const int begin = range * range_size;
+  range_fn(begin, std::min(n, begin + range_size));
+}
+
+}  // namespace
+
+void RunParallelFor(const int n,
+    const boost::function<void(int, int)>& range_fn) {
+  const int num_ranges = std::max(1,
+      std::min(Caffe::cpu_threads(), n / Caffe::cpu_grain_size()));
+  // Whole cache lines of floats, so that ranges do not share the lines they
+  // write.
+  const int range_size = ((n - 1) / num_ranges + 16) / 16 * 16;
+  Caffe::cpu_thread_pool()->Run((n + range_size - 1) / range_size,
+      boost::bind(&RunRange, boost::cref(range_fn), n, range_size, _1));
+}
+
+}  // namespace caffe
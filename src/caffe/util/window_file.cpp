@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/window_file.hpp"
+
+namespace caffe {
+
+namespace {
+
+// A binary window file is this header followed by arrays of 32-bit values:
+// the path offsets and then the channels, height and width of each image;
+// the image index, label, overlap, x1, y1, x2 and y2 of each window; and at
+// the end the NUL terminated image paths. Values are in host byte order.
+struct WindowFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_images;
+  uint32_t num_windows;
+  uint32_t path_bytes;
+};
+
+const char kWindowFileMagic[8] = { 'C', 'A', 'F', 'F', 'E', 'W', 'I', 'N' };
+const uint32_t kWindowFileVersion = 1;
+
+size_t WindowFileSize(const WindowFileHeader& header) {
+  return sizeof(header) + sizeof(uint32_t) *
+      (4 * static_cast<size_t>(header.num_images) +
+       7 * static_cast<size_t>(header.num_windows)) + header.path_bytes;
+}
+
+struct Window {
+  int32_t image;
+  int32_t label;
+  float overlap;
+  int32_t x1, y1, x2, y2;
+};
+
+bool HigherOverlap(const Window& a, const Window& b) {
+  return a.overlap > b.overlap;
+}
+
+}  // namespace
+
+WindowFile::WindowFile()
+    : mapped_(NULL), data_(NULL), size_(0), num_images_(0),
+      num_windows_(0) {}
+
+WindowFile::~WindowFile() {
+  Close();
+}
+
+void WindowFile::Close() {
+  if (mapped_) {
+    munmap(mapped_, size_);
+    mapped_ = NULL;
+  }
+  owned_.clear();
+  data_ = NULL;
+  size_ = 0;
+  num_images_ = 0;
+  num_windows_ = 0;
+}
+
+void WindowFile::Open(const string& filename) {
+  Close();
+  char magic[sizeof(kWindowFileMagic)] = { 0 };
+  std::ifstream infile(filename.c_str(), ios::in | ios::binary);
+  CHECK(infile.good()) << "Failed to open window file " << filename;
+  infile.read(magic, sizeof(magic));
+  infile.close();
+  if (memcmp(magic, kWindowFileMagic, sizeof(magic)) == 0) {
+    Map(filename);
+  } else {
+    ParseText(filename);
+  }
+}
+
+void WindowFile::ParseText(const string& filename) {
+  std::ifstream infile(filename.c_str());
+  CHECK(infile.good()) << "Failed to open window file " << filename;
+  vector<string> paths;
+  vector<int32_t> image_sizes;
+  vector<Window> windows;
+  string hashtag;
+  int image_index;
+  while (infile >> hashtag >> image_index) {
+    CHECK_EQ(hashtag, "#");
+    string path;
+    int channels, height, width, num_windows;
+    infile >> path >> channels >> height >> width >> num_windows;
+    CHECK(infile.good()) << "Malformed header of image " << image_index
+        << " in window file " << filename;
+    for (int i = 0; i < num_windows; ++i) {
+      Window window;
+      window.image = paths.size();
+      infile >> window.label >> window.overlap >> window.x1 >> window.y1
+             >> window.x2 >> window.y2;
+      CHECK(!infile.fail()) << "Malformed window " << i << " of image "
+          << image_index << " in window file " << filename;
+      windows.push_back(window);
+    }
+    paths.push_back(path);
+    image_sizes.push_back(channels);
+    image_sizes.push_back(height);
+    image_sizes.push_back(width);
+  }
+  if (paths.empty()) {
+    LOG(FATAL) << "Window file is empty";
+  }
+  // Stable, so that windows of equal overlap keep their order in the file.
+  std::stable_sort(windows.begin(), windows.end(), HigherOverlap);
+
+  WindowFileHeader header;
+  std::copy(kWindowFileMagic, kWindowFileMagic + sizeof(kWindowFileMagic),
+            header.magic);
+  header.version = kWindowFileVersion;
+  header.num_images = paths.size();
+  header.num_windows = windows.size();
+  header.path_bytes = 0;
+  for (int i = 0; i < paths.size(); ++i) {
+    header.path_bytes += paths[i].size() + 1;
+  }
+  const size_t size = WindowFileSize(header);
+  owned_.assign((size + sizeof(uint32_t) - 1) / sizeof(uint32_t), 0);
+  char* data = reinterpret_cast<char*>(&owned_[0]);
+  std::copy(reinterpret_cast<const char*>(&header),
+            reinterpret_cast<const char*>(&header + 1), data);
+  uint32_t* path_offsets = reinterpret_cast<uint32_t*>(data + sizeof(header));
+  int32_t* sizes = reinterpret_cast<int32_t*>(path_offsets + paths.size());
+  int32_t* window_image = sizes + image_sizes.size();
+  int32_t* window_label = window_image + windows.size();
+  float* window_overlap = reinterpret_cast<float*>(
+      window_label + windows.size());
+  int32_t* window_x1 = reinterpret_cast<int32_t*>(
+      window_overlap + windows.size());
+  int32_t* window_y1 = window_x1 + windows.size();
+  int32_t* window_x2 = window_y1 + windows.size();
+  int32_t* window_y2 = window_x2 + windows.size();
+  char* path_data = reinterpret_cast<char*>(window_y2 + windows.size());
+  uint32_t path_offset = 0;
+  for (int i = 0; i < paths.size(); ++i) {
+    path_offsets[i] = path_offset;
+    std::copy(paths[i].begin(), paths[i].end(), path_data + path_offset);
+    path_offset += paths[i].size() + 1;
+  }
+  std::copy(image_sizes.begin(), image_sizes.end(), sizes);
+  for (int j = 0; j < windows.size(); ++j) {
+    window_image[j] = windows[j].image;
+    window_label[j] = windows[j].label;
+    window_overlap[j] = windows[j].overlap;
+    window_x1[j] = windows[j].x1;
+    window_y1[j] = windows[j].y1;
+    window_x2[j] = windows[j].x2;
+    window_y2[j] = windows[j].y2;
+  }
+  SetData(data, size);
+}
+
+void WindowFile::Map(const string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Failed to open window file " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  const size_t size = file_stat.st_size;
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(mapped != MAP_FAILED) << "Failed to map window file " << filename;
+  mapped_ = mapped;
+  size_ = size;
+  SetData(static_cast<const char*>(mapped), size);
+}
+
+void WindowFile::SetData(const char* data, const size_t size) {
+  WindowFileHeader header;
+  CHECK_GE(size, sizeof(header)) << "Truncated window file";
+  std::copy(data, data + sizeof(header), reinterpret_cast<char*>(&header));
+  CHECK_EQ(header.version, kWindowFileVersion)
+      << "Unsupported window file version";
+  CHECK_EQ(WindowFileSize(header), size) << "Truncated window file";
+  data_ = data;
+  size_ = size;
+  num_images_ = header.num_images;
+  CHECK_GT(num_images_, 0) << "Window file is empty";
+  num_windows_ = header.num_windows;
+  path_offsets_ = reinterpret_cast<const uint32_t*>(data + sizeof(header));
+  image_sizes_ = reinterpret_cast<const int32_t*>(path_offsets_ + num_images_);
+  window_image_ = image_sizes_ + 3 * num_images_;
+  window_label_ = window_image_ + num_windows_;
+  window_overlap_ = reinterpret_cast<const float*>(
+      window_label_ + num_windows_);
+  window_x1_ = reinterpret_cast<const int32_t*>(
+      window_overlap_ + num_windows_);
+  window_y1_ = window_x1_ + num_windows_;
+  window_x2_ = window_y1_ + num_windows_;
+  window_y2_ = window_x2_ + num_windows_;
+  paths_ = reinterpret_cast<const char*>(window_y2_ + num_windows_);
+  CHECK_EQ(paths_[header.path_bytes - 1], '\0') << "Truncated window file";
+}
+
+void WindowFile::WriteBinary(const string& filename) const {
+  CHECK(data_) << "No window file is open";
+  std::ofstream outfile(filename.c_str(),
+                        ios::out | ios::trunc | ios::binary);
+  CHECK(outfile.good()) << "Failed to open " << filename;
+  outfile.write(data_, size_);
+  CHECK(outfile.good()) << "Failed to write " << filename;
+}
+
+int WindowFile::CountOverlapAtLeast(const float threshold) const {
+  // The first window whose overlap is below threshold.
+  int begin = 0;
+  int end = num_windows_;
+  while (begin < end) {
+    const int middle = begin + (end - begin) / 2;
+    if (window_overlap_[middle] >= threshold) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+}  // namespace caffe
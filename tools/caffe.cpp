@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -29,6 +30,15 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(cpu_threads, 0,
+    "Optional; the number of threads CPU kernels use, 0 for all cores.");
+DEFINE_int32(cpu_grain_size, 0,
+    "Optional; the fewest elements element-wise CPU kernels give a thread.");
+DEFINE_int32(host_cache_mb, -1,
+    "Optional; the MB of freed host memory kept for reuse, 0 to disable "
+    "caching; -1 keeps the default.");
+DEFINE_bool(host_huge_pages, false,
+    "Optional; back large host blobs with transparent huge pages.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -261,6 +271,12 @@ int time() {
       " milliseconds.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() <<
       " milliseconds.";
+  const caffe::HostAllocatorStats host_stats =
+      caffe::HostAllocator::Get()->stats();
+  LOG(INFO) << "Host memory: " << host_stats.bytes_in_use << " bytes in use, "
+      << host_stats.peak_bytes_in_use << " peak, "
+      << host_stats.num_cache_hits << " of " << host_stats.num_allocs
+      << " allocations served from cache.";
   LOG(INFO) << "*** Benchmark ends ***";
   return 0;
 }
@@ -279,6 +295,15 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::Caffe::set_cpu_threads(FLAGS_cpu_threads);
+  if (FLAGS_cpu_grain_size > 0) {
+    caffe::Caffe::set_cpu_grain_size(FLAGS_cpu_grain_size);
+  }
+  if (FLAGS_host_cache_mb >= 0) {
+    caffe::HostAllocator::Get()->set_cache_limit(
+        static_cast<size_t>(FLAGS_host_cache_mb) << 20);
+  }
+  caffe::HostAllocator::Get()->set_huge_pages(FLAGS_host_huge_pages);
   if (argc == 2) {
     return GetBrewFunction(caffe::string(argv[1]))();
   } else {
@@ -0,0 +1,102 @@
+// Picks the quantization_param input_scale of every Convolution and
+// InnerProduct layer of a net by running a few batches from its data layers
+// through the float forward pass in the TEST phase, and writes the net
+// definition with the scales filled in. Each scale maps the largest magnitude
+// seen in the layer's bottom to 127.
+// Usage:
+//    calibrate_quantization net_proto_file trained_net_file iterations
+//        output_proto_file
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::LayerParameter;
+using caffe::LayerParameter_LayerType_CONVOLUTION;
+using caffe::LayerParameter_LayerType_INNER_PRODUCT;
+using caffe::Net;
+using caffe::NetParameter;
+using std::map;
+using std::string;
+using std::vector;
+
+bool IsQuantizable(const LayerParameter& layer_param) {
+  return layer_param.type() == LayerParameter_LayerType_CONVOLUTION ||
+      layer_param.type() == LayerParameter_LayerType_INNER_PRODUCT;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: calibrate_quantization net_proto_file "
+               << "trained_net_file iterations output_proto_file";
+    return 1;
+  }
+  const int iterations = atoi(argv[3]);
+  CHECK_GT(iterations, 0);
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+
+  NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  // Calibrate on the float forward pass, whatever scales the net has now.
+  NetParameter float_param(net_param);
+  for (int i = 0; i < float_param.layers_size(); ++i) {
+    float_param.mutable_layers(i)->clear_quantization_param();
+  }
+  Net<float> net(float_param);
+  net.CopyTrainedLayersFrom(argv[2]);
+
+  // Each layer's bottoms are read right before it runs, since later layers
+  // may work in place on them or reuse their memory.
+  map<string, float> max_input;
+  for (int iter = 0; iter < iterations; ++iter) {
+    for (int layer_id = 0; layer_id < net.layers().size(); ++layer_id) {
+      if (IsQuantizable(net.layers()[layer_id]->layer_param())) {
+        float& max_abs = max_input[net.layer_names()[layer_id]];
+        const vector<Blob<float>*>& bottom = net.bottom_vecs()[layer_id];
+        for (int i = 0; i < bottom.size(); ++i) {
+          const float* data = bottom[i]->cpu_data();
+          for (int j = 0; j < bottom[i]->count(); ++j) {
+            max_abs = std::max(max_abs, std::fabs(data[j]));
+          }
+        }
+      }
+      net.ForwardFromTo(layer_id, layer_id);
+    }
+    LOG(INFO) << "Calibrated on batch " << iter + 1 << " of " << iterations;
+  }
+
+  int num_quantized = 0;
+  for (int i = 0; i < net_param.layers_size(); ++i) {
+    LayerParameter* layer_param = net_param.mutable_layers(i);
+    if (!IsQuantizable(*layer_param) ||
+        !max_input.count(layer_param->name())) {
+      continue;
+    }
+    const float max_abs = max_input[layer_param->name()];
+    // A bottom that stayed zero quantizes to zeros with any scale.
+    const float input_scale = max_abs > 0 ? max_abs / 127 : 1;
+    layer_param->mutable_quantization_param()->set_input_scale(input_scale);
+    LOG(INFO) << "Layer " << layer_param->name() << ": largest input "
+              << max_abs << ", input_scale " << input_scale;
+    ++num_quantized;
+  }
+  LOG(INFO) << "Writing " << num_quantized << " quantized layers to "
+            << argv[4];
+  caffe::WriteProtoToTextFile(net_param, argv[4]);
+  return 0;
+}
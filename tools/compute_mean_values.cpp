@@ -0,0 +1,42 @@
+// Derives per-channel mean values from a mean image, e.g. the output of
+// compute_image_mean, and prints them in the form expected by the
+// mean_value field of TransformationParameter.
+// Usage:
+//    compute_mean_values mean_file
+#include <glog/logging.h>
+
+#include <iostream>  // NOLINT(readability/streams)
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+using caffe::BlobProto;
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 2) {
+    LOG(ERROR) << "Usage: compute_mean_values mean_file";
+    return 1;
+  }
+
+  BlobProto blob_proto;
+  caffe::ReadProtoFromBinaryFileOrDie(argv[1], &blob_proto);
+  const int channels = blob_proto.channels();
+  const int channel_size = blob_proto.height() * blob_proto.width();
+  CHECK_GT(channels, 0);
+  CHECK_GT(channel_size, 0);
+  CHECK_GE(blob_proto.data_size(), channels * channel_size)
+      << "Mean file has fewer values than its dimensions call for";
+  LOG(INFO) << "Averaging " << channels << " channels of " << channel_size
+            << " values each";
+
+  // Only the first mean image is used, as in BaseDataLayer.
+  for (int c = 0; c < channels; ++c) {
+    double sum = 0;
+    for (int i = 0; i < channel_size; ++i) {
+      sum += blob_proto.data(c * channel_size + i);
+    }
+    std::cout << "mean_value: " << sum / channel_size << std::endl;
+  }
+  return 0;
+}
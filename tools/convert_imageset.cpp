@@ -36,6 +36,8 @@ DEFINE_bool(shuffle, false,
 DEFINE_string(backend, "lmdb", "The backend for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_bool(reduced_decode, false,
+    "Let the JPEG decoder scale images down by 2, 4 or 8 before resizing");
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -128,7 +130,8 @@ int main(int argc, char** argv) {
 
   for (int line_id = 0; line_id < lines.size(); ++line_id) {
     if (!ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color, &datum)) {
+        lines[line_id].second, resize_height, resize_width, is_color,
+        FLAGS_reduced_decode, &datum)) {
       continue;
     }
     if (!data_size_initialized) {
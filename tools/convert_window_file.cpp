@@ -0,0 +1,26 @@
+// Converts a text window file, as read by WindowDataLayer, to the binary
+// format that the layer memory-maps instead of parsing. The windows come out
+// sorted by overlap, so the layer finds its foreground and background windows
+// without going through them.
+// Usage:
+//    convert_window_file text_window_file binary_window_file
+#include <glog/logging.h>
+
+#include "caffe/util/window_file.hpp"
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: convert_window_file text_window_file "
+               << "binary_window_file";
+    return 1;
+  }
+
+  caffe::WindowFile windows;
+  windows.Open(argv[1]);
+  LOG(INFO) << "Read " << windows.num_windows() << " windows of "
+            << windows.num_images() << " images";
+  windows.WriteBinary(argv[2]);
+  LOG(INFO) << "Wrote " << argv[2];
+  return 0;
+}